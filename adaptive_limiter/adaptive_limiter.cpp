@@ -0,0 +1,244 @@
+#include "adaptive_limiter.hpp"
+#include "../queue_sim/queue_sim.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace NAdaptiveLimiter;
+
+// the inflight limit as it was in the config
+struct TStaticLimiter {
+    uint32_t Limit;
+    uint32_t Inflight = 0;
+
+    bool TryAcquire() {
+        if (Inflight < Limit) {
+            ++Inflight;
+            return true;
+        }
+        return false;
+    }
+    void Release(uint64_t, uint64_t) {--Inflight;}
+    uint32_t GetLimit() const {return Limit;}
+};
+
+struct TPhase {
+    double Rps;
+    // a slower dependency, a heavier model: the same pods serve fewer requests
+    double ServiceScale;
+    double DurationMs;
+};
+
+struct TPhaseStats {
+    uint64_t Requests = 0;
+    uint64_t Rejected = 0;
+    std::vector<double> Latencies;
+    double LimitSum = 0;
+    uint64_t LimitSamples = 0;
+    uint32_t LimitAfter1s = 0;
+    uint32_t LimitAfter5s = 0;
+};
+
+// 5 pods of 2 workers each with a FIFO queue, requests routed at random (as in math_posts/queue_rejects.md),
+// each pod admits by its own limiter; the latency is queue wait + service.
+// Virtual time in ms as in queue_sim, the limiters get nanoseconds
+template<class TLimiter, class TMakeLimiter>
+std::vector<TPhaseStats> Replay(const std::vector<TPhase>& phases, TMakeLimiter&& makeLimiter) {
+    constexpr uint32_t PodsNum = 5;
+    constexpr uint32_t WorkersNum = 2;
+    NQueueSim::TRng rng(2026);
+    const NQueueSim::TShiftedExponentialService service{7, 15, 60};
+
+    struct TPod {
+        std::unique_ptr<TLimiter> Limiter;
+        uint32_t Busy = 0;
+        // arrival time and service time of waiting requests
+        std::deque<std::pair<double, double>> Waiting;
+    };
+    struct TCompletion {
+        double Time;
+        uint32_t Pod;
+        double Arrival;
+        bool operator>(const TCompletion& other) const {return Time > other.Time;}
+    };
+    std::vector<TPod> pods(PodsNum);
+    for(auto& pod : pods) {
+        pod.Limiter = makeLimiter();
+    }
+    std::priority_queue<TCompletion, std::vector<TCompletion>, std::greater<>> completions;
+    std::vector<TPhaseStats> stats(phases.size());
+    size_t phase = 0;
+    double phaseStart = 0;
+    double nextLimitSample = 0;
+
+    auto complete = [&](const TCompletion& completion) {
+        TPod& pod = pods[completion.Pod];
+        const double latency = completion.Time - completion.Arrival;
+        pod.Limiter->Release(uint64_t(latency * 1e6), uint64_t(completion.Time * 1e6));
+        stats[phase].Latencies.push_back(latency);
+        if (pod.Waiting.empty()) {
+            --pod.Busy;
+        } else {
+            auto [arrival, serviceMs] = pod.Waiting.front();
+            pod.Waiting.pop_front();
+            completions.push(TCompletion{completion.Time + serviceMs, completion.Pod, arrival});
+        }
+    };
+
+    double now = 0;
+    while(phase < phases.size()) {
+        now += rng.Exponential(1000 / phases[phase].Rps);
+        while(!completions.empty() && completions.top().Time <= now) {
+            const TCompletion completion = completions.top();
+            completions.pop();
+            complete(completion);
+        }
+        while(nextLimitSample <= now) {
+            const uint32_t limit = pods[0].Limiter->GetLimit();
+            stats[phase].LimitSum += limit;
+            ++stats[phase].LimitSamples;
+            if (nextLimitSample - phaseStart <= 1000) {
+                stats[phase].LimitAfter1s = limit;
+            }
+            if (nextLimitSample - phaseStart <= 5000) {
+                stats[phase].LimitAfter5s = limit;
+            }
+            nextLimitSample += 100;
+        }
+        if (now - phaseStart >= phases[phase].DurationMs) {
+            phaseStart = now;
+            if (++phase == phases.size()) {
+                break;
+            }
+        }
+
+        ++stats[phase].Requests;
+        const uint32_t podIndex = rng.Below(PodsNum);
+        TPod& pod = pods[podIndex];
+        if (!pod.Limiter->TryAcquire()) {
+            ++stats[phase].Rejected;
+            continue;
+        }
+        const double serviceMs = service.Next(rng) * phases[phase].ServiceScale;
+        if (pod.Busy < WorkersNum) {
+            ++pod.Busy;
+            completions.push(TCompletion{now + serviceMs, podIndex, now});
+        } else {
+            pod.Waiting.emplace_back(now, serviceMs);
+        }
+    }
+    return stats;
+}
+
+void Print(std::string_view name, const std::vector<TPhase>& phases, std::vector<TPhaseStats> stats) {
+    std::cout << std::setw(14) << name;
+    for(size_t i = 0; i < phases.size(); ++i) {
+        auto& s = stats[i];
+        std::cout << " | " << std::fixed << std::setprecision(2) << std::setw(5) << s.Rejected * 100.0 / s.Requests << "%";
+        // every request of the phase rejected: no latencies
+        if (s.Latencies.empty()) {
+            std::cout << std::setw(7) << "-";
+        } else {
+            auto p99 = s.Latencies.begin() + s.Latencies.size() * 99 / 100;
+            std::nth_element(s.Latencies.begin(), p99, s.Latencies.end());
+            std::cout << std::setprecision(0) << std::setw(5) << *p99 << "ms";
+        }
+        std::cout << std::setprecision(1) << std::setw(5) << s.LimitSum / s.LimitSamples
+            << " (" << std::setw(2) << s.LimitAfter1s << "," << std::setw(2) << s.LimitAfter5s << ")";
+    }
+    std::cout << std::endl;
+}
+
+template<class TAlgo>
+void ReportAdaptive(const std::vector<TPhase>& phases, TLimiterOptions options) {
+    Print(TAlgo::Name, phases, Replay<TAdaptiveLimiter<TAlgo>>(phases, [&]() {
+        return std::make_unique<TAdaptiveLimiter<TAlgo>>(options);
+    }));
+}
+
+// acquire + release from real threads with the real clock: the cost of the lock free path and the metrics
+template<class TAlgo>
+void BenchConcurrent(size_t threadsNum, uint64_t iters) {
+    TLimiterOptions options;
+    options.WindowNs = 1'000'000;
+    TAdaptiveLimiter<TAlgo> limiter(options);
+    std::atomic<uint64_t> admitted = 0;
+    auto started = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < threadsNum; ++t) {
+        threads.emplace_back([&]() {
+            uint64_t localAdmitted = 0;
+            for(uint64_t i = 0; i < iters; ++i) {
+                const uint64_t start = std::chrono::steady_clock::now().time_since_epoch().count();
+                if (limiter.TryAcquire()) {
+                    ++localAdmitted;
+                    limiter.Release(1000 + i % 100, start + 1000);
+                }
+            }
+            admitted += localAdmitted;
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    auto finished = std::chrono::high_resolution_clock::now();
+    std::cout << std::setw(14) << TAlgo::Name << ", " << threadsNum << " threads: "
+        << std::setprecision(1) << std::chrono::duration<double, std::nano>(finished - started).count() / iters
+        << " ns per acquire+release per thread (clock read included), admitted " << admitted * 100.0 / (iters * threadsNum)
+        << "%, limit " << limiter.GetLimit() << ", inflight " << limiter.GetInflight()
+        << ", no load rtt " << limiter.GetNoLoadRttNs() << " ns, queue estimate " << limiter.GetQueueEstimate() << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    const double phaseSeconds = argc > 1 ? atof(argv[1]) : 60;
+    // capacity is 5 pods * 2 workers / 21.6 ms = 463 rps, half of it when the service gets 2 times slower
+    const std::vector<TPhase> phases = {
+        {200, 1, phaseSeconds * 1000},
+        {400, 1, phaseSeconds * 1000},
+        {600, 1, phaseSeconds * 1000},
+        {200, 2, phaseSeconds * 1000},
+        {200, 1, phaseSeconds * 1000},
+    };
+
+    std::cout << "5 pods of 2 workers, random routing, service 7 + exp(15) ms cut at 60, " << phaseSeconds << " s per phase\n"
+        << "per phase: rejects, p99 latency, mean limit of a pod (limit 1 s and 5 s after the phase start)\n"
+        << std::setw(14) << "limiter";
+    for(const auto& phase : phases) {
+        std::cout << " | " << std::setw(5) << phase.Rps << " rps, service x" << phase.ServiceScale << "        ";
+    }
+    std::cout << std::endl;
+
+    for(uint32_t limit : {2, 5, 10, 50}) {
+        Print("static " + std::to_string(limit), phases, Replay<TStaticLimiter>(phases, [&]() {
+            return std::make_unique<TStaticLimiter>(TStaticLimiter{limit});
+        }));
+    }
+
+    TLimiterOptions options;
+    options.InitialLimit = 5;
+    options.MaxLimit = 100;
+    options.WindowNs = 250'000'000;
+    // a mean of a few samples of 7..60 ms is too noisy for the no load rtt
+    options.MinWindowSamples = 50;
+    ReportAdaptive<TVegasLimit>(phases, options);
+    ReportAdaptive<TGradientLimit>(phases, options);
+    ReportAdaptive<TLittleLimit>(phases, options);
+
+    std::cout << std::endl;
+    const size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        BenchConcurrent<TVegasLimit>(threadsNum, 10'000'000);
+        BenchConcurrent<TGradientLimit>(threadsNum, 10'000'000);
+        BenchConcurrent<TLittleLimit>(threadsNum, 10'000'000);
+    }
+    return 0;
+}
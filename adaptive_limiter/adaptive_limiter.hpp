@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <string_view>
+
+// Inflight limit computed online from latencies, instead of a hand tuned number in a config
+// (the "5 -> 4 -> 2" of math_posts/queue_rejects.md).
+//
+// TAdaptiveLimiter<TAlgo> admits a request while inflight < limit. Every release reports the request
+// latency into lock free window accumulators; the first release after the window end takes
+// the window (under a try lock, nobody waits for it) and asks TAlgo for the next limit:
+// - TVegasLimit: queue = limit * (1 - noLoadRtt / rtt); grow while the queue is short, shrink when long
+// - TGradientLimit: limit * clamp(tolerance * noLoadRtt / rtt) + a small queue allowance
+// - TLittleLimit: probe upwards while the rtt is fine, on overload Little's law: throughput * noLoadRtt * headroom
+// A limit only grows when it was actually reached (not app limited), so a quiet period doesn't inflate it.
+// The no load rtt is the lowest window mean rtt seen, not the lowest sample: with 7..60 ms service times
+// the fastest request says nothing about the load. Time is passed explicitly in nanoseconds, as in rps_limiter.
+
+namespace NAdaptiveLimiter {
+
+struct TLimiterOptions {
+    uint32_t InitialLimit = 10;
+    uint32_t MinLimit = 1;
+    uint32_t MaxLimit = 1000;
+    uint64_t WindowNs = 100'000'000;
+    // a window with fewer samples is extended
+    uint64_t MinWindowSamples = 10;
+    // the no load rtt grows by this share every window until a window mean is lower:
+    // otherwise a rtt that grew for good (new model, slower dependency) is never accepted
+    double NoLoadRttDrift = 0.01;
+};
+
+struct TWindowStats {
+    // fractional, so that small steps accumulate; the enforced limit is the rounded one
+    double Limit = 0;
+    uint32_t EnforcedLimit = 0;
+    uint32_t MaxInflight = 0;
+    uint64_t Samples = 0;
+    uint64_t DurationNs = 0;
+    double MeanRttNs = 0;
+    double NoLoadRttNs = 0;
+
+    bool AtLimit() const {return MaxInflight >= EnforcedLimit;}
+    bool AppLimited() const {return MaxInflight * 2 < Limit;}
+};
+
+class TVegasLimit {
+public:
+    static constexpr std::string_view Name = "vegas";
+
+    double Next(const TWindowStats& window) {
+        const double limit = window.Limit;
+        const double queue = limit * (1 - window.NoLoadRttNs / window.MeanRttNs);
+        const double log = std::max(1.0, std::log10(limit));
+        if (queue < std::max(1.0, 3 * log)) {
+            return window.AppLimited() ? limit : limit + log;
+        }
+        if (queue > std::max(2.0, 6 * log)) {
+            return limit - log;
+        }
+        return limit;
+    }
+};
+
+class TGradientLimit {
+public:
+    static constexpr std::string_view Name = "gradient";
+
+    double Next(const TWindowStats& window) {
+        const double limit = window.Limit;
+        const double gradient = std::clamp(Tolerance * window.NoLoadRttNs / window.MeanRttNs, 0.5, 1.0);
+        double next = limit * gradient + std::sqrt(limit);
+        if (next > limit && window.AppLimited()) {
+            next = limit;
+        }
+        return limit * (1 - Smoothing) + next * Smoothing;
+    }
+
+private:
+    // the rtt may grow this much before the limit goes down
+    static constexpr double Tolerance = 1.5;
+    static constexpr double Smoothing = 0.2;
+};
+
+class TLittleLimit {
+public:
+    static constexpr std::string_view Name = "little's law";
+
+    double Next(const TWindowStats& window) {
+        if (window.MeanRttNs <= Headroom * window.NoLoadRttNs) {
+            return window.AtLimit() ? window.Limit + 1 : window.Limit;
+        }
+        // overloaded: the throughput is what the pod can do, and it needs throughput * noLoadRtt in flight
+        const double throughputPerNs = double(window.Samples) / window.DurationNs;
+        return std::max(throughputPerNs * window.NoLoadRttNs * Headroom, window.Limit / 2);
+    }
+
+private:
+    static constexpr double Headroom = 2;
+};
+
+template<class TAlgo>
+class TAdaptiveLimiter {
+public:
+    explicit TAdaptiveLimiter(TLimiterOptions options = {}, TAlgo algo = {})
+        : Options(options)
+        , Algo(algo)
+        , Limit(options.InitialLimit)
+        , LimitValue(options.InitialLimit)
+    {}
+
+    bool TryAcquire() {
+        uint32_t current = Inflight.load(std::memory_order_relaxed);
+        while(current < Limit.load(std::memory_order_relaxed)) {
+            if (Inflight.compare_exchange_weak(current, current + 1, std::memory_order_acquire)) {
+                AtomicMax(MaxInflight, current + 1);
+                return true;
+            }
+        }
+        Rejects.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void Release(uint64_t rttNs, uint64_t nowNs) {
+        Inflight.fetch_sub(1, std::memory_order_release);
+        RttSum.fetch_add(rttNs, std::memory_order_relaxed);
+        const uint64_t samples = RttCount.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (nowNs >= WindowEndNs.load(std::memory_order_relaxed) && samples >= Options.MinWindowSamples) [[unlikely]] {
+            TryUpdate(nowNs);
+        }
+    }
+
+    // a request that failed or was cancelled: frees the slot, its latency tells nothing
+    void Drop() {
+        Inflight.fetch_sub(1, std::memory_order_release);
+    }
+
+    // metrics
+    uint32_t GetLimit() const {return Limit.load(std::memory_order_relaxed);}
+    uint32_t GetInflight() const {return Inflight.load(std::memory_order_relaxed);}
+    uint64_t GetRejects() const {return Rejects.load(std::memory_order_relaxed);}
+    double GetNoLoadRttNs() const {return NoLoadRttNs.load(std::memory_order_relaxed);}
+    // requests waiting somewhere behind the limiter by the rtt growth, as vegas sees it
+    double GetQueueEstimate() const {return QueueEstimate.load(std::memory_order_relaxed);}
+
+private:
+    static void AtomicMax(std::atomic<uint32_t>& x, uint32_t value) {
+        uint32_t current = x.load(std::memory_order_relaxed);
+        while(value > current && !x.compare_exchange_weak(current, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    void TryUpdate(uint64_t nowNs) {
+        // a try lock: a release that finds the update busy just goes on
+        if (Updating.exchange(true, std::memory_order_acquire)) {
+            return;
+        }
+        const uint64_t windowEnd = WindowEndNs.load(std::memory_order_relaxed);
+        if (nowNs >= windowEnd) {
+            WindowEndNs.store(nowNs + Options.WindowNs, std::memory_order_relaxed);
+            UpdateLocked(nowNs, windowEnd);
+        }
+        Updating.store(false, std::memory_order_release);
+    }
+
+    void UpdateLocked(uint64_t nowNs, uint64_t windowEnd) {
+        if (!windowEnd) {
+            // the first release: samples so far have no window start, just start one
+            RttSum.store(0, std::memory_order_relaxed);
+            RttCount.store(0, std::memory_order_relaxed);
+            WindowStartNs = nowNs;
+            return;
+        }
+        // samples of releases racing with us land in this window or the next one, both are fine
+        TWindowStats window;
+        const uint64_t rttSum = RttSum.exchange(0, std::memory_order_relaxed);
+        window.Samples = RttCount.exchange(0, std::memory_order_relaxed);
+        window.MaxInflight = MaxInflight.exchange(Inflight.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        window.DurationNs = nowNs - WindowStartNs;
+        WindowStartNs = nowNs;
+        if (!window.Samples) {
+            return;
+        }
+        window.MeanRttNs = double(rttSum) / window.Samples;
+
+        NoLoadRttLocal = std::min(NoLoadRttLocal * (1 + Options.NoLoadRttDrift), window.MeanRttNs);
+        window.NoLoadRttNs = NoLoadRttLocal;
+        window.Limit = LimitValue;
+        window.EnforcedLimit = Limit.load(std::memory_order_relaxed);
+
+        LimitValue = std::clamp<double>(Algo.Next(window), Options.MinLimit, Options.MaxLimit);
+        Limit.store(uint32_t(std::lround(LimitValue)), std::memory_order_relaxed);
+        NoLoadRttNs.store(NoLoadRttLocal, std::memory_order_relaxed);
+        QueueEstimate.store(std::max(0.0, window.Limit * (1 - NoLoadRttLocal / window.MeanRttNs)), std::memory_order_relaxed);
+    }
+
+    const TLimiterOptions Options;
+    TAlgo Algo;
+
+    alignas(64) std::atomic<uint32_t> Inflight = 0;
+    std::atomic<uint32_t> Limit;
+    std::atomic<uint32_t> MaxInflight = 0;
+
+    // window accumulators, written by every release
+    alignas(64) std::atomic<uint64_t> RttSum = 0;
+    std::atomic<uint64_t> RttCount = 0;
+    std::atomic<uint64_t> WindowEndNs = 0;
+    std::atomic<bool> Updating = false;
+
+    alignas(64) std::atomic<uint64_t> Rejects = 0;
+    std::atomic<double> NoLoadRttNs = 0;
+    std::atomic<double> QueueEstimate = 0;
+
+    // the updater's state, guarded by Updating
+    double LimitValue;
+    double NoLoadRttLocal = std::numeric_limits<double>::infinity();
+    uint64_t WindowStartNs = 0;
+};
+
+}
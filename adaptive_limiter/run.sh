@@ -0,0 +1,3 @@
+set -x -e
+clang++ -std=c++20 adaptive_limiter.cpp -o adaptive_limiter.exe -Wall -O2 -DNDEBUG
+./adaptive_limiter.exe | tee report.txt
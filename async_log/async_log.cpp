@@ -0,0 +1,205 @@
+#include "async_log.hpp"
+#include "../bench/bench.hpp"
+#include "../hdr_histogram/hdr_histogram.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// The async logger vs what test_locks did before: a line through std::ostream under a global mutex.
+// Both write the same line to the same file (/dev/null by default: the cost of logging, not of the disk).
+
+using NAsyncLog::ELevel;
+using NAsyncLog::EBackpressure;
+
+constexpr uint64_t LinesPerThread = 1 << 16;
+constexpr uint64_t LinesPerBatch = 64;
+// ~90 bytes a record: a burst takes about a third of the 1mb ring, under the half where Sample starts to thin out
+constexpr uint64_t LinesPerBurst = 4096;
+
+// the mutex guarded stream, the line is formatted by the caller under the lock
+template<bool FlushEachLine>
+class TSyncLog {
+public:
+    static constexpr std::string_view Name = FlushEachLine ? "mutex + std::ostream, endl" : "mutex + std::ostream, '\\n'";
+
+    explicit TSyncLog(const std::string& path)
+        : Out(path)
+    {}
+
+    void Log(uint64_t i, std::string_view user, double us) {
+        std::lock_guard g(Lock);
+        Out << "INFO " << __FILE__ << ':' << __LINE__ << " request " << i << " of " << user << " took " << us << " us, status " << "ok";
+        if constexpr (FlushEachLine) {
+            Out << std::endl;
+        } else {
+            Out << '\n';
+        }
+    }
+
+    uint64_t Dropped() const {return 0;}
+
+    void Flush() {
+        std::lock_guard g(Lock);
+        Out.flush();
+    }
+
+private:
+    std::mutex Lock;
+    std::ofstream Out;
+};
+
+template<EBackpressure Backpressure>
+class TAsyncLog {
+public:
+    static constexpr std::string_view Name = Backpressure == EBackpressure::Drop ? "async, drop"
+        : Backpressure == EBackpressure::Block ? "async, block" : "async, sample";
+
+    explicit TAsyncLog(const std::string& path)
+        : Out(std::fopen(path.c_str(), "w"))
+        , Logger(std::make_unique<NAsyncLog::TLogger>(Out, NAsyncLog::TOptions{.Backpressure = Backpressure}))
+    {}
+    ~TAsyncLog() {
+        Logger.reset();
+        std::fclose(Out);
+    }
+
+    void Log(uint64_t i, std::string_view user, double us) {
+        Logger->Log(ELevel::Info, "request {} of {} took {} us, status {}", i, user, us, "ok");
+    }
+
+    // after a flush: every line logged so far is written or dropped
+    uint64_t Dropped() const {
+        Logger->Flush();
+        return Logger->GetDropped();
+    }
+
+    void Flush() {
+        Logger->Flush();
+    }
+
+private:
+    std::FILE* const Out;
+    std::unique_ptr<NAsyncLog::TLogger> Logger;
+};
+
+// ns per line of one thread, the drainer runs alongside
+template<class TLog>
+void RunHotPath(NBench::TReporter& reporter, const std::string& path) {
+    TLog log(path);
+    const std::string user = "user_42";
+    uint64_t i = 0;
+    NBench::TStats stats = NBench::Run(std::string(TLog::Name) + ", 1 thread", [&](uint64_t iters) {
+        for(uint64_t j = 0; j < iters; ++j, ++i) {
+            log.Log(i, user, i * 0.5);
+        }
+    });
+    stats.AddCounter("dropped_pct", i ? 100.0 * log.Dropped() / i : 0);
+    reporter.Add(std::move(stats));
+}
+
+// ns per line of a burst of LinesPerBurst lines from one thread, the burst fits in the ring: the hot path
+// with space, nothing dropped. The drain of a burst (or the flush of the stream) is between the samples
+template<class TLog>
+void RunBurst(NBench::TReporter& reporter, const std::string& path) {
+    TLog log(path);
+    const std::string user = "user_42";
+    NBench::TOptions options;
+    options.Iterations = LinesPerBurst;
+    options.WarmupTime = {};
+    uint64_t lines = 0;
+    NBench::TStats stats = NBench::RunManual(std::string(TLog::Name) + ", bursts of " + std::to_string(LinesPerBurst), [&](uint64_t iters) {
+        auto started = std::chrono::steady_clock::now();
+        for(uint64_t i = 0; i < iters; ++i) {
+            log.Log(i, user, i * 0.5);
+        }
+        auto finished = std::chrono::steady_clock::now();
+        lines += iters;
+        log.Flush();
+        return NBench::TSample{std::chrono::duration<double, std::nano>(finished - started).count(), double(iters)};
+    }, options);
+    stats.AddCounter("dropped_pct", 100.0 * log.Dropped() / lines);
+    reporter.Add(std::move(stats));
+}
+
+// threadsNum threads log LinesPerThread lines each; the sample is the slowest thread and the lines of all of them
+template<class TLog>
+void RunThreads(NBench::TReporter& reporter, const std::string& path, size_t threadsNum, uint32_t samples) {
+    TLog log(path);
+    NHdrHistogram::TConcurrentHistogram batchLatencies;
+    std::vector<NHdrHistogram::TConcurrentHistogram::TRecorder> recorders;
+    for(size_t t = 0; t < threadsNum; ++t) {
+        recorders.push_back(batchLatencies.GetRecorder());
+    }
+    NBench::TOptions options;
+    options.Iterations = 1;
+    options.WarmupTime = {};
+    options.Samples = samples;
+    NBench::TStats stats = NBench::RunManual(std::string(TLog::Name) + ", " + std::to_string(threadsNum) + " threads", [&](uint64_t) {
+        std::vector<double> elapsed(threadsNum);
+        std::vector<std::thread> threads;
+        std::atomic<bool> start = false;
+        for(size_t t = 0; t < threadsNum; ++t) {
+            threads.emplace_back([&, t]() {
+                const std::string user = "user_" + std::to_string(t);
+                while(!start.load()) {}
+                auto started = std::chrono::steady_clock::now();
+                auto batchStarted = started;
+                for(uint64_t i = 0; i < LinesPerThread; ++i) {
+                    log.Log(i, user, i * 0.5);
+                    if ((i + 1) % LinesPerBatch == 0) {
+                        auto batchFinished = std::chrono::steady_clock::now();
+                        recorders[t].Record((batchFinished - batchStarted).count());
+                        batchStarted = batchFinished;
+                    }
+                }
+                elapsed[t] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+            });
+        }
+        start = true;
+        for(auto& t : threads) {
+            t.join();
+        }
+        return NBench::TSample{*std::max_element(elapsed.begin(), elapsed.end()), double(LinesPerThread * threadsNum)};
+    }, options);
+    const double lines = double(LinesPerThread) * threadsNum * samples;
+    stats.AddCounter("threads", threadsNum)
+        .AddCounter("dropped_pct", 100.0 * log.Dropped() / lines)
+        .AddQuantiles("batch64_", batchLatencies.Snapshot());
+    reporter.Add(std::move(stats));
+}
+
+int main(int argc, const char* argv[]) {
+    const std::string path = argc > 1 ? argv[1] : "/dev/null";
+    const size_t maxThreads = argc > 2 ? atoll(argv[2]) : std::max(4u, std::thread::hardware_concurrency());
+    const uint32_t samples = argc > 3 ? atoi(argv[3]) : 5;
+
+    NBench::TReporter reporter("async_log");
+    RunHotPath<TSyncLog<true>>(reporter, path);
+    RunHotPath<TSyncLog<false>>(reporter, path);
+    RunHotPath<TAsyncLog<EBackpressure::Drop>>(reporter, path);
+    RunHotPath<TAsyncLog<EBackpressure::Sample>>(reporter, path);
+    RunHotPath<TAsyncLog<EBackpressure::Block>>(reporter, path);
+    RunBurst<TSyncLog<true>>(reporter, path);
+    RunBurst<TSyncLog<false>>(reporter, path);
+    RunBurst<TAsyncLog<EBackpressure::Drop>>(reporter, path);
+    RunBurst<TAsyncLog<EBackpressure::Sample>>(reporter, path);
+    RunBurst<TAsyncLog<EBackpressure::Block>>(reporter, path);
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        RunThreads<TSyncLog<true>>(reporter, path, threadsNum, samples);
+        RunThreads<TSyncLog<false>>(reporter, path, threadsNum, samples);
+        RunThreads<TAsyncLog<EBackpressure::Drop>>(reporter, path, threadsNum, samples);
+        RunThreads<TAsyncLog<EBackpressure::Sample>>(reporter, path, threadsNum, samples);
+        RunThreads<TAsyncLog<EBackpressure::Block>>(reporter, path, threadsNum, samples);
+    }
+    return 0;
+}
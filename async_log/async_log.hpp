@@ -0,0 +1,507 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Logging with a hot path of a few tens of ns while the ring has space: the caller formats nothing
+// (50-60 ns a record here, measured by async_log.cpp on bursts that fit in the ring, drained between samples).
+//
+// A call site is compile time data: TFormat is built by a consteval constructor from the string literal
+// and the std::source_location of the call (a default argument, just_post/source_location.md),
+// and the number of {} is checked against the arguments at compile time.
+// The caller copies the site (pointers to the literal and the file name, the line, the function that
+// formats these argument types) and the raw arguments (strings by value) into its thread's ring:
+// a single producer single consumer byte ring, a release store of the tail per record.
+// A background thread drains all rings every DrainPeriod, formats the records and writes them in one fwrite
+// per pass. Records are ordered within a thread, not between threads.
+//
+// A full ring is EBackpressure: Drop the record, Block until there is space, or Sample: above half of
+// the ring keep one record of SampleEvery, so the log thins out instead of stopping at once.
+// A producer faster than the drainer fills the ring anyway: Drop and Sample then lose most records
+// (78-84% with the threads of the benchmark, over 90% in its single thread loop), and Block runs
+// at the formatting speed of the drainer, 180-310 ns per record here.
+// A record over half of the ring that doesn't fit is dropped in Block mode too, instead of waiting: an empty
+// ring may not fit it after the padding to the end, and Block would wait forever.
+//
+// A thread gets a ring per logger on its first record. The rings of finished threads are freed by the drainer
+// once drained, the ones a thread keeps of destroyed loggers at its next new ring.
+
+namespace NAsyncLog {
+
+enum class ELevel : uint8_t {
+    Debug,
+    Info,
+    Warning,
+    Error,
+};
+
+constexpr std::string_view LevelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+enum class EBackpressure {
+    Drop,
+    Block,
+    Sample,
+};
+
+struct TOptions {
+    // per thread, a power of two
+    size_t RingBytes = 1 << 20;
+    EBackpressure Backpressure = EBackpressure::Drop;
+    uint32_t SampleEvery = 16;
+    // the drain thread sleeps that long when all rings are empty
+    std::chrono::microseconds DrainPeriod = std::chrono::milliseconds(1);
+    ELevel MinLevel = ELevel::Info;
+};
+
+inline uint64_t Now() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// arguments are stored as this: strings by value (length + bytes), the rest as raw trivially copyable bytes
+template<class T>
+using TStored = std::conditional_t<std::is_convertible_v<const T&, std::string_view>, std::string_view, std::decay_t<T>>;
+
+namespace NPrivate {
+
+// not constexpr: a call from the consteval constructor is a compile error
+void FormatDoesNotMatchArguments();
+
+consteval size_t CountPlaceholders(std::string_view text) {
+    size_t res = 0;
+    for(size_t pos = text.find("{}"); pos != std::string_view::npos; pos = text.find("{}", pos + 2)) {
+        ++res;
+    }
+    return res;
+}
+
+template<class T>
+size_t StoredSize(const T& value) {
+    if constexpr (std::is_same_v<TStored<T>, std::string_view>) {
+        return sizeof(uint32_t) + std::string_view(value).size();
+    } else {
+        static_assert(std::is_trivially_copyable_v<TStored<T>>, "log arguments are strings or trivially copyable");
+        return sizeof(TStored<T>);
+    }
+}
+
+template<class T>
+char* Store(char* out, const T& value) {
+    if constexpr (std::is_same_v<TStored<T>, std::string_view>) {
+        const std::string_view s(value);
+        const uint32_t size = s.size();
+        std::memcpy(out, &size, sizeof(size));
+        std::memcpy(out + sizeof(size), s.data(), size);
+        return out + sizeof(size) + size;
+    } else {
+        const TStored<T> stored = value;
+        std::memcpy(out, &stored, sizeof(stored));
+        return out + sizeof(stored);
+    }
+}
+
+template<class T>
+T Load(const char*& data) {
+    if constexpr (std::is_same_v<T, std::string_view>) {
+        uint32_t size;
+        std::memcpy(&size, data, sizeof(size));
+        const std::string_view res(data + sizeof(size), size);
+        data += sizeof(size) + size;
+        return res;
+    } else {
+        T res;
+        std::memcpy(&res, data, sizeof(res));
+        data += sizeof(res);
+        return res;
+    }
+}
+
+template<class T>
+void Append(std::string& out, const T& value) {
+    if constexpr (std::is_same_v<T, std::string_view>) {
+        out += value;
+    } else if constexpr (std::is_same_v<T, bool>) {
+        out += value ? "true" : "false";
+    } else if constexpr (std::is_same_v<T, char>) {
+        out += value;
+    } else if constexpr (std::is_arithmetic_v<T>) {
+        char buf[64];
+        const auto res = std::to_chars(buf, buf + sizeof(buf), value);
+        out.append(buf, res.ptr);
+    } else if constexpr (std::is_pointer_v<T>) {
+        char buf[24];
+        const auto res = std::to_chars(buf, buf + sizeof(buf), uintptr_t(value), 16);
+        out += "0x";
+        out.append(buf, res.ptr);
+    } else {
+        out += "<";
+        Append(out, sizeof(T));
+        out += " bytes>";
+    }
+}
+
+// text with every {} replaced by the next argument read from data
+template<class... TArgs>
+void FormatRecord(std::string& out, std::string_view text, const char* data) {
+    // braced init: the arguments are read in order
+    const std::tuple<TArgs...> args{Load<TArgs>(data)...};
+    std::apply([&](const auto&... arg) {
+        auto next = [&](const auto& value) {
+            const size_t pos = text.find("{}");
+            out += text.substr(0, pos);
+            Append(out, value);
+            text.remove_prefix(pos + 2);
+        };
+        (next(arg), ...);
+    }, args);
+    out += text;
+}
+
+}
+
+template<class... TArgs>
+struct TFormat {
+    template<class T>
+        requires std::convertible_to<const T&, std::string_view>
+    consteval TFormat(const T& text, std::source_location location = std::source_location::current())
+        : Text(text)
+        , Location(location)
+    {
+        if (NPrivate::CountPlaceholders(Text) != sizeof...(TArgs)) {
+            NPrivate::FormatDoesNotMatchArguments();
+        }
+    }
+
+    std::string_view Text;
+    std::source_location Location;
+};
+
+using TFormatRecord = void(std::string& out, std::string_view text, const char* data);
+
+// a padding to the end of the ring is only the Size with this bit: there may be 8 bytes left
+constexpr uint32_t PaddingBit = 1u << 31;
+
+struct alignas(8) TRecordHeader {
+    // of the whole record, 8 aligned
+    uint32_t Size;
+    uint32_t Line;
+    ELevel Level;
+    uint32_t TextSize;
+    const char* Text;
+    const char* File;
+    TFormatRecord* Format;
+    uint64_t Ticks;
+};
+
+class TRing {
+public:
+    explicit TRing(size_t bytes)
+        : Buffer(new (std::align_val_t(64)) char[bytes])
+        , Capacity(bytes)
+    {}
+    ~TRing() {
+        ::operator delete[](Buffer, std::align_val_t(64));
+    }
+
+    // nullptr when there is no space
+    char* Reserve(uint32_t size) {
+        const uint64_t tail = Tail.load(std::memory_order_relaxed);
+        const size_t offset = tail & (Capacity - 1);
+        const size_t padding = offset + size > Capacity ? Capacity - offset : 0;
+        if (tail + padding + size - CachedHead > Capacity) {
+            CachedHead = Head.load(std::memory_order_acquire);
+            if (tail + padding + size - CachedHead > Capacity) {
+                return nullptr;
+            }
+        }
+        if (padding) {
+            const uint32_t size = padding | PaddingBit;
+            std::memcpy(Buffer + offset, &size, sizeof(size));
+        }
+        Reserved = padding + size;
+        return Buffer + (offset + padding) % Capacity;
+    }
+
+    void Commit() {
+        Tail.store(Tail.load(std::memory_order_relaxed) + Reserved, std::memory_order_release);
+    }
+
+    // more than half is used; the cached head is only ever behind, so only a "yes" needs the fresh one
+    bool IsHalfFull() {
+        const uint64_t tail = Tail.load(std::memory_order_relaxed);
+        if (tail - CachedHead <= Capacity / 2) {
+            return false;
+        }
+        CachedHead = Head.load(std::memory_order_acquire);
+        return tail - CachedHead > Capacity / 2;
+    }
+
+    // the consumer: on(header) for every committed record, then frees them
+    template<class TOnRecord>
+    size_t Drain(TOnRecord&& on) {
+        uint64_t head = Head.load(std::memory_order_relaxed);
+        const uint64_t tail = Tail.load(std::memory_order_acquire);
+        size_t records = 0;
+        while(head < tail) {
+            const TRecordHeader* header = reinterpret_cast<const TRecordHeader*>(Buffer + (head & (Capacity - 1)));
+            if (header->Size & PaddingBit) {
+                head += header->Size & ~PaddingBit;
+                continue;
+            }
+            on(*header);
+            ++records;
+            head += header->Size;
+        }
+        Head.store(head, std::memory_order_release);
+        return records;
+    }
+
+    void CountDrop() {
+        Dropped.store(Dropped.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    uint64_t GetDropped() const {return Dropped.load(std::memory_order_relaxed);}
+    uint64_t GetTail() const {return Tail.load(std::memory_order_acquire);}
+    uint64_t GetHead() const {return Head.load(std::memory_order_acquire);}
+
+    // the producer thread has finished: its records are committed before
+    void Abandon() {Abandoned.store(true, std::memory_order_release);}
+    bool IsAbandoned() const {return Abandoned.load(std::memory_order_acquire);}
+    // the logger is destroyed
+    void Close() {Closed.store(true, std::memory_order_relaxed);}
+    bool IsClosed() const {return Closed.load(std::memory_order_relaxed);}
+
+    // producer only
+    uint32_t SampleCounter = 0;
+
+private:
+    char* const Buffer;
+    const size_t Capacity;
+    alignas(64) std::atomic<uint64_t> Tail = 0;
+    uint64_t CachedHead = 0;
+    uint32_t Reserved = 0;
+    std::atomic<uint64_t> Dropped = 0;
+    alignas(64) std::atomic<uint64_t> Head = 0;
+    std::atomic<bool> Abandoned = false;
+    std::atomic<bool> Closed = false;
+};
+
+class TLogger {
+    static inline std::atomic<uint64_t> NextId = 1;
+
+public:
+    // out is not closed by the logger
+    explicit TLogger(std::FILE* out, TOptions options = {})
+        : Options(options)
+        , Out(out)
+        , StartedTicks(Now())
+        , Started(std::chrono::steady_clock::now())
+        , Drainer([this]() {DrainLoop();})
+    {}
+    TLogger(const TLogger&) = delete;
+    TLogger& operator=(const TLogger&) = delete;
+    // everything logged before is written
+    ~TLogger() {
+        Stop = true;
+        Drainer.join();
+        for(const auto& ring : Rings) {
+            ring->Close();
+        }
+    }
+
+    template<class... TArgs>
+    void Log(ELevel level, TFormat<std::type_identity_t<TArgs>...> format, const TArgs&... args) {
+        if (level < Options.MinLevel) {
+            return;
+        }
+        TRing& ring = CurrentRing();
+        if (Options.Backpressure == EBackpressure::Sample && ring.IsHalfFull() && ++ring.SampleCounter % Options.SampleEvery) {
+            ring.CountDrop();
+            return;
+        }
+        const uint32_t size = (sizeof(TRecordHeader) + (NPrivate::StoredSize(args) + ... + 0) + 7) / 8 * 8;
+        char* data = ring.Reserve(size);
+        while(!data) {
+            if (Options.Backpressure != EBackpressure::Block || size > Options.RingBytes / 2) {
+                ring.CountDrop();
+                return;
+            }
+            std::this_thread::yield();
+            data = ring.Reserve(size);
+        }
+        TRecordHeader* header = reinterpret_cast<TRecordHeader*>(data);
+        header->Size = size;
+        header->Line = format.Location.line();
+        header->Level = level;
+        header->TextSize = format.Text.size();
+        header->Text = format.Text.data();
+        header->File = format.Location.file_name();
+        header->Format = &NPrivate::FormatRecord<TStored<TArgs>...>;
+        header->Ticks = Now();
+        char* out = data + sizeof(TRecordHeader);
+        ((out = NPrivate::Store(out, args)), ...);
+        ring.Commit();
+    }
+
+    // everything logged before the call is written
+    void Flush() {
+        const uint64_t passes = Passes.load();
+        while(Passes.load() < passes + 2) {
+            std::this_thread::sleep_for(Options.DrainPeriod / 4);
+        }
+    }
+
+    uint64_t GetWritten() const {return Written.load();}
+    uint64_t GetDropped() const {
+        std::lock_guard g(RingsLock);
+        uint64_t res = ReclaimedDropped;
+        for(const auto& ring : Rings) {
+            res += ring->GetDropped();
+        }
+        return res;
+    }
+
+private:
+    // the rings of a thread by logger id: a logger at the address of a destroyed one is another logger.
+    // The rings are shared with the loggers, either may go first
+    struct TThreadRings {
+        std::vector<std::pair<uint64_t, std::shared_ptr<TRing>>> Rings;
+
+        ~TThreadRings() {
+            for(const auto& [id, ring] : Rings) {
+                ring->Abandon();
+            }
+        }
+    };
+
+    // the last used ring is cached, a thread logging to one logger doesn't look further
+    TRing& CurrentRing() {
+        thread_local uint64_t cachedId = 0;
+        thread_local TRing* cachedRing = nullptr;
+        if (cachedId != Id) [[unlikely]] {
+            cachedRing = FindOrAddRing();
+            cachedId = Id;
+        }
+        return *cachedRing;
+    }
+
+    TRing* FindOrAddRing() {
+        thread_local TThreadRings threadRings;
+        std::erase_if(threadRings.Rings, [](const auto& idRing) {return idRing.second->IsClosed();});
+        for(const auto& [id, ring] : threadRings.Rings) {
+            if (id == Id) {
+                return ring.get();
+            }
+        }
+        auto ring = std::make_shared<TRing>(Options.RingBytes);
+        {
+            std::lock_guard g(RingsLock);
+            Rings.push_back(ring);
+        }
+        threadRings.Rings.emplace_back(Id, ring);
+        return ring.get();
+    }
+
+    size_t DrainOnce() {
+        std::vector<TRing*> rings;
+        {
+            std::lock_guard g(RingsLock);
+            for(const auto& ring : Rings) {
+                rings.push_back(ring.get());
+            }
+        }
+        // the ticks rate is measured against steady_clock since the start, more precise with every pass
+        const double elapsedNs = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - Started).count();
+        const double ticksPerNs = elapsedNs > 0 ? (Now() - StartedTicks) / elapsedNs : 1;
+        size_t records = 0;
+        std::vector<TRing*> abandoned;
+        for(TRing* ring : rings) {
+            // checked before the drain: the last records are drained in this pass
+            if (ring->IsAbandoned()) {
+                abandoned.push_back(ring);
+            }
+            records += ring->Drain([&](const TRecordHeader& header) {
+                char buf[32];
+                const auto res = std::to_chars(buf, buf + sizeof(buf), uint64_t((header.Ticks - StartedTicks) / ticksPerNs / 1000));
+                Batch.append(buf, res.ptr);
+                Batch += "us ";
+                Batch += LevelNames[size_t(header.Level)];
+                Batch += ' ';
+                Batch += header.File;
+                Batch += ':';
+                NPrivate::Append(Batch, header.Line);
+                Batch += ' ';
+                header.Format(Batch, std::string_view(header.Text, header.TextSize), reinterpret_cast<const char*>(&header + 1));
+                Batch += '\n';
+            });
+        }
+        if (!Batch.empty()) {
+            std::fwrite(Batch.data(), 1, Batch.size(), Out);
+            std::fflush(Out);
+            Batch.clear();
+        }
+        Written.fetch_add(records);
+        if (!abandoned.empty()) {
+            std::lock_guard g(RingsLock);
+            std::erase_if(Rings, [&](const auto& ring) {
+                if (std::find(abandoned.begin(), abandoned.end(), ring.get()) == abandoned.end()) {
+                    return false;
+                }
+                ReclaimedDropped += ring->GetDropped();
+                return true;
+            });
+        }
+        return records;
+    }
+
+    void DrainLoop() {
+        while(!Stop.load()) {
+            if (!DrainOnce()) {
+                std::this_thread::sleep_for(Options.DrainPeriod);
+            }
+            Passes.fetch_add(1);
+        }
+        DrainOnce();
+    }
+
+    const TOptions Options;
+    std::FILE* const Out;
+    const uint64_t Id = NextId.fetch_add(1);
+    const uint64_t StartedTicks;
+    const std::chrono::steady_clock::time_point Started;
+    mutable std::mutex RingsLock;
+    std::vector<std::shared_ptr<TRing>> Rings;
+    // of the freed rings, under the lock
+    uint64_t ReclaimedDropped = 0;
+    std::string Batch;
+    std::atomic<uint64_t> Written = 0;
+    std::atomic<uint64_t> Passes = 0;
+    std::atomic<bool> Stop = false;
+    std::thread Drainer;
+};
+
+}
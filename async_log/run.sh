@@ -0,0 +1,4 @@
+set -x -e
+clang++ -std=c++20 async_log.cpp -o async_log.exe -Wall -O2 -DNDEBUG
+# args: [log file=/dev/null] [max threads] [samples=5]
+BENCH_JSON=report.json ./async_log.exe | tee report.txt
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <unistd.h>
+
+// Shared benchmark harness of the experiments: one number per case that can be compared
+// between runs, hosts and experiments, instead of a single run or an ad hoc quantile.
+//
+// A case is a function of the iterations count. The harness warms it up, finds how many iterations
+// make a sample of at least MinSampleTime, takes Samples samples, drops outliers by Tukey fences
+// (1.5 IQR) and reports the median, the mean and its 95% confidence interval per item.
+// - Run: the harness times `op(iters)`
+// - RunManual: `op(iters)` times itself and returns TSample, for setup that must stay out of
+//   the measurement or for threads, where the sample is the time of the slowest one
+// TReporter prints a line per case, and writes all of them as json into $BENCH_JSON at the end.
+
+namespace NBench {
+
+template<class T>
+inline void DoNotOptimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+template<class T>
+inline void DoNotOptimize(T& value) {
+    asm volatile("" : "+r,m"(value) : : "memory");
+}
+
+// all memory may be read and written here: stores before it are not removed, loads after it are not hoisted
+inline void ClobberMemory() {
+    asm volatile("" : : : "memory");
+}
+
+struct TOptions {
+    // iterations per sample are calibrated to make a sample at least this long
+    std::chrono::nanoseconds MinSampleTime = std::chrono::milliseconds(10);
+    std::chrono::nanoseconds WarmupTime = std::chrono::milliseconds(100);
+    uint32_t Samples = 30;
+    // fixed iterations per sample, 0 to calibrate
+    uint64_t Iterations = 0;
+    // items done by one iteration of Run, the results are per item
+    double ItemsPerIteration = 1;
+};
+
+struct TSample {
+    double Ns = 0;
+    double Items = 0;
+};
+
+struct TStats {
+    std::string Name;
+    uint64_t Iterations = 0;
+    uint32_t Samples = 0;
+    uint32_t Outliers = 0;
+    // per item, outliers excluded
+    double MedianNs = 0;
+    double MeanNs = 0;
+    double StddevNs = 0;
+    double Ci95Ns = 0;
+    double MinNs = 0;
+    double MaxNs = 0;
+    // whatever else the case measured: branch misses, miss orders, bandwidth
+    std::vector<std::pair<std::string, double>> Counters;
+
+    TStats& AddCounter(std::string name, double value) {
+        Counters.emplace_back(std::move(name), value);
+        return *this;
+    }
+
+    // of a latency histogram in ns, anything with Quantile(q): NHdrHistogram::THistogram
+    template<class THistogram>
+    TStats& AddQuantiles(const std::string& prefix, const THistogram& histogram) {
+        return AddCounter(prefix + "p50_ns", histogram.Quantile(0.5))
+            .AddCounter(prefix + "p90_ns", histogram.Quantile(0.9))
+            .AddCounter(prefix + "p99_ns", histogram.Quantile(0.99))
+            .AddCounter(prefix + "p99.9_ns", histogram.Quantile(0.999))
+            .AddCounter(prefix + "max_ns", histogram.GetMax());
+    }
+};
+
+// two sided 95% quantile of the student distribution
+inline double StudentT95(size_t df) {
+    static constexpr double Table[] = {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042,
+    };
+    if (df == 0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    // within 0.002 of the exact value above 30
+    return df <= std::size(Table) ? Table[df - 1] : 1.96 + 2.5 / df;
+}
+
+// of sorted values, linear interpolation between the closest ranks
+inline double Quantile(const std::vector<double>& sorted, double q) {
+    const double rank = q * (sorted.size() - 1);
+    const size_t low = size_t(rank);
+    const size_t high = std::min(low + 1, sorted.size() - 1);
+    return sorted[low] + (sorted[high] - sorted[low]) * (rank - low);
+}
+
+// ns per item of every sample
+inline TStats Summarize(std::string name, uint64_t iterations, std::vector<double> values) {
+    TStats stats;
+    stats.Name = std::move(name);
+    stats.Iterations = iterations;
+    if (values.empty()) {
+        return stats;
+    }
+    std::sort(values.begin(), values.end());
+    if (values.size() >= 4) {
+        const double q1 = Quantile(values, 0.25);
+        const double q3 = Quantile(values, 0.75);
+        const double low = q1 - 1.5 * (q3 - q1);
+        const double high = q3 + 1.5 * (q3 - q1);
+        const size_t before = values.size();
+        values.erase(std::remove_if(values.begin(), values.end(), [&](double x) {
+            return x < low || x > high;
+        }), values.end());
+        stats.Outliers = before - values.size();
+    }
+    const size_t n = values.size();
+    stats.Samples = n;
+    stats.MedianNs = Quantile(values, 0.5);
+    stats.MinNs = values.front();
+    stats.MaxNs = values.back();
+    for(double x : values) {
+        stats.MeanNs += x / n;
+    }
+    double squares = 0;
+    for(double x : values) {
+        squares += (x - stats.MeanNs) * (x - stats.MeanNs);
+    }
+    stats.StddevNs = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+    stats.Ci95Ns = n > 1 ? StudentT95(n - 1) * stats.StddevNs / std::sqrt(double(n)) : 0;
+    return stats;
+}
+
+// op(iters) returns TSample
+template<class TOp>
+TStats RunManual(std::string name, TOp&& op, const TOptions& options = {}) {
+    using TClock = std::chrono::steady_clock;
+    const double minSampleNs = std::chrono::duration<double, std::nano>(options.MinSampleTime).count();
+    const auto warmupEnd = TClock::now() + options.WarmupTime;
+
+    uint64_t iters = options.Iterations ? options.Iterations : 1;
+    if (!options.Iterations) {
+        // grow by the measured ratio, but at most 10 times a step: the first samples are cold
+        while(true) {
+            const TSample sample = op(iters);
+            if (sample.Ns >= minSampleNs || iters >= (uint64_t(1) << 40)) {
+                break;
+            }
+            const double ratio = sample.Ns > 0 ? minSampleNs / sample.Ns : 10;
+            iters = std::max(iters + 1, uint64_t(iters * std::min(10.0, ratio * 1.2)));
+        }
+    }
+    while(TClock::now() < warmupEnd) {
+        op(iters);
+    }
+
+    std::vector<double> values;
+    values.reserve(options.Samples);
+    for(uint32_t i = 0; i < options.Samples; ++i) {
+        const TSample sample = op(iters);
+        values.push_back(sample.Items > 0 ? sample.Ns / sample.Items : sample.Ns);
+    }
+    return Summarize(std::move(name), iters, std::move(values));
+}
+
+// op(iters) does iters iterations of the measured code
+template<class TOp>
+TStats Run(std::string name, TOp&& op, const TOptions& options = {}) {
+    return RunManual(std::move(name), [&](uint64_t iters) {
+        ClobberMemory();
+        const auto started = std::chrono::steady_clock::now();
+        op(iters);
+        ClobberMemory();
+        const auto finished = std::chrono::steady_clock::now();
+        return TSample{std::chrono::duration<double, std::nano>(finished - started).count(), iters * options.ItemsPerIteration};
+    }, options);
+}
+
+class TReporter {
+public:
+    explicit TReporter(std::string experiment, std::ostream& text = std::cout)
+        : Experiment(std::move(experiment))
+        , Text(text)
+    {}
+
+    ~TReporter() {
+        if (const char* path = std::getenv("BENCH_JSON"); path && *path) {
+            std::ofstream out(path);
+            WriteJson(out);
+        }
+    }
+
+    const TStats& Add(TStats stats) {
+        const std::ios_base::fmtflags flags = Text.flags();
+        const std::streamsize precision = Text.precision();
+        Text << stats.Name << ": " << std::fixed << std::setprecision(stats.MeanNs < 10 ? 3 : 1) << stats.MeanNs << " ns"
+            << " +- " << std::setprecision(1) << (stats.MeanNs > 0 ? stats.Ci95Ns / stats.MeanNs * 100 : 0) << "%"
+            << std::setprecision(stats.MedianNs < 10 ? 3 : 1)
+            << " (median " << stats.MedianNs << ", min " << stats.MinNs << ", max " << stats.MaxNs << ")"
+            << ", " << FormatRate(stats.MedianNs > 0 ? 1e9 / stats.MedianNs : 0) << "/s"
+            << ", " << stats.Samples << " samples x " << stats.Iterations << " iters";
+        if (stats.Outliers) {
+            Text << ", " << stats.Outliers << " outliers";
+        }
+        Text.flags(flags);
+        Text.precision(precision);
+        for(const auto& [name, value] : stats.Counters) {
+            Text << ", " << name << "=" << value;
+        }
+        Text << std::endl;
+        Results.push_back(std::move(stats));
+        return Results.back();
+    }
+
+    void WriteJson(std::ostream& out) const {
+        char host[256] = {};
+        gethostname(host, sizeof(host) - 1);
+        char date[32] = {};
+        const std::time_t now = std::time(nullptr);
+        std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", std::gmtime(&now));
+
+        out << "{\n  \"experiment\": " << Quote(Experiment)
+            << ",\n  \"context\": {\"host\": " << Quote(host)
+            << ", \"cpus\": " << std::thread::hardware_concurrency()
+            << ", \"compiler\": " << Quote(__VERSION__)
+            << ", \"date\": " << Quote(date) << "}"
+            << ",\n  \"benchmarks\": [";
+        for(size_t i = 0; i < Results.size(); ++i) {
+            const TStats& s = Results[i];
+            out << (i ? "," : "") << "\n    {\"name\": " << Quote(s.Name)
+                << ", \"iterations\": " << s.Iterations
+                << ", \"samples\": " << s.Samples
+                << ", \"outliers\": " << s.Outliers
+                << ", \"median_ns\": " << Number(s.MedianNs)
+                << ", \"mean_ns\": " << Number(s.MeanNs)
+                << ", \"stddev_ns\": " << Number(s.StddevNs)
+                << ", \"ci95_ns\": " << Number(s.Ci95Ns)
+                << ", \"min_ns\": " << Number(s.MinNs)
+                << ", \"max_ns\": " << Number(s.MaxNs)
+                << ", \"counters\": {";
+            for(size_t j = 0; j < s.Counters.size(); ++j) {
+                out << (j ? ", " : "") << Quote(s.Counters[j].first) << ": " << Number(s.Counters[j].second);
+            }
+            out << "}}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+private:
+    static std::string Quote(std::string_view s) {
+        std::string res = "\"";
+        for(char c : s) {
+            if (c == '"' || c == '\\') {
+                res += '\\';
+                res += c;
+            } else if (uint8_t(c) < 0x20) {
+                char buf[8];
+                std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+                res += buf;
+            } else {
+                res += c;
+            }
+        }
+        return res + "\"";
+    }
+
+    static std::string Number(double x) {
+        if (!std::isfinite(x)) {
+            return "null";
+        }
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.6g", x);
+        return buf;
+    }
+
+    static std::string FormatRate(double x) {
+        static constexpr std::string_view Prefixes[] = {"", "k", "M", "G", "T"};
+        size_t prefix = 0;
+        while(x >= 1000 && prefix + 1 < std::size(Prefixes)) {
+            x /= 1000;
+            ++prefix;
+        }
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "%.2f%s", x, Prefixes[prefix].data());
+        return buf;
+    }
+
+    const std::string Experiment;
+    std::ostream& Text;
+    std::vector<TStats> Results;
+};
+
+}
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+// Intrusive pointer with biased reference counting (Choi, Shull, Torrellas, "Biased Reference Counting").
+//
+// Every object is biased to the thread that created it. The owner thread changes a plain (non atomic) counter,
+// any other thread uses an atomic one. The real count is their sum:
+// - while the owner still has biased references the object is alive, whatever the shared counter says
+//   (it may go negative when a reference made by the owner is released elsewhere)
+// - when the biased counter drops to 0 the owner "merges": sets the Merged bit of the shared counter,
+//   from then on everybody uses the shared counter and whoever brings it to 0 deletes the object
+// - a non owner release that would make the shared counter negative while the owner is still biased
+//   hands its reference to the owner's queue instead; the owner merges queued objects in ProcessMergeQueue()
+//   or at thread exit. After the exit the queue is closed and the releasing thread merges by itself
+//
+// TBorrowedPtr is a plain pointer for call chains that don't need to own anything, it never touches counters.
+
+namespace NBiased {
+
+class TBiasedRefCountedBase;
+
+struct TOwnerRecord {
+    static inline TBiasedRefCountedBase* const Closed = reinterpret_cast<TBiasedRefCountedBase*>(uintptr_t(1));
+
+    std::atomic<TBiasedRefCountedBase*> QueueHead = nullptr;
+    // one for the thread itself, one per alive object biased to it
+    std::atomic<int64_t> Refs = 1;
+
+    void UnRef() {
+        if (Refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            delete this;
+        }
+    }
+};
+
+// trivial thread_local: accessing it is a single fs-relative load, unlike thread_locals with destructors
+inline thread_local TOwnerRecord* CurrentOwner = nullptr;
+
+void ProcessMergeQueue();
+
+struct TOwnerThreadHandle {
+    ~TOwnerThreadHandle() {
+        ProcessMergeQueue();
+        TOwnerRecord* owner = CurrentOwner;
+        // objects queued from now on are merged by the releasing thread
+        TBiasedRefCountedBase* rest = owner->QueueHead.exchange(TOwnerRecord::Closed, std::memory_order_acq_rel);
+        CurrentOwner = nullptr;
+        ProcessQueued(rest);
+        owner->UnRef();
+    }
+    static void ProcessQueued(TBiasedRefCountedBase* head);
+};
+
+inline TOwnerRecord* GetOrCreateCurrentOwner() {
+    if (!CurrentOwner) [[unlikely]] {
+        static thread_local TOwnerThreadHandle handle;
+        CurrentOwner = new TOwnerRecord;
+    }
+    return CurrentOwner;
+}
+
+class TBiasedRefCountedBase {
+public:
+    TBiasedRefCountedBase()
+        : Owner(GetOrCreateCurrentOwner())
+    {
+        Owner->Refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    TBiasedRefCountedBase(const TBiasedRefCountedBase&) = delete;
+    TBiasedRefCountedBase& operator=(const TBiasedRefCountedBase&) = delete;
+
+    void Ref() {
+        if (Owner == CurrentOwner && BiasedCount > 0) [[likely]] {
+            ++BiasedCount;
+        } else {
+            Shared.fetch_add(CountUnit, std::memory_order_relaxed);
+        }
+    }
+
+    void UnRef() {
+        if (Owner == CurrentOwner && BiasedCount > 0) [[likely]] {
+            if (--BiasedCount == 0) {
+                Merge();
+            }
+            return;
+        }
+        int64_t current = Shared.load(std::memory_order_relaxed);
+        while(true) {
+            if (!(current & (MergedBit | QueuedBit)) && current < CountUnit) {
+                // the count would go negative: the owner still has biased references, and nobody would free
+                // the object if they are gone. So our reference is not released but handed to the owner's queue
+                if (Shared.compare_exchange_weak(current, current | QueuedBit, std::memory_order_acq_rel)) {
+                    Enqueue();
+                    return;
+                }
+            } else if (Shared.compare_exchange_weak(current, current - CountUnit, std::memory_order_acq_rel)) {
+                if ((current - CountUnit) >> CountShift == 0 && (current & MergedBit)) {
+                    Destroy();
+                }
+                return;
+            }
+        }
+    }
+
+    // for tests and reports only: the count as seen by the owner thread
+    int64_t OwnerViewCount() const {
+        return BiasedCount + (Shared.load(std::memory_order_acquire) >> CountShift);
+    }
+
+protected:
+    virtual ~TBiasedRefCountedBase() = default;
+
+private:
+    friend struct TOwnerThreadHandle;
+    friend void ProcessMergeQueue();
+
+    // the shared counter keeps flags in the lowest bits and the count above them,
+    // so adding and subtracting CountUnit never touches flags, even when the count is negative
+    static constexpr int64_t MergedBit = 1;
+    static constexpr int64_t QueuedBit = 2;
+    static constexpr int CountShift = 2;
+    static constexpr int64_t CountUnit = 1 << CountShift;
+
+    // called by the owner, or, once the owner thread is gone, by the thread that queued the object
+    void Merge() {
+        const int64_t add = BiasedCount * CountUnit + MergedBit;
+        BiasedCount = 0;
+        int64_t current = Shared.load(std::memory_order_relaxed);
+        do {
+            if (current & MergedBit) {
+                return;
+            }
+        } while(!Shared.compare_exchange_weak(current, current + add, std::memory_order_acq_rel));
+        if ((current + add) >> CountShift == 0) {
+            Destroy();
+        }
+    }
+
+    // the queue holds the reference of the thread that queued the object
+    void Enqueue() {
+        TBiasedRefCountedBase* head = Owner->QueueHead.load(std::memory_order_acquire);
+        while(true) {
+            if (head == TOwnerRecord::Closed) {
+                MergeQueued();
+                return;
+            }
+            NextQueued = head;
+            if (Owner->QueueHead.compare_exchange_weak(head, this, std::memory_order_acq_rel)) {
+                return;
+            }
+        }
+    }
+
+    void MergeQueued() {
+        Merge();
+        UnRef();
+    }
+
+    void Destroy() {
+        TOwnerRecord* owner = Owner;
+        delete this;
+        owner->UnRef();
+    }
+
+    TOwnerRecord* const Owner;
+    int64_t BiasedCount = 1;
+    std::atomic<int64_t> Shared = 0;
+    TBiasedRefCountedBase* NextQueued = nullptr;
+};
+
+// merges objects biased to the current thread that other threads queued; call it from time to time
+// (between requests for example) in threads that hand objects off, otherwise they live until the thread exits
+inline void ProcessMergeQueue() {
+    if (CurrentOwner) {
+        TOwnerThreadHandle::ProcessQueued(CurrentOwner->QueueHead.exchange(nullptr, std::memory_order_acq_rel));
+    }
+}
+
+inline void TOwnerThreadHandle::ProcessQueued(TBiasedRefCountedBase* head) {
+    while(head) {
+        TBiasedRefCountedBase* next = head->NextQueued;
+        head->MergeQueued();
+        head = next;
+    }
+}
+
+template<class T>
+class TBorrowedPtr;
+
+template<class T>
+class TBiasedPtr {
+public:
+    TBiasedPtr() = default;
+    // takes the reference the object was created with
+    explicit TBiasedPtr(T* ptr)
+        : Ptr(ptr)
+    {}
+    TBiasedPtr(const TBiasedPtr& other)
+        : Ptr(other.Ptr)
+    {
+        if (Ptr) {
+            Ptr->Ref();
+        }
+    }
+    TBiasedPtr(TBiasedPtr&& other) noexcept
+        : Ptr(std::exchange(other.Ptr, nullptr))
+    {}
+    TBiasedPtr& operator=(TBiasedPtr other) noexcept {
+        std::swap(Ptr, other.Ptr);
+        return *this;
+    }
+    ~TBiasedPtr() {
+        if (Ptr) {
+            Ptr->UnRef();
+        }
+    }
+
+    T* Get() const {return Ptr;}
+    T& operator*() const {return *Ptr;}
+    T* operator->() const {return Ptr;}
+    explicit operator bool() const {return Ptr != nullptr;}
+
+    TBorrowedPtr<T> Borrow() const;
+
+private:
+    T* Ptr = nullptr;
+};
+
+template<class T, class... TArgs>
+TBiasedPtr<T> MakeBiased(TArgs&&... args) {
+    return TBiasedPtr<T>(new T(std::forward<TArgs>(args)...));
+}
+
+// valid while some TBiasedPtr to the object is alive, as a reference
+template<class T>
+class TBorrowedPtr {
+public:
+    TBorrowedPtr() = default;
+    TBorrowedPtr(const TBiasedPtr<T>& ptr)
+        : Ptr(ptr.Get())
+    {}
+
+    T* Get() const {return Ptr;}
+    T& operator*() const {return *Ptr;}
+    T* operator->() const {return Ptr;}
+    explicit operator bool() const {return Ptr != nullptr;}
+
+    // takes a real reference, when the callee decides to keep the object
+    TBiasedPtr<T> Acquire() const {
+        if (Ptr) {
+            Ptr->Ref();
+        }
+        return TBiasedPtr<T>(Ptr);
+    }
+
+private:
+    T* Ptr = nullptr;
+};
+
+template<class T>
+TBorrowedPtr<T> TBiasedPtr<T>::Borrow() const {
+    return TBorrowedPtr<T>(*this);
+}
+
+}
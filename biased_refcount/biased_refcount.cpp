@@ -0,0 +1,175 @@
+#include "biased_ptr.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+std::atomic<int64_t> AliveObjects = 0;
+
+struct TPayload : public NBiased::TBiasedRefCountedBase {
+    int64_t Value;
+    explicit TPayload(int64_t value) : Value(value) {AliveObjects += 1;}
+    ~TPayload() {AliveObjects -= 1;}
+};
+
+struct TPlainPayload {
+    int64_t Value;
+    explicit TPlainPayload(int64_t value) : Value(value) {AliveObjects += 1;}
+    ~TPlainPayload() {AliveObjects -= 1;}
+};
+
+using TShared = std::shared_ptr<TPlainPayload>;
+using TBiased = NBiased::TBiasedPtr<TPayload>;
+using TBorrowed = NBiased::TBorrowedPtr<TPayload>;
+
+// by value, as doInc2 from just_post/how_calls_destructor.md: the caller copies, the caller destroys
+[[gnu::noinline]] int64_t UseCopy(TShared x) {return x->Value;}
+[[gnu::noinline]] int64_t UseCopy(TBiased x) {return x->Value;}
+[[gnu::noinline]] int64_t UseCopy(TBorrowed x) {return x->Value;}
+
+TShared Make(const TShared*, int64_t value) {return std::make_shared<TPlainPayload>(value);}
+TBiased Make(const TBiased*, int64_t value) {return NBiased::MakeBiased<TPayload>(value);}
+
+template<class TFunc>
+void RunThreads(std::string_view name, size_t threadsNum, size_t opsPerThread, TFunc&& func) {
+    std::atomic<int64_t> checksum = 0;
+    auto started = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < threadsNum; ++t) {
+        threads.emplace_back([&, t]() {checksum += func(t);});
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    auto finished = std::chrono::high_resolution_clock::now();
+    std::cout << name << ", " << threadsNum << " threads: "
+        << std::chrono::duration<double, std::nano>(finished - started).count() / opsPerThread << " ns/op per thread"
+        << " (checksum " << checksum << ", alive objects " << AliveObjects << ")" << std::endl;
+}
+
+// every thread copies its own object: the common request path case
+template<class TPtr>
+void BenchOwnCopies(std::string_view name, size_t threadsNum, size_t iters) {
+    RunThreads(name, threadsNum, iters, [&](size_t t) {
+        TPtr ptr = Make((const TPtr*)nullptr, t);
+        int64_t accum = 0;
+        for(size_t i = 0; i < iters; ++i) {
+            accum += UseCopy(ptr);
+        }
+        return accum;
+    });
+}
+
+void BenchOwnBorrowed(size_t threadsNum, size_t iters) {
+    RunThreads("borrowed ptr, own object", threadsNum, iters, [&](size_t t) {
+        TBiased ptr = NBiased::MakeBiased<TPayload>(t);
+        int64_t accum = 0;
+        for(size_t i = 0; i < iters; ++i) {
+            accum += UseCopy(ptr.Borrow());
+        }
+        return accum;
+    });
+}
+
+// all threads copy one object created by the main thread: both variants pay for an atomic rmw on a shared line
+template<class TPtr>
+void BenchSharedCopies(std::string_view name, size_t threadsNum, size_t iters) {
+    TPtr ptr = Make((const TPtr*)nullptr, 1);
+    RunThreads(name, threadsNum, iters, [&](size_t) {
+        int64_t accum = 0;
+        for(size_t i = 0; i < iters; ++i) {
+            accum += UseCopy(ptr);
+        }
+        return accum;
+    });
+}
+
+// single producer single consumer ring of pointers, moved through without touching counters
+template<class TPtr>
+struct TRing {
+    static constexpr size_t Size = 1024;
+    TPtr Items[Size];
+    alignas(64) std::atomic<size_t> Head = 0;
+    alignas(64) std::atomic<size_t> Tail = 0;
+
+    void Push(TPtr&& ptr) {
+        const size_t tail = Tail.load(std::memory_order_relaxed);
+        while(tail - Head.load(std::memory_order_acquire) == Size) {
+            std::this_thread::yield();
+        }
+        Items[tail % Size] = std::move(ptr);
+        Tail.store(tail + 1, std::memory_order_release);
+    }
+    TPtr Pop() {
+        const size_t head = Head.load(std::memory_order_relaxed);
+        while(Tail.load(std::memory_order_acquire) == head) {
+            std::this_thread::yield();
+        }
+        TPtr ptr = std::move(Items[head % Size]);
+        Head.store(head + 1, std::memory_order_release);
+        return ptr;
+    }
+};
+
+// producer creates objects, copies each a few times itself and hands a copy to the consumer,
+// which copies it a few more times and drops it: the producer's reference outlives or not - both happen
+template<class TPtr>
+void BenchHandoff(std::string_view name, size_t items, size_t copiesPerSide) {
+    auto ring = std::make_unique<TRing<TPtr>>();
+    std::atomic<int64_t> checksum = 0;
+    auto started = std::chrono::high_resolution_clock::now();
+    std::thread consumer([&]() {
+        int64_t accum = 0;
+        for(size_t i = 0; i < items; ++i) {
+            TPtr ptr = ring->Pop();
+            for(size_t c = 0; c < copiesPerSide; ++c) {
+                accum += UseCopy(ptr);
+            }
+        }
+        checksum += accum;
+    });
+    std::thread producer([&]() {
+        int64_t accum = 0;
+        TPtr kept[16];
+        for(size_t i = 0; i < items; ++i) {
+            TPtr ptr = Make((const TPtr*)nullptr, i);
+            for(size_t c = 0; c < copiesPerSide; ++c) {
+                accum += UseCopy(ptr);
+            }
+            kept[i % 16] = ptr;
+            ring->Push(std::move(ptr));
+            if constexpr (std::is_same_v<TPtr, TBiased>) {
+                if (i % 256 == 0) {
+                    NBiased::ProcessMergeQueue();
+                }
+            }
+        }
+        checksum += accum;
+    });
+    producer.join();
+    consumer.join();
+    auto finished = std::chrono::high_resolution_clock::now();
+    std::cout << name << ": " << std::chrono::duration<double, std::nano>(finished - started).count() / items
+        << " ns/item (checksum " << checksum << ", alive objects after both threads exited " << AliveObjects << ")" << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    size_t iters = argc > 1 ? atoll(argv[1]) : 100'000'000;
+    size_t maxThreads = argc > 2 ? atoll(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        BenchOwnCopies<TShared>("std::shared_ptr, own object", threadsNum, iters);
+        BenchOwnCopies<TBiased>("biased ptr, own object", threadsNum, iters);
+        BenchOwnBorrowed(threadsNum, iters);
+        BenchSharedCopies<TShared>("std::shared_ptr, one object for all", threadsNum, iters / 10);
+        BenchSharedCopies<TBiased>("biased ptr, one object for all", threadsNum, iters / 10);
+    }
+    BenchHandoff<TShared>("std::shared_ptr handoff", iters / 100, 4);
+    BenchHandoff<TBiased>("biased ptr handoff", iters / 100, 4);
+    return 0;
+}
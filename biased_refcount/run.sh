@@ -0,0 +1,3 @@
+set -x -e
+clang++ -std=c++20 biased_refcount.cpp -o biased_refcount.exe -Wall -O2 -DNDEBUG
+./biased_refcount.exe | tee report.txt
@@ -1,13 +1,15 @@
 #include <cassert>
 #include <deque>
 #include <iostream>
-#include <functional>
 #include <map>
 #include <utility>
 
+#include "../callables/function_ref.hpp"
+
 using TItem = float;
 using TItemId = size_t;
-using TItemCallback = std::function<void(TItem)>;
+// called per item and passed down the recursion, so a non owning two pointer ref instead of std::function
+using TItemCallback = TFunctionRef<void(TItem)>;
 
 class TLongestMonotonicSubseqCollector {
     std::deque<TItem> InputSequence;
@@ -19,7 +21,7 @@ class TLongestMonotonicSubseqCollector {
     TChainsMap LastChainValueToItemIdAndChainSize;
     std::deque<TChainsMap::iterator> SizeToItemIdToStartFrom;
 
-    void IterateChainStartingByItemId(const TItemCallback& cb, TItemId itemId) const {
+    void IterateChainStartingByItemId(TItemCallback cb, TItemId itemId) const {
         const TItemId& prev = PrevItems.at(itemId);
         if (prev != itemId) {
             IterateChainStartingByItemId(cb, prev);
@@ -27,7 +29,7 @@ class TLongestMonotonicSubseqCollector {
         cb(InputSequence[itemId]);
     }
 public:
-    void DumpEach(const TItemCallback& cb) const {
+    void DumpEach(TItemCallback cb) const {
         if (CurrentBiggestSubseqSize == 0) {
             return;
         }
@@ -1,38 +1,268 @@
+#include "../bench/bench.hpp"
+
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <immintrin.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// values are reused in a loop, so keep them cache resident to measure the predictor and not the memory
+constexpr size_t PatternSize = 1 << 16;
+
+// empty asm with side effects: the compiler can neither if-convert a branch holding it into cmov,
+// nor keep the value in a vector register across iterations
+inline void KeepScalar(int64_t& x) {
+    asm volatile("" : "+r"(x));
+}
 
 void update1(int64_t& x) {
+    KeepScalar(x);
     x += 1;
 }
 void update2(int64_t& x) {
+    KeepScalar(x);
     x -= 1;
 }
-int main(int argc, const char* argv[]) {
-    assert(argc == 5);
-    int64_t iters = atoll(argv[1]);
-    int64_t step = atoll(argv[2]);
-    int64_t cmp = atoll(argv[3]);
-    int64_t p = atoll(argv[4]);
 
+int64_t KernelBranchy(const std::vector<int64_t>& values, int64_t cmp, int64_t iters) {
     int64_t sum = 0;
-    int64_t sum1 = 0;
-    int64_t value = 0;
     for(int64_t i = 0; i < iters; ++i) {
-        value += step;
-        value += 2 * step;
-        value += 3 * step;
-        value += 4 * step;
-        value += 5 * step;
-        value /= 2;
-        // if (value % p <= cmp) {
-            // update1(sum);
-        // }
-        // else {
-            // update2(sum);
-        // }
-    }
-    std::cout << sum << std::endl;
+        if (values[i % PatternSize] <= cmp) {
+            update1(sum);
+        }
+        else {
+            update2(sum);
+        }
+    }
+    return sum;
+}
+
+int64_t KernelPredicated(const std::vector<int64_t>& values, int64_t cmp, int64_t iters) {
+    int64_t sum = 0;
+    for(int64_t i = 0; i < iters; ++i) {
+        const int64_t taken = values[i % PatternSize] <= cmp;
+        sum += 2 * taken - 1;
+        KeepScalar(sum);
+    }
+    return sum;
+}
+
+__attribute__((target("avx2")))
+int64_t KernelSimdMasked(const std::vector<int64_t>& values, int64_t cmp, int64_t iters) {
+    static_assert(PatternSize % 4 == 0);
+    const __m256i cmpVec = _mm256_set1_epi64x(cmp);
+    const __m256i ones = _mm256_set1_epi64x(1);
+    __m256i acc = _mm256_setzero_si256();
+    int64_t i = 0;
+    for(; i + 4 <= iters; i += 4) {
+        const __m256i v = _mm256_loadu_si256((const __m256i*)&values[i % PatternSize]);
+        // all bits set where the branch would NOT be taken: +1 - 2 = -1, otherwise +1
+        const __m256i notTaken = _mm256_cmpgt_epi64(v, cmpVec);
+        acc = _mm256_add_epi64(acc, ones);
+        acc = _mm256_add_epi64(acc, _mm256_add_epi64(notTaken, notTaken));
+    }
+    alignas(32) int64_t lanes[4];
+    _mm256_store_si256((__m256i*)lanes, acc);
+    int64_t sum = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    for(; i < iters; ++i) {
+        sum += values[i % PatternSize] <= cmp ? 1 : -1;
+    }
+    return sum;
+}
+
+// branch counters of the current thread; reports nothing if perf events are not available (vm, paranoid level)
+struct TBranchCounters {
+    int BranchesFd = -1;
+    int MissesFd = -1;
+
+    static int Open(uint64_t config, int groupFd) {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.size = sizeof(attr);
+        attr.config = config;
+        attr.disabled = groupFd == -1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return syscall(SYS_perf_event_open, &attr, 0, -1, groupFd, 0);
+    }
+
+    TBranchCounters() {
+        BranchesFd = Open(PERF_COUNT_HW_BRANCH_INSTRUCTIONS, -1);
+        if (BranchesFd != -1) {
+            MissesFd = Open(PERF_COUNT_HW_BRANCH_MISSES, BranchesFd);
+        }
+    }
+    ~TBranchCounters() {
+        if (MissesFd != -1) {
+            close(MissesFd);
+        }
+        if (BranchesFd != -1) {
+            close(BranchesFd);
+        }
+    }
+
+    bool Available() const {
+        return BranchesFd != -1 && MissesFd != -1;
+    }
+    void Start() {
+        if (Available()) {
+            ioctl(BranchesFd, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+            ioctl(BranchesFd, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        }
+    }
+    void Stop(uint64_t& branches, uint64_t& misses) {
+        branches = misses = 0;
+        if (Available()) {
+            ioctl(BranchesFd, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+            if (read(BranchesFd, &branches, sizeof(branches)) != sizeof(branches)
+                || read(MissesFd, &misses, sizeof(misses)) != sizeof(misses)) {
+                branches = misses = 0;
+            }
+        }
+    }
+};
+
+using TKernel = int64_t(*)(const std::vector<int64_t>&, int64_t, int64_t);
+
+// the counters are read around every sample (warmup and calibration included, the same kernel), per iteration at the end
+void RunKernel(NBench::TReporter& reporter, const std::string& prefix, std::string_view name, TKernel kernel,
+    const std::vector<int64_t>& values, int64_t cmp, int64_t iters)
+{
+    TBranchCounters counters;
+    uint64_t branchesTotal = 0;
+    uint64_t missesTotal = 0;
+    uint64_t itersTotal = 0;
+    int64_t sum = 0;
+    NBench::TOptions options;
+    options.Iterations = iters;
+    NBench::TStats stats = NBench::RunManual(prefix + ", " + std::string(name), [&](uint64_t sampleIters) {
+        uint64_t branches = 0;
+        uint64_t misses = 0;
+        auto started = std::chrono::high_resolution_clock::now();
+        counters.Start();
+        sum = kernel(values, cmp, sampleIters);
+        counters.Stop(branches, misses);
+        auto finished = std::chrono::high_resolution_clock::now();
+        NBench::DoNotOptimize(sum);
+        branchesTotal += branches;
+        missesTotal += misses;
+        itersTotal += sampleIters;
+        return NBench::TSample{std::chrono::duration<double, std::nano>(finished - started).count(), double(sampleIters)};
+    }, options);
+
+    stats.AddCounter("sum", sum);
+    if (counters.Available()) {
+        stats.AddCounter("branches_per_iter", branchesTotal / double(itersTotal))
+            .AddCounter("branch_misses_per_iter", missesTotal / double(itersTotal))
+            .AddCounter("miss_rate_percent", branchesTotal ? missesTotal * 100. / branchesTotal : 0.);
+    }
+    reporter.Add(std::move(stats));
+    if (!counters.Available()) {
+        std::cout << "branch counters n/a" << std::endl;
+    }
+}
+
+// every generator returns values and cmp, the branch is taken when value <= cmp
+
+// random bit pattern of length k repeated over and over: predictable once k fits into the predictor history
+std::vector<int64_t> GeneratePeriodic(int64_t k) {
+    assert(k > 0);
+    std::mt19937_64 rng(2026);
+    std::vector<int64_t> period(k);
+    for(auto& x : period) {
+        x = rng() % 2;
+    }
+    std::vector<int64_t> values(PatternSize);
+    for(size_t i = 0; i < values.size(); ++i) {
+        values[i] = period[i % k];
+    }
+    return values;
+}
+
+// independent coin flips, taken with probability p
+std::vector<int64_t> GenerateRandom(double p) {
+    std::mt19937_64 rng(2026);
+    std::bernoulli_distribution taken(p);
+    std::vector<int64_t> values(PatternSize);
+    for(auto& x : values) {
+        x = taken(rng) ? 0 : 1;
+    }
+    return values;
+}
+
+// the original experiment: value evolves by a recurrence, the branch is `value % p <= cmp`.
+// The recurrence used to halve the value: it converged in 14 steps and the branch was constant after that.
+// Now it is the MMIX LCG with 15 * step as the increment (made odd: the full period), the value is
+// the high bits of the state: uniform in [0, p), so the branch is taken (cmp + 1) / p of the time,
+// 49.5% for run.sh's 500 of 1013
+std::vector<int64_t> GenerateDataDependent(int64_t step, int64_t p) {
+    assert(p > 0);
+    std::vector<int64_t> values(PatternSize);
+    uint64_t value = 0;
+    for(auto& x : values) {
+        value = value * 6364136223846793005ULL + (15 * uint64_t(step) | 1);
+        x = (value >> 32) % p;
+    }
+    return values;
+}
+
+int Usage() {
+    std::cerr << "usage:\n"
+        << "  bp.exe periodic <iters> <k>\n"
+        << "  bp.exe random <iters> <p>\n"
+        << "  bp.exe data <iters> <step> <cmp> <p>\n"
+        << "iters are per sample, 0 to calibrate\n";
+    return 1;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc < 4) {
+        return Usage();
+    }
+    const std::string_view pattern = argv[1];
+    const int64_t iters = atoll(argv[2]);
+
+    std::vector<int64_t> values;
+    int64_t cmp = 0;
+    if (pattern == "periodic") {
+        values = GeneratePeriodic(atoll(argv[3]));
+    } else if (pattern == "random") {
+        values = GenerateRandom(atof(argv[3]));
+    } else if (pattern == "data" && argc == 6) {
+        cmp = atoll(argv[4]);
+        values = GenerateDataDependent(atoll(argv[3]), atoll(argv[5]));
+    } else {
+        return Usage();
+    }
+
+    const auto taken = std::count_if(values.begin(), values.end(), [&](int64_t value) {return value <= cmp;});
+    std::cout << "branch taken " << 100.0 * taken / values.size() << "% of " << values.size() << " values" << std::endl;
+
+    std::string prefix = "pattern " + std::string(pattern);
+    for(int i = 3; i < argc; ++i) {
+        prefix += " ";
+        prefix += argv[i];
+    }
+
+    NBench::TReporter reporter("branch_predictor");
+    RunKernel(reporter, prefix, "branchy", &KernelBranchy, values, cmp, iters);
+    RunKernel(reporter, prefix, "predicated", &KernelPredicated, values, cmp, iters);
+    if (__builtin_cpu_supports("avx2")) {
+        RunKernel(reporter, prefix, "simd masked", &KernelSimdMasked, values, cmp, iters);
+    }
 
     return 0;
 }
@@ -4,11 +4,13 @@ set -x -e
 # perf stat ./empty.exe 2>&1| tee empty2.txt | grep branch
 # perf stat ./empty.exe 2>&1| tee empty3.txt | grep branch
 
-clang++ -std=c++2b bp.cpp tp2.cpp -o bp.exe -Wall -O0 -DNDEBUG
-# perf stat ./bp.exe 1000000 1 0 2>&1 | tee run1.txt
-# perf stat ./bp.exe 1000000 1 1 2>&1 | tee run2.txt
-# perf stat ./bp.exe 1000000 1 2 2 2>&1 | tee run3.txt
-perf stat ./bp.exe 10000000 700 500 1013 2>&1 | grep branches | tee run4_1.txt
-perf stat ./bp.exe 20000000 700 500 1013 2>&1 | grep branches | tee run4_2.txt
-perf stat ./bp.exe 30000000 700 500 1013 2>&1 | grep branches | tee run4_3.txt
+clang++ -std=c++2b bp.cpp tp2.cpp -o bp.exe -Wall -O2 -DNDEBUG
 
+echo "" > report.txt
+for k in 2 16 64 1024 65536; do
+    BENCH_JSON=report_periodic_$k.json ./bp.exe periodic 0 $k | tee -a report.txt
+done
+for p in 0.5 0.9 0.99 1; do
+    BENCH_JSON=report_random_$p.json ./bp.exe random 0 $p | tee -a report.txt
+done
+BENCH_JSON=report_data.json ./bp.exe data 0 700 500 1013 | tee -a report.txt
@@ -0,0 +1,53 @@
+set -e
+# one target per experiment, binaries go to _build/:
+#   bash build.sh                  all targets
+#   bash build.sh test_locks ...   the given ones
+#   bash build.sh run test_locks   build and run with the default args, the json report goes to _build/test_locks.json
+# the experiment's own run.sh stays the reference for the args and reports of the posts
+
+CXX=${CXX:-clang++}
+FLAGS="-Wall -O2 -DNDEBUG -pthread"
+ROOT=$(cd "$(dirname "$0")" && pwd)
+OUT="$ROOT/_build"
+
+TARGETS="test_locks mem_random_access hash_map_reorders branch_predictor non_atomic_atomic sort_ub
+callables singletons_init biased_refcount rps_limiter queue_sim inflight_balancer adaptive_limiter hdr_histogram
+epoch_publish hash_bench lock_profiler async_log work_stealing concurrent_map false_sharing"
+
+build() {
+    mkdir -p "$OUT"
+    case "$1" in
+        test_locks)        $CXX -std=c++20 test_locks/test_locks.cpp -o "$OUT/$1" $FLAGS ;;
+        mem_random_access) $CXX -std=c++20 mem_random_access/mem_random_access.cpp -o "$OUT/$1" $FLAGS ;;
+        hash_map_reorders) $CXX -std=c++23 hash_map_reorders/reorder.cpp -o "$OUT/$1" $FLAGS ;;
+        hash_bench)        $CXX -std=c++23 hash_map_reorders/hash_bench.cpp -o "$OUT/$1" $FLAGS ;;
+        branch_predictor)  $CXX -std=c++2b branch_predictor/bp.cpp branch_predictor/tp2.cpp -o "$OUT/$1" $FLAGS ;;
+        non_atomic_atomic) $CXX -std=c++23 non_atomic_atomic/main.cpp -o "$OUT/$1" $FLAGS ;;
+        sort_ub)           $CXX -std=c++2b sort_ub/sort_ub.cpp -o "$OUT/$1" $FLAGS ;;
+        callables)         $CXX -std=c++20 callables/callables_bench.cpp -o "$OUT/$1" $FLAGS ;;
+        *)                 $CXX -std=c++20 "$1/$1.cpp" -o "$OUT/$1" $FLAGS ;;
+    esac
+}
+
+args() {
+    case "$1" in
+        mem_random_access) echo 128 ;;
+        branch_predictor)  echo random 0 0.5 ;;
+        non_atomic_atomic) echo bench ;;
+    esac
+}
+
+cd "$ROOT"
+if [ "$1" = "run" ]; then
+    shift
+    for target in "$@"; do
+        build "$target"
+        BENCH_JSON="$OUT/$target.json" "$OUT/$target" $(args "$target")
+    done
+    exit 0
+fi
+
+for target in ${@:-$TARGETS}; do
+    echo "building $target"
+    build "$target"
+done
@@ -0,0 +1,140 @@
+#include "function_ref.hpp"
+#include "inplace_function.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string_view>
+
+using TSig = int64_t(int64_t);
+
+// the interface variant from just_post/function.md
+struct ICallable {
+    virtual ~ICallable() {}
+    virtual int64_t operator()(int64_t) = 0;
+};
+
+template<class F>
+struct TLambdaCallable : public ICallable {
+    F Functor;
+    TLambdaCallable(F&& f) : Functor(std::move(f))
+    {}
+    int64_t operator()(int64_t x) final {
+        return Functor(x);
+    }
+};
+
+// call cost: the callee is opaque to the loop, as it is for a callback passed through a few layers
+[[gnu::noinline]] int64_t CallStdFunction(const std::function<TSig>& f, size_t n) {
+    int64_t accum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        accum += f(i);
+    }
+    return accum;
+}
+[[gnu::noinline]] int64_t CallFunctionRef(TFunctionRef<TSig> f, size_t n) {
+    int64_t accum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        accum += f(i);
+    }
+    return accum;
+}
+[[gnu::noinline]] int64_t CallInplaceFunction(const TInplaceFunction<TSig, 64>& f, size_t n) {
+    int64_t accum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        accum += f(i);
+    }
+    return accum;
+}
+[[gnu::noinline]] int64_t CallInterface(ICallable& f, size_t n) {
+    int64_t accum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        accum += f(i);
+    }
+    return accum;
+}
+template<class F>
+[[gnu::noinline]] int64_t CallTemplate(F&& f, size_t n) {
+    int64_t accum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        accum += f(i);
+    }
+    return accum;
+}
+
+template<class TFunc>
+void Report(std::string_view name, size_t iters, TFunc&& func) {
+    auto started = std::chrono::high_resolution_clock::now();
+    int64_t accum = func();
+    auto finished = std::chrono::high_resolution_clock::now();
+    std::cout << name << ": " << std::chrono::duration<double, std::nano>(finished - started).count() / iters
+        << " ns/op (checksum " << accum << ")" << std::endl;
+}
+
+// construction cost: build a wrapper around a fresh lambda and call it once, as a per-item callback would
+template<size_t CaptureSize>
+void BenchConstruct(size_t iters) {
+    std::array<int64_t, CaptureSize / sizeof(int64_t)> captured;
+    captured.fill(3);
+    std::cout << "construct + 1 call, capture of " << CaptureSize << " bytes" << std::endl;
+
+    Report(" - std::function", iters, [&]() {
+        int64_t accum = 0;
+        for(size_t i = 0; i < iters; ++i) {
+            accum += CallStdFunction([captured, i](int64_t x) {return x + captured[0] + i;}, 1);
+        }
+        return accum;
+    });
+    Report(" - TFunctionRef", iters, [&]() {
+        int64_t accum = 0;
+        for(size_t i = 0; i < iters; ++i) {
+            accum += CallFunctionRef([captured, i](int64_t x) {return x + captured[0] + i;}, 1);
+        }
+        return accum;
+    });
+    Report(" - TInplaceFunction", iters, [&]() {
+        int64_t accum = 0;
+        for(size_t i = 0; i < iters; ++i) {
+            accum += CallInplaceFunction([captured, i](int64_t x) {return x + captured[0] + i;}, 1);
+        }
+        return accum;
+    });
+    Report(" - interface", iters, [&]() {
+        int64_t accum = 0;
+        for(size_t i = 0; i < iters; ++i) {
+            TLambdaCallable callable{[captured, i](int64_t x) {return x + captured[0] + i;}};
+            accum += CallInterface(callable, 1);
+        }
+        return accum;
+    });
+    Report(" - template", iters, [&]() {
+        int64_t accum = 0;
+        for(size_t i = 0; i < iters; ++i) {
+            accum += CallTemplate([captured, i](int64_t x) {return x + captured[0] + i;}, 1);
+        }
+        return accum;
+    });
+}
+
+int main(int argc, const char* argv[]) {
+    size_t iters = argc > 1 ? atoll(argv[1]) : 100'000'000;
+    int64_t k = argc + 6;
+    auto lambda = [k](int64_t x) {return x * k + 1;};
+
+    std::cout << "call, sizeof: std::function " << sizeof(std::function<TSig>)
+        << ", TFunctionRef " << sizeof(TFunctionRef<TSig>)
+        << ", TInplaceFunction<64> " << sizeof(TInplaceFunction<TSig, 64>) << std::endl;
+    Report(" - std::function", iters, [&]() {return CallStdFunction(lambda, iters);});
+    Report(" - TFunctionRef", iters, [&]() {return CallFunctionRef(lambda, iters);});
+    Report(" - TInplaceFunction", iters, [&]() {return CallInplaceFunction(lambda, iters);});
+    TLambdaCallable callable{[k](int64_t x) {return x * k + 1;}};
+    Report(" - interface", iters, [&]() {return CallInterface(callable, iters);});
+    Report(" - template", iters, [&]() {return CallTemplate(lambda, iters);});
+
+    // std::function keeps up to 16 bytes inline in libstdc++, bigger captures go to the heap
+    BenchConstruct<8>(iters / 10);
+    BenchConstruct<48>(iters / 10);
+    return 0;
+}
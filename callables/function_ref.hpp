@@ -0,0 +1,41 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+// Non owning reference to a callable: a pointer to the object and a pointer to the invoker, nothing else.
+// Never allocates, trivially copyable, cheap to pass by value.
+// The referenced callable must outlive the ref (binding a temporary lambda in a call argument is fine).
+
+template<class TSig>
+class TFunctionRef;
+
+template<class R, class... TArgs>
+class TFunctionRef<R(TArgs...)> {
+public:
+    template<class F>
+        requires (!std::is_same_v<std::remove_cvref_t<F>, TFunctionRef> && std::is_invocable_r_v<R, F&, TArgs...>)
+    TFunctionRef(F&& f) noexcept {
+        if constexpr (std::is_function_v<std::remove_reference_t<F>>) {
+            Object = reinterpret_cast<void*>(&f);
+            Invoker = [](void* object, TArgs... args) -> R {
+                return std::invoke(reinterpret_cast<std::remove_reference_t<F>*>(object), std::forward<TArgs>(args)...);
+            };
+        } else {
+            Object = const_cast<void*>(static_cast<const void*>(std::addressof(f)));
+            Invoker = [](void* object, TArgs... args) -> R {
+                return std::invoke(*static_cast<std::remove_reference_t<F>*>(object), std::forward<TArgs>(args)...);
+            };
+        }
+    }
+
+    R operator()(TArgs... args) const {
+        return Invoker(Object, std::forward<TArgs>(args)...);
+    }
+
+private:
+    void* Object = nullptr;
+    R (*Invoker)(void*, TArgs...) = nullptr;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Owning type erased callable with a fixed inline buffer: never touches the heap,
+// a callable that doesn't fit into Capacity bytes is a compile error.
+// Copyable = false makes a move-only wrapper, which accepts move-only callables (capturing a unique_ptr for example).
+
+template<class TSig, size_t Capacity = 32, bool Copyable = true>
+class TInplaceFunction;
+
+template<class R, class... TArgs, size_t Capacity, bool Copyable>
+class TInplaceFunction<R(TArgs...), Capacity, Copyable> {
+    struct TVTable {
+        R (*Invoke)(void*, TArgs...);
+        void (*MoveTo)(void* from, void* to);
+        void (*CopyTo)(const void* from, void* to);
+        void (*Destroy)(void*);
+    };
+
+    template<class F>
+    static constexpr TVTable VTableFor = {
+        .Invoke = [](void* object, TArgs... args) -> R {
+            return std::invoke(*static_cast<F*>(object), std::forward<TArgs>(args)...);
+        },
+        .MoveTo = [](void* from, void* to) {
+            new(to) F(std::move(*static_cast<F*>(from)));
+            static_cast<F*>(from)->~F();
+        },
+        .CopyTo = [](const void* from, void* to) {
+            if constexpr (Copyable) {
+                new(to) F(*static_cast<const F*>(from));
+            }
+        },
+        .Destroy = [](void* object) {
+            static_cast<F*>(object)->~F();
+        },
+    };
+
+public:
+    TInplaceFunction() noexcept = default;
+
+    template<class F>
+        requires (!std::is_same_v<std::remove_cvref_t<F>, TInplaceFunction> && std::is_invocable_r_v<R, std::decay_t<F>&, TArgs...>)
+    TInplaceFunction(F&& f) {
+        using TFunc = std::decay_t<F>;
+        static_assert(sizeof(TFunc) <= Capacity, "callable doesn't fit into TInplaceFunction, increase Capacity");
+        static_assert(alignof(TFunc) <= alignof(std::max_align_t), "overaligned callable");
+        static_assert(!Copyable || std::is_copy_constructible_v<TFunc>, "use Copyable = false for move-only callables");
+        new(Storage) TFunc(std::forward<F>(f));
+        VTable = &VTableFor<TFunc>;
+    }
+
+    TInplaceFunction(const TInplaceFunction& other) requires Copyable {
+        if (other.VTable) {
+            other.VTable->CopyTo(other.Storage, Storage);
+            VTable = other.VTable;
+        }
+    }
+
+    TInplaceFunction(TInplaceFunction&& other) noexcept {
+        if (other.VTable) {
+            other.VTable->MoveTo(other.Storage, Storage);
+            VTable = std::exchange(other.VTable, nullptr);
+        }
+    }
+
+    TInplaceFunction& operator=(const TInplaceFunction& other) requires Copyable {
+        if (this != &other) {
+            TInplaceFunction copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    TInplaceFunction& operator=(TInplaceFunction&& other) noexcept {
+        if (this != &other) {
+            Reset();
+            if (other.VTable) {
+                other.VTable->MoveTo(other.Storage, Storage);
+                VTable = std::exchange(other.VTable, nullptr);
+            }
+        }
+        return *this;
+    }
+
+    ~TInplaceFunction() {
+        Reset();
+    }
+
+    void Reset() {
+        if (VTable) {
+            VTable->Destroy(Storage);
+            VTable = nullptr;
+        }
+    }
+
+    explicit operator bool() const noexcept {
+        return VTable != nullptr;
+    }
+
+    R operator()(TArgs... args) const {
+        assert(VTable);
+        return VTable->Invoke(const_cast<std::byte*>(Storage), std::forward<TArgs>(args)...);
+    }
+
+private:
+    const TVTable* VTable = nullptr;
+    alignas(std::max_align_t) std::byte Storage[Capacity];
+};
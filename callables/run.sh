@@ -0,0 +1,3 @@
+set -x -e
+clang++ -std=c++20 callables_bench.cpp -o callables_bench.exe -Wall -O2 -DNDEBUG
+./callables_bench.exe | tee report.txt
@@ -0,0 +1,368 @@
+#include "concurrent_map.hpp"
+#include "../bench/bench.hpp"
+#include "../snapshot_pool/snapshot_pool.hpp"
+#include "../work_stealing/work_stealing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// The sharded map with each lock element as the shard lock vs one std::mutex around std::unordered_map,
+// at 1..max threads on pool workers. Keys are Zipfian: a few hot keys take most of the operations,
+// as with real caches and counters, so the hot shards are contended whatever the shards count.
+// An operation is a lookup with readPct percent chance and an increment otherwise, one by one
+// or in batches of BenchBatch. Ns per operation are of all threads: the wall time / operations done.
+// Then the fill of an empty map by writers while readers look up keys, so the tables grow under the readers:
+// ns per insert are of the writers, the reads of a torn or of a missing value after the fill are errors.
+
+using NLockElems::TMutexElem;
+using NLockElems::TAtomicFlagElem;
+using NLockElems::TSharedMutexElem;
+using NLockElems::TShardedRwLockElem;
+using NLockElems::TSeqLockElem;
+
+constexpr uint64_t KeysSeed = 47;
+constexpr uint64_t OpsSeed = 48;
+constexpr uint64_t OpsPerThread = 1 << 16;
+constexpr size_t BenchBatch = 16;
+
+// Sum == Count * key: a value torn between two writes breaks it
+struct TValue {
+    uint64_t Count = 0;
+    uint64_t Sum = 0;
+};
+
+void Increment(uint64_t key, TValue& value) {
+    ++value.Count;
+    value.Sum += key;
+}
+
+bool IsTorn(uint64_t key, const std::optional<TValue>& value) {
+    return value && value->Sum != value->Count * key;
+}
+
+// the rank is scrambled: the hot keys are spread over the shards, not all in the first one.
+// Below ~0, the empty key of the map
+inline uint64_t KeyOf(uint64_t rank) {
+    return NSnapshotPool::CounterRandom(KeysSeed, rank) >> 1;
+}
+
+// ranks 0..n-1 with P(rank) ~ 1 / (rank + 1)^theta, theta != 1: Gray et al. "Quickly generating
+// billion-record synthetic databases", as in YCSB. zeta(n) is O(n) once, a sample is a couple of pow
+class TZipf {
+public:
+    TZipf(uint64_t n, double theta)
+        : N(n)
+        , Theta(theta)
+        , Alpha(1 / (1 - theta))
+        , Zetan(Zeta(n, theta))
+        , Eta((1 - std::pow(2.0 / n, 1 - theta)) / (1 - Zeta(2, theta) / Zetan))
+    {}
+
+    // u is uniform in [0, 1)
+    uint64_t operator()(double u) const {
+        const double uz = u * Zetan;
+        if (uz < 1) {
+            return 0;
+        }
+        if (uz < 1 + std::pow(0.5, Theta)) {
+            return 1;
+        }
+        return std::min<uint64_t>(N - 1, N * std::pow(Eta * u - Eta + 1, Alpha));
+    }
+
+private:
+    static double Zeta(uint64_t n, double theta) {
+        double res = 0;
+        for(uint64_t i = 1; i <= n; ++i) {
+            res += 1 / std::pow(double(i), theta);
+        }
+        return res;
+    }
+
+    uint64_t N;
+    double Theta;
+    double Alpha;
+    double Zetan;
+    double Eta;
+};
+
+struct TOp {
+    uint64_t Key;
+    bool Read;
+};
+
+// OpsPerThread operations of each thread, generated before the runs: pow is slower than the map
+std::vector<TOp> GenerateOps(size_t threadsNum, size_t keysNum, double theta, uint32_t readPct) {
+    const TZipf zipf(keysNum, theta);
+    std::vector<TOp> res(threadsNum * OpsPerThread);
+    NSnapshotPool::ParallelFill(res.size(), [&](size_t begin, size_t end) {
+        for(size_t i = begin; i < end; ++i) {
+            const uint64_t random = NSnapshotPool::CounterRandom(OpsSeed, i);
+            res[i] = TOp{KeyOf(zipf((random >> 11) * 0x1.0p-53)), random % 100 < readPct};
+        }
+    });
+    return res;
+}
+
+// a batch is done under one lock
+struct TMutexUnorderedMap {
+    static constexpr std::string_view Name = "std::mutex + std::unordered_map";
+
+    explicit TMutexUnorderedMap(size_t keysNum) {
+        Map.reserve(keysNum);
+    }
+
+    void FindBatch(std::span<const uint64_t> keys, std::span<std::optional<TValue>> res) {
+        std::lock_guard g(Lock);
+        for(size_t i = 0; i < keys.size(); ++i) {
+            auto it = Map.find(keys[i]);
+            res[i] = it == Map.end() ? std::nullopt : std::optional<TValue>(it->second);
+        }
+    }
+
+    void IncrementBatch(std::span<const uint64_t> keys) {
+        std::lock_guard g(Lock);
+        for(uint64_t key : keys) {
+            Increment(key, Map[key]);
+        }
+    }
+
+    std::mutex Lock;
+    std::unordered_map<uint64_t, TValue> Map;
+};
+
+template<class TLock>
+struct TSharded {
+    static inline const std::string Name = "sharded, " + std::string(TLock::Name);
+
+    explicit TSharded(size_t keysNum)
+        : Map(keysNum)
+    {}
+
+    void FindBatch(std::span<const uint64_t> keys, std::span<std::optional<TValue>> res) {
+        if (keys.size() == 1) {
+            res[0] = Map.Find(keys[0]);
+        } else {
+            Map.FindBatch(keys, res);
+        }
+    }
+
+    void IncrementBatch(std::span<const uint64_t> keys) {
+        if (keys.size() == 1) {
+            Map.Update(keys[0], [&](TValue& value) {Increment(keys[0], value);});
+        } else {
+            Map.UpdateBatch(keys, [&](size_t i, TValue& value) {Increment(keys[i], value);});
+        }
+    }
+
+    NConcurrentMap::TShardedMap<TValue, TLock> Map;
+};
+
+// the ops of a thread by batches of batchSize: the reads of a batch go together, then the increments
+template<class TMap>
+uint64_t DoOps(TMap& map, std::span<const TOp> ops, size_t batchSize) {
+    uint64_t torn = 0;
+    uint64_t reads[BenchBatch];
+    uint64_t writes[BenchBatch];
+    std::optional<TValue> found[BenchBatch];
+    for(size_t begin = 0; begin < ops.size(); begin += batchSize) {
+        size_t readsNum = 0;
+        size_t writesNum = 0;
+        for(const TOp& op : ops.subspan(begin, std::min(batchSize, ops.size() - begin))) {
+            if (op.Read) {
+                reads[readsNum++] = op.Key;
+            } else {
+                writes[writesNum++] = op.Key;
+            }
+        }
+        if (readsNum) {
+            map.FindBatch(std::span<const uint64_t>(reads, readsNum), std::span<std::optional<TValue>>(found, readsNum));
+            for(size_t i = 0; i < readsNum; ++i) {
+                torn += IsTorn(reads[i], found[i]);
+            }
+        }
+        if (writesNum) {
+            map.IncrementBatch(std::span<const uint64_t>(writes, writesNum));
+        }
+    }
+    return torn;
+}
+
+struct TRunOptions {
+    size_t MaxThreads;
+    size_t KeysNum;
+    double Theta;
+    uint32_t ReadPct;
+    uint32_t Samples;
+};
+
+// a map filled with all the keys, then a phase of threadsNum tasks on threadsNum workers is a sample;
+// returns the torn reads seen, 0 for a correct map
+template<class TMap>
+uint64_t RunMap(NBench::TReporter& reporter, const std::vector<TOp>& ops, const TRunOptions& run, size_t batchSize) {
+    TMap map(run.KeysNum);
+    for(uint64_t rank = 0; rank < run.KeysNum; ++rank) {
+        const uint64_t key = KeyOf(rank);
+        map.IncrementBatch(std::span<const uint64_t>(&key, 1));
+    }
+    std::atomic<uint64_t> torn = 0;
+    for(size_t threadsNum = 1; threadsNum <= run.MaxThreads; threadsNum *= 2) {
+        NWorkStealing::TPool workers({.Workers = threadsNum});
+        NBench::TOptions options;
+        options.Iterations = 1;
+        options.WarmupTime = {};
+        options.Samples = run.Samples;
+        const std::string name = std::string(TMap::Name) + (batchSize > 1 ? ", batch " + std::to_string(batchSize) : "")
+            + ", " + std::to_string(threadsNum) + " threads";
+        NBench::TStats stats = NBench::RunManual(name, [&](uint64_t) {
+            auto started = std::chrono::steady_clock::now();
+            workers.ParallelFor(0, threadsNum, 1, [&](size_t t, size_t) {
+                torn += DoOps(map, std::span<const TOp>(ops).subspan(t * OpsPerThread, OpsPerThread), batchSize);
+            });
+            const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+            return NBench::TSample{ns, double(threadsNum * OpsPerThread)};
+        }, options);
+        stats.AddCounter("threads", threadsNum)
+            .AddCounter("mops_per_s", 1e3 / stats.MedianNs);
+        reporter.Add(std::move(stats));
+    }
+    return torn;
+}
+
+// the keys of ranks begin, begin + step, ... below end in batches of BenchBatch, each once
+template<class TMap>
+void InsertKeys(TMap& map, uint64_t begin, uint64_t end, uint64_t step) {
+    uint64_t keys[BenchBatch];
+    size_t keysNum = 0;
+    for(uint64_t rank = begin; rank < end; rank += step) {
+        keys[keysNum++] = KeyOf(rank);
+        if (keysNum == BenchBatch || rank + step >= end) {
+            map.IncrementBatch(std::span<const uint64_t>(keys, keysNum));
+            keysNum = 0;
+        }
+    }
+}
+
+// batches of random keys of all ranks till done, inserted or not yet; returns the torn reads
+template<class TMap>
+uint64_t ReadWhileInserting(TMap& map, uint64_t keysNum, uint64_t seed, const std::atomic<bool>& done, uint64_t& reads) {
+    uint64_t torn = 0;
+    uint64_t keys[BenchBatch];
+    std::optional<TValue> found[BenchBatch];
+    for(uint64_t counter = 0; !done.load(std::memory_order_relaxed);) {
+        for(uint64_t& key : keys) {
+            key = KeyOf(NSnapshotPool::CounterRandom(seed, counter++) % keysNum);
+        }
+        map.FindBatch(std::span<const uint64_t>(keys, BenchBatch), std::span<std::optional<TValue>>(found, BenchBatch));
+        for(size_t i = 0; i < BenchBatch; ++i) {
+            torn += IsTorn(keys[i], found[i]);
+        }
+        reads += BenchBatch;
+    }
+    return torn;
+}
+
+// a sample is the fill of an empty map with all the keys by threadsNum / 2 writer threads,
+// while as many reader threads look up random keys; returns the torn reads and the keys missing after the fill
+template<class TMap>
+uint64_t RunInserts(NBench::TReporter& reporter, const TRunOptions& run) {
+    uint64_t errors = 0;
+    for(size_t threadsNum = 2; threadsNum <= std::max<size_t>(2, run.MaxThreads); threadsNum *= 2) {
+        const size_t writersNum = threadsNum / 2;
+        NBench::TOptions options;
+        options.Iterations = 1;
+        options.WarmupTime = {};
+        options.Samples = run.Samples;
+        uint64_t reads = 0;
+        uint64_t inserts = 0;
+        const std::string name = std::string(TMap::Name) + ", fill from empty, " + std::to_string(writersNum) + " writers + "
+            + std::to_string(threadsNum - writersNum) + " readers";
+        NBench::TStats stats = NBench::RunManual(name, [&](uint64_t) {
+            TMap map(0);
+            std::atomic<bool> done = false;
+            std::atomic<uint64_t> torn = 0;
+            std::vector<uint64_t> threadReads(threadsNum - writersNum);
+            std::vector<std::thread> readers;
+            for(size_t t = 0; t < threadsNum - writersNum; ++t) {
+                readers.emplace_back([&, t] {
+                    torn += ReadWhileInserting(map, run.KeysNum, OpsSeed + t, done, threadReads[t]);
+                });
+            }
+            auto started = std::chrono::steady_clock::now();
+            std::vector<std::thread> writers;
+            for(size_t t = 0; t < writersNum; ++t) {
+                writers.emplace_back([&, t] {
+                    InsertKeys(map, t, run.KeysNum, writersNum);
+                });
+            }
+            for(std::thread& writer : writers) {
+                writer.join();
+            }
+            const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+            done.store(true, std::memory_order_relaxed);
+            for(std::thread& reader : readers) {
+                reader.join();
+            }
+            for(uint64_t r : threadReads) {
+                reads += r;
+            }
+            inserts += run.KeysNum;
+            errors += torn;
+            // every key once: Count == 1
+            std::optional<TValue> found;
+            for(uint64_t rank = 0; rank < run.KeysNum; ++rank) {
+                const uint64_t key = KeyOf(rank);
+                map.FindBatch(std::span<const uint64_t>(&key, 1), std::span<std::optional<TValue>>(&found, 1));
+                errors += !found || found->Count != 1 || IsTorn(key, found);
+            }
+            return NBench::TSample{ns, double(run.KeysNum)};
+        }, options);
+        stats.AddCounter("threads", threadsNum)
+            .AddCounter("reads_per_insert", double(reads) / inserts)
+            .AddCounter("mops_per_s", 1e3 / stats.MedianNs);
+        reporter.Add(std::move(stats));
+    }
+    return errors;
+}
+
+template<class TMap>
+uint64_t RunBoth(NBench::TReporter& reporter, const std::vector<TOp>& ops, const TRunOptions& run) {
+    return RunMap<TMap>(reporter, ops, run, 1) + RunMap<TMap>(reporter, ops, run, BenchBatch) + RunInserts<TMap>(reporter, run);
+}
+
+int main(int argc, const char* argv[]) {
+    TRunOptions run;
+    run.MaxThreads = argc > 1 ? atoll(argv[1]) : 64;
+    run.KeysNum = argc > 2 ? atoll(argv[2]) : 1 << 20;
+    run.Theta = argc > 3 ? atof(argv[3]) : 0.99;
+    run.ReadPct = argc > 4 ? atoi(argv[4]) : 90;
+    run.Samples = argc > 5 ? atoi(argv[5]) : 5;
+
+    std::cout << run.KeysNum << " keys, zipf theta " << run.Theta << ", " << run.ReadPct << "% reads" << std::endl;
+    const std::vector<TOp> ops = GenerateOps(run.MaxThreads, run.KeysNum, run.Theta, run.ReadPct);
+
+    NBench::TReporter reporter("concurrent_map");
+    uint64_t torn = RunBoth<TMutexUnorderedMap>(reporter, ops, run);
+    torn += RunBoth<TSharded<TMutexElem>>(reporter, ops, run);
+    torn += RunBoth<TSharded<TAtomicFlagElem>>(reporter, ops, run);
+    torn += RunBoth<TSharded<TSharedMutexElem>>(reporter, ops, run);
+    torn += RunBoth<TSharded<TShardedRwLockElem>>(reporter, ops, run);
+    torn += RunBoth<TSharded<TSeqLockElem>>(reporter, ops, run);
+    if (torn) {
+        std::cout << "ERROR: " << torn << " torn reads or lost keys" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,290 @@
+#pragma once
+
+#include "../hash_map_reorders/hashes.hpp"
+#include "../test_locks/lock_elems.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <span>
+#include <type_traits>
+#include <vector>
+
+// A concurrent uint64_t -> TValue map: ShardsNum shards, each in its own cache lines,
+// an open addressing table (linear probing) in each.
+//
+// Writers take the shard lock, TLock is any lock element of test_locks, and make the shard version odd
+// for the time of the change, as TSeqLockElem does. Readers take no lock: they load the version, probe,
+// and load the version again, retrying if a writer was there; a reader writes nothing, so the readers
+// of a hot shard don't move its lines between cores. Values are copied by 8 byte words through atomic_ref:
+// TValue is trivially copyable and a multiple of 8 bytes, a read sees the whole value of one write.
+// After OptimisticTries failed tries (the shard is busy with writers) a reader takes the lock too:
+// LockShared if the element has it, Lock otherwise.
+//
+// A table grows by 2x at 3/4 load and the old one is kept till the destruction, a reader may be inside it
+// (as the arrays of the work stealing deque): at most as much memory again. There is no erase.
+//
+// FindBatch / UpdateBatch hash a chunk of up to BatchSize keys, prefetch their slots, order them by shard
+// and go to each shard once: a version check or a lock per shard of the chunk, not per key.
+//
+// The shard is taken from the high half of the hash and the slot from the low bits:
+// the hasher must give 64 good bits (not crc32). Key ~0 marks an empty slot and can't be stored:
+// an update of it asserts, and skips the key in release builds; a find of it finds nothing.
+
+namespace NConcurrentMap {
+
+constexpr uint64_t EmptyKey = std::numeric_limits<uint64_t>::max();
+constexpr size_t BatchSize = 64;
+constexpr uint32_t OptimisticTries = 4;
+
+template<class TValue, class TLock = NLockElems::TMutexElem, class THash = NHashes::TWyHash, size_t ShardsNum = 64>
+class TShardedMap {
+    static_assert(std::is_trivially_copyable_v<TValue> && sizeof(TValue) % sizeof(uint64_t) == 0,
+        "values are copied by 8 byte words");
+    static_assert(ShardsNum <= std::numeric_limits<uint32_t>::max() / BatchSize, "a batch orders keys by shard * BatchSize + index");
+
+    static constexpr size_t WordsNum = sizeof(TValue) / sizeof(uint64_t);
+
+    struct TSlot {
+        uint64_t Key = EmptyKey;
+        uint64_t Words[WordsNum] = {};
+    };
+
+    struct TTable {
+        size_t Mask;
+        std::unique_ptr<TSlot[]> Slots;
+
+        explicit TTable(size_t size)
+            : Mask(size - 1)
+            , Slots(std::make_unique<TSlot[]>(size))
+        {}
+    };
+
+    struct alignas(NLockElems::CacheLineSize) TShard {
+        TLock Lock;
+        // odd while a writer is inside
+        std::atomic<uint64_t> Version = 0;
+        std::atomic<TTable*> Table = nullptr;
+        std::atomic<size_t> Size = 0;
+        // the current table and the ones it grew from, under the lock
+        std::vector<std::unique_ptr<TTable>> Tables;
+    };
+
+public:
+    explicit TShardedMap(size_t expectedSize = 0) {
+        const size_t tableSize = std::bit_ceil(std::max<size_t>(16, expectedSize / ShardsNum * 4 / 3 + 1));
+        for(TShard& shard : Shards) {
+            shard.Tables.push_back(std::make_unique<TTable>(tableSize));
+            shard.Table.store(shard.Tables.back().get(), std::memory_order_release);
+        }
+    }
+    TShardedMap(const TShardedMap&) = delete;
+    TShardedMap& operator=(const TShardedMap&) = delete;
+
+    std::optional<TValue> Find(uint64_t key) const {
+        std::optional<TValue> res;
+        FindBatch(std::span<const uint64_t>(&key, 1), std::span<std::optional<TValue>>(&res, 1));
+        return res;
+    }
+
+    // value = change(value) under the shard lock, a new key starts with TValue{}
+    template<class TChange>
+    void Update(uint64_t key, TChange&& change) {
+        UpdateBatch(std::span<const uint64_t>(&key, 1), [&](size_t, TValue& value) {change(value);});
+    }
+
+    void Upsert(uint64_t key, const TValue& value) {
+        Update(key, [&](TValue& prev) {prev = value;});
+    }
+
+    // res[i] is the value of keys[i]
+    void FindBatch(std::span<const uint64_t> keys, std::span<std::optional<TValue>> res) const {
+        ForEachShardGroup(keys, [&](TShard& shard, const uint64_t* hashes, const uint32_t* group, size_t n, size_t begin) {
+            for(uint32_t tries = 0; tries < OptimisticTries; ++tries) {
+                if (TryFindGroup(shard, keys.data() + begin, hashes, group, n, res.data() + begin)) {
+                    return;
+                }
+            }
+            // no writer is inside under the lock: the try succeeds
+            if constexpr (requires {shard.Lock.LockShared();}) {
+                shard.Lock.LockShared();
+                TryFindGroup(shard, keys.data() + begin, hashes, group, n, res.data() + begin);
+                shard.Lock.UnLockShared();
+            } else {
+                shard.Lock.Lock();
+                TryFindGroup(shard, keys.data() + begin, hashes, group, n, res.data() + begin);
+                shard.Lock.UnLock();
+            }
+        });
+    }
+
+    // change(i, value) for keys[i] under the shard lock, a new key starts with TValue{}
+    template<class TChange>
+    void UpdateBatch(std::span<const uint64_t> keys, TChange&& change) {
+        assert(std::find(keys.begin(), keys.end(), EmptyKey) == keys.end() && "key ~0 marks an empty slot");
+        ForEachShardGroup(keys, [&](TShard& shard, const uint64_t* hashes, const uint32_t* group, size_t n, size_t begin) {
+            shard.Lock.Lock();
+            // the odd version is visible before any of the slot stores
+            shard.Version.store(shard.Version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            for(size_t j = 0; j < n; ++j) {
+                const uint32_t i = group[j];
+                if (keys[begin + i] == EmptyKey) [[unlikely]] {
+                    continue;
+                }
+                TSlot* slot = Emplace(shard, keys[begin + i], hashes[i]);
+                TValue value = LoadValue(*slot);
+                change(begin + i, value);
+                StoreValue(*slot, value);
+            }
+            shard.Version.store(shard.Version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+            shard.Lock.UnLock();
+        });
+    }
+
+    size_t Size() const {
+        size_t res = 0;
+        for(const TShard& shard : Shards) {
+            res += shard.Size.load(std::memory_order_relaxed);
+        }
+        return res;
+    }
+
+private:
+    static uint64_t Load(uint64_t& word) {
+        return std::atomic_ref<uint64_t>(word).load(std::memory_order_relaxed);
+    }
+    static void Store(uint64_t& word, uint64_t value) {
+        std::atomic_ref<uint64_t>(word).store(value, std::memory_order_relaxed);
+    }
+
+    static TValue LoadValue(TSlot& slot) {
+        uint64_t words[WordsNum];
+        for(size_t w = 0; w < WordsNum; ++w) {
+            words[w] = Load(slot.Words[w]);
+        }
+        TValue res;
+        std::memcpy(&res, words, sizeof(TValue));
+        return res;
+    }
+    static void StoreValue(TSlot& slot, const TValue& value) {
+        uint64_t words[WordsNum];
+        std::memcpy(words, &value, sizeof(TValue));
+        for(size_t w = 0; w < WordsNum; ++w) {
+            Store(slot.Words[w], words[w]);
+        }
+    }
+
+    static size_t ShardOf(uint64_t hash) {
+        return (hash >> 32) % ShardsNum;
+    }
+
+    // the slot of the key or the empty one it goes to: a table is never full
+    static TSlot* Probe(TTable* table, uint64_t key, uint64_t hash) {
+        for(size_t i = hash & table->Mask;; i = (i + 1) & table->Mask) {
+            const uint64_t slotKey = Load(table->Slots[i].Key);
+            if (slotKey == key || slotKey == EmptyKey) {
+                return &table->Slots[i];
+            }
+        }
+    }
+
+    // onGroup(shard, hashes, group, n, begin) for the keys of a shard in each chunk:
+    // keys[begin + group[j]], j < n, hashes are by the index in the chunk
+    template<class TOnGroup>
+    void ForEachShardGroup(std::span<const uint64_t> keys, TOnGroup&& onGroup) const {
+        uint64_t hashes[BatchSize];
+        uint32_t order[BatchSize];
+        for(size_t begin = 0; begin < keys.size(); begin += BatchSize) {
+            const size_t n = std::min(BatchSize, keys.size() - begin);
+            for(size_t i = 0; i < n; ++i) {
+                hashes[i] = THash()(keys[begin + i]);
+                const size_t shard = ShardOf(hashes[i]);
+                TTable* table = Shards[shard].Table.load(std::memory_order_acquire);
+                __builtin_prefetch(&table->Slots[hashes[i] & table->Mask]);
+                order[i] = shard * BatchSize + i;
+            }
+            std::sort(order, order + n);
+            for(size_t j = 0; j < n;) {
+                const size_t shard = order[j] / BatchSize;
+                size_t end = j;
+                for(; end < n && order[end] / BatchSize == shard; ++end) {
+                    order[end] %= BatchSize;
+                }
+                onGroup(Shards[shard], hashes, order + j, end - j, begin);
+                j = end;
+            }
+        }
+    }
+
+    // the group in one version window: false if a writer was inside, res is garbage then
+    static bool TryFindGroup(TShard& shard, const uint64_t* keys, const uint64_t* hashes, const uint32_t* group, size_t n, std::optional<TValue>* res) {
+        const uint64_t before = shard.Version.load(std::memory_order_acquire);
+        if (before % 2 != 0) {
+            return false;
+        }
+        TTable* table = shard.Table.load(std::memory_order_acquire);
+        for(size_t j = 0; j < n; ++j) {
+            const uint32_t i = group[j];
+            TSlot* slot = Probe(table, keys[i], hashes[i]);
+            // the empty key "matches" the empty slot its probe stops at
+            if (Load(slot->Key) == keys[i] && keys[i] != EmptyKey) {
+                res[i] = LoadValue(*slot);
+            } else {
+                res[i].reset();
+            }
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return shard.Version.load(std::memory_order_relaxed) == before;
+    }
+
+    // under the lock, the version is odd: the value words of a new slot are stored before its key
+    TSlot* Emplace(TShard& shard, uint64_t key, uint64_t hash) {
+        TTable* table = shard.Table.load(std::memory_order_relaxed);
+        TSlot* slot = Probe(table, key, hash);
+        if (Load(slot->Key) == key) {
+            return slot;
+        }
+        const size_t size = shard.Size.load(std::memory_order_relaxed) + 1;
+        if (size * 4 > (table->Mask + 1) * 3) {
+            table = Grow(shard);
+            slot = Probe(table, key, hash);
+        }
+        StoreValue(*slot, TValue{});
+        Store(slot->Key, key);
+        shard.Size.store(size, std::memory_order_relaxed);
+        return slot;
+    }
+
+    TTable* Grow(TShard& shard) {
+        TTable* old = shard.Table.load(std::memory_order_relaxed);
+        auto table = std::make_unique<TTable>((old->Mask + 1) * 2);
+        for(size_t i = 0; i <= old->Mask; ++i) {
+            TSlot& from = old->Slots[i];
+            const uint64_t key = Load(from.Key);
+            if (key == EmptyKey) {
+                continue;
+            }
+            // the new table is not published yet
+            TSlot* to = Probe(table.get(), key, THash()(key));
+            to->Key = key;
+            for(size_t w = 0; w < WordsNum; ++w) {
+                to->Words[w] = Load(from.Words[w]);
+            }
+        }
+        shard.Table.store(table.get(), std::memory_order_release);
+        shard.Tables.push_back(std::move(table));
+        return shard.Tables.back().get();
+    }
+
+    // readers may take the lock
+    mutable TShard Shards[ShardsNum];
+};
+
+}
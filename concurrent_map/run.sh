@@ -0,0 +1,4 @@
+set -x -e
+clang++ -std=c++20 concurrent_map.cpp -o concurrent_map.exe -Wall -O2 -DNDEBUG
+# args: [max threads=64] [keys=1048576] [zipf theta=0.99] [read percent=90] [samples=5]
+BENCH_JSON=report.json ./concurrent_map.exe | tee report.txt
@@ -0,0 +1,241 @@
+#include "epoch_publish.hpp"
+#include "../bench/bench.hpp"
+#include "../hdr_histogram/hdr_histogram.hpp"
+#include "../snapshot_pool/snapshot_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using TMap = std::unordered_map<uint64_t, uint64_t>;
+
+constexpr uint64_t KeysSeed = 41;
+constexpr uint64_t LookupsPerThread = 1 << 20;
+// lookups are timed in batches: a stall of any of them (a free of a whole map) is in the batch time
+constexpr uint64_t LookupsPerBatch = 64;
+
+inline uint64_t Key(uint64_t index) {
+    return NSnapshotPool::CounterRandom(KeysSeed, index);
+}
+
+// a version of the config; alive versions are counted, to see how many of them a publish method keeps
+struct TVersion {
+    static inline std::atomic<int64_t> Alive = 0;
+    static inline std::atomic<int64_t> MaxAlive = 0;
+
+    uint64_t Number;
+    TMap Map;
+
+    TVersion(uint64_t number, const TMap& map)
+        : Number(number)
+        , Map(map)
+    {
+        const int64_t alive = Alive.fetch_add(1) + 1;
+        int64_t prev = MaxAlive.load();
+        while(prev < alive && !MaxAlive.compare_exchange_weak(prev, alive)) {}
+    }
+    TVersion(const TVersion&) = delete;
+    ~TVersion() {
+        Alive.fetch_sub(1);
+    }
+
+    uint64_t Lookup(uint64_t key) const {
+        auto it = Map.find(key);
+        return it == Map.end() ? 0 : it->second;
+    }
+};
+
+// readers look up under the lock, the writer swaps the pointer under it and frees the old version after
+struct TMutexPublish {
+    static constexpr std::string_view Name = "std::mutex";
+    struct TReader {};
+
+    TReader GetReader() {return {};}
+    uint64_t Lookup(TReader&, uint64_t key) {
+        std::lock_guard g(Lock);
+        return Current->Lookup(key);
+    }
+    void Publish(std::unique_ptr<TVersion> version) {
+        {
+            std::lock_guard g(Lock);
+            std::swap(Current, version);
+        }
+    }
+
+    std::mutex Lock;
+    std::unique_ptr<TVersion> Current;
+};
+
+// a reference per lookup on the shared counter; the last reader of the old version frees it
+struct TSharedPtrPublish {
+    static constexpr std::string_view Name = "std::atomic<std::shared_ptr>";
+    struct TReader {};
+
+    TReader GetReader() {return {};}
+    uint64_t Lookup(TReader&, uint64_t key) {
+        return Current.load(std::memory_order_acquire)->Lookup(key);
+    }
+    void Publish(std::unique_ptr<TVersion> version) {
+        Current.store(std::shared_ptr<const TVersion>(std::move(version)), std::memory_order_release);
+    }
+
+    std::atomic<std::shared_ptr<const TVersion>> Current;
+};
+
+struct TEpochPublish {
+    static constexpr std::string_view Name = "epoch";
+    using TReader = NEpoch::TDomain::TReader;
+
+    TReader GetReader() {return Domain.GetReader();}
+    uint64_t Lookup(TReader& reader, uint64_t key) {
+        auto guard = reader.Enter();
+        return Current.Get(guard)->Lookup(key);
+    }
+    void Publish(std::unique_ptr<TVersion> version) {
+        Current.Publish(std::move(version));
+    }
+
+    NEpoch::TDomain Domain;
+    // destroyed before the domain: its last version is retired there
+    NEpoch::TPublished<TVersion> Current{Domain};
+};
+
+// rebuilds the map (a copy with one changed value) and publishes it every period, or as often as it can
+template<class TVariant>
+class TRepublisher {
+public:
+    TRepublisher(TVariant& variant, const TMap& base, std::chrono::microseconds period)
+        : Started(std::chrono::steady_clock::now())
+        , Thread([&variant, &base, period, this]() {
+            auto deadline = Started + period;
+            for(uint64_t number = 1; !Stop.load(); ++number) {
+                auto next = std::make_unique<TVersion>(number, base);
+                next->Map[Key(number % base.size())] = number;
+                std::this_thread::sleep_until(deadline);
+                auto publishStarted = std::chrono::steady_clock::now();
+                variant.Publish(std::move(next));
+                auto publishFinished = std::chrono::steady_clock::now();
+                PublishNs.fetch_add((publishFinished - publishStarted).count());
+                Publishes.fetch_add(1);
+                deadline = std::max(deadline + period, publishFinished);
+            }
+        })
+    {}
+
+    ~TRepublisher() {
+        Stop = true;
+        Thread.join();
+    }
+
+    double PeriodMs() const {
+        const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - Started).count();
+        return Publishes.load() ? elapsed / Publishes.load() : 0;
+    }
+
+    std::atomic<uint64_t> Publishes = 0;
+    // with the free of the old version, when the writer does it
+    std::atomic<uint64_t> PublishNs = 0;
+
+private:
+    std::atomic<bool> Stop = false;
+    const std::chrono::steady_clock::time_point Started;
+    std::thread Thread;
+};
+
+// threadsNum readers of random keys while the writer republishes; the sample is the slowest reader
+// and the lookups of all of them, so the rate is the total lookup throughput
+template<class TVariant>
+void RunReaders(NBench::TReporter& reporter, const TMap& base, size_t threadsNum, std::chrono::microseconds period, uint32_t samples) {
+    TVariant variant;
+    variant.Publish(std::make_unique<TVersion>(0, base));
+    std::vector<typename TVariant::TReader> readers;
+    for(size_t t = 0; t < threadsNum; ++t) {
+        // a handle per reader thread, the threads of the next sample take them over
+        readers.push_back(variant.GetReader());
+    }
+    NHdrHistogram::TConcurrentHistogram batchLatencies;
+    std::vector<NHdrHistogram::TConcurrentHistogram::TRecorder> recorders;
+    for(size_t t = 0; t < threadsNum; ++t) {
+        recorders.push_back(batchLatencies.GetRecorder());
+    }
+
+    NBench::TOptions options;
+    options.Iterations = 1;
+    options.WarmupTime = {};
+    options.Samples = samples;
+    TVersion::MaxAlive = TVersion::Alive.load();
+    TRepublisher<TVariant> writer(variant, base, period);
+    NBench::TStats stats = NBench::RunManual(std::string(TVariant::Name) + ", " + std::to_string(threadsNum) + " readers", [&](uint64_t) {
+        std::vector<double> elapsed(threadsNum);
+        std::vector<std::thread> threads;
+        std::atomic<bool> start = false;
+        for(size_t t = 0; t < threadsNum; ++t) {
+            threads.emplace_back([&, t]() {
+                while(!start.load()) {}
+                uint64_t sum = 0;
+                const uint64_t seed = NSnapshotPool::CounterRandom(t, elapsed.size());
+                auto started = std::chrono::steady_clock::now();
+                auto batchStarted = started;
+                for(uint64_t i = 0; i < LookupsPerThread; ++i) {
+                    sum += variant.Lookup(readers[t], Key(NSnapshotPool::CounterRandom(seed, i) % base.size()));
+                    if ((i + 1) % LookupsPerBatch == 0) {
+                        auto batchFinished = std::chrono::steady_clock::now();
+                        recorders[t].Record((batchFinished - batchStarted).count());
+                        batchStarted = batchFinished;
+                    }
+                }
+                elapsed[t] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+                NBench::DoNotOptimize(sum);
+            });
+        }
+        start = true;
+        for(auto& t : threads) {
+            t.join();
+        }
+        return NBench::TSample{*std::max_element(elapsed.begin(), elapsed.end()), double(LookupsPerThread * threadsNum)};
+    }, options);
+
+    stats.AddCounter("readers", threadsNum)
+        .AddCounter("publishes", writer.Publishes.load())
+        .AddCounter("publish_period_ms", writer.PeriodMs())
+        .AddCounter("publish_us", writer.Publishes.load() ? writer.PublishNs.load() / 1e3 / writer.Publishes.load() : 0)
+        .AddCounter("max_alive_versions", TVersion::MaxAlive.load())
+        .AddQuantiles("batch64_", batchLatencies.Snapshot());
+    reporter.Add(std::move(stats));
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t maxThreads = argc > 1 ? atoll(argv[1]) : std::max(4u, std::thread::hardware_concurrency());
+    const size_t mapSize = argc > 2 ? atoll(argv[2]) : 1'000'000;
+    const auto period = std::chrono::microseconds(uint64_t((argc > 3 ? atof(argv[3]) : 5) * 1000));
+    const uint32_t samples = argc > 4 ? atoi(argv[4]) : 10;
+
+    TMap base;
+    base.reserve(mapSize);
+    for(size_t i = 0; i < mapSize; ++i) {
+        base[Key(i)] = i;
+    }
+    const auto copyStarted = std::chrono::steady_clock::now();
+    {
+        TVersion copy(0, base);
+        NBench::DoNotOptimize(copy);
+    }
+    std::cout << "map of " << mapSize << " keys, copy + free "
+        << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - copyStarted).count() << " ms" << std::endl;
+
+    NBench::TReporter reporter("epoch_publish");
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        RunReaders<TMutexPublish>(reporter, base, threadsNum, period, samples);
+        RunReaders<TSharedPtrPublish>(reporter, base, threadsNum, period, samples);
+        RunReaders<TEpochPublish>(reporter, base, threadsNum, period, samples);
+    }
+    return 0;
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <deque>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Publishing rebuilt read only data (config maps reloaded as a whole) to many reader threads
+// without a lock or a shared refcount per lookup: epoch based reclamation.
+//
+// TDomain keeps a global epoch and a slot per reader thread, each in its own cache line.
+// A reader enters by storing the current epoch into its slot and leaves by storing 0:
+// two stores to a line nobody else writes, wait free. A writer swaps the pointer of TPublished,
+// retires the old version with the epoch it advanced from, and frees the retired versions
+// older than every slot in use: a reader that entered later loads the new pointer.
+// A reader must not stay inside for long, the retired versions wait for it.
+//
+// TReader is a thread's handle, as TConcurrentHistogram::TRecorder: one per thread, kept for the thread life,
+// it must not outlive the domain; the domain frees what is left at destruction.
+
+namespace NEpoch {
+
+class TDomain {
+    struct alignas(64) TSlot {
+        // the epoch the reader entered at, 0 outside
+        std::atomic<uint64_t> Epoch = 0;
+    };
+
+    struct TRetired {
+        uint64_t Epoch;
+        void* Ptr;
+        void (*Delete)(void*);
+    };
+
+public:
+    class TReader;
+
+    // the objects loaded from the domain's TPublished stay alive while the guard is alive
+    class TGuard {
+    public:
+        TGuard(const TGuard&) = delete;
+        TGuard& operator=(const TGuard&) = delete;
+        ~TGuard() {
+            Slot->Epoch.store(0, std::memory_order_release);
+        }
+
+    private:
+        friend class TReader;
+        TGuard(TSlot* slot, uint64_t epoch)
+            : Slot(slot)
+        {
+            assert(Slot->Epoch.load(std::memory_order_relaxed) == 0 && "guards don't nest");
+            // seq_cst: the store is visible before the pointer is loaded, or the writer would miss the reader
+            Slot->Epoch.store(epoch, std::memory_order_seq_cst);
+        }
+
+        TSlot* Slot;
+    };
+
+    class TReader {
+    public:
+        TGuard Enter() {
+            return TGuard(Slot, Domain->GlobalEpoch.load(std::memory_order_acquire));
+        }
+
+    private:
+        friend class TDomain;
+        TReader(TDomain* domain, TSlot* slot)
+            : Domain(domain)
+            , Slot(slot)
+        {}
+
+        TDomain* Domain;
+        TSlot* Slot;
+    };
+
+    TDomain() = default;
+    TDomain(const TDomain&) = delete;
+    TDomain& operator=(const TDomain&) = delete;
+    ~TDomain() {
+        for(const TRetired& r : Retired) {
+            r.Delete(r.Ptr);
+        }
+    }
+
+    TReader GetReader() {
+        std::lock_guard g(Lock);
+        return TReader(this, &Slots.emplace_back());
+    }
+
+    // the object was unpublished already: new readers can't load it
+    template<class T>
+    void Retire(T* ptr) {
+        if (!ptr) {
+            return;
+        }
+        // readers that enter at a later epoch load the new pointer
+        const uint64_t epoch = GlobalEpoch.fetch_add(1, std::memory_order_seq_cst);
+        std::lock_guard g(Lock);
+        Retired.push_back({epoch, ptr, [](void* p) {delete static_cast<T*>(p);}});
+    }
+
+    // frees what no reader can hold, outside of the lock; returns the number of freed objects
+    size_t Reclaim() {
+        std::vector<TRetired> free;
+        {
+            std::lock_guard g(Lock);
+            uint64_t oldestReader = std::numeric_limits<uint64_t>::max();
+            for(const TSlot& slot : Slots) {
+                const uint64_t epoch = slot.Epoch.load(std::memory_order_seq_cst);
+                if (epoch) {
+                    oldestReader = std::min(oldestReader, epoch);
+                }
+            }
+            auto held = std::partition(Retired.begin(), Retired.end(), [&](const TRetired& r) {
+                return r.Epoch < oldestReader;
+            });
+            free.assign(Retired.begin(), held);
+            Retired.erase(Retired.begin(), held);
+        }
+        for(const TRetired& r : free) {
+            r.Delete(r.Ptr);
+        }
+        return free.size();
+    }
+
+    size_t PendingCount() const {
+        std::lock_guard g(Lock);
+        return Retired.size();
+    }
+
+private:
+    // starts from 1: 0 is a free slot
+    std::atomic<uint64_t> GlobalEpoch = 1;
+    mutable std::mutex Lock;
+    // a deque never moves its elements
+    std::deque<TSlot> Slots;
+    std::vector<TRetired> Retired;
+};
+
+// a pointer to the current version of T, read under a TGuard of the domain
+template<class T>
+class TPublished {
+public:
+    explicit TPublished(TDomain& domain, std::unique_ptr<T> initial = {})
+        : Domain(domain)
+        , Current(initial.release())
+    {}
+    TPublished(const TPublished&) = delete;
+    TPublished& operator=(const TPublished&) = delete;
+    ~TPublished() {
+        Domain.Retire(Current.load(std::memory_order_relaxed));
+    }
+
+    // valid while the guard is alive, nullptr before the first publish
+    const T* Get(const TDomain::TGuard&) const {
+        // seq_cst against the slot store of the guard, a plain load on x86
+        return Current.load(std::memory_order_seq_cst);
+    }
+
+    // the old version is retired and freed by this or a later Reclaim once no reader holds it;
+    // returns the number of freed versions
+    size_t Publish(std::unique_ptr<T> value) {
+        T* old = Current.exchange(value.release(), std::memory_order_seq_cst);
+        Domain.Retire(old);
+        return Domain.Reclaim();
+    }
+
+private:
+    TDomain& Domain;
+    std::atomic<T*> Current;
+};
+
+}
@@ -0,0 +1,4 @@
+set -x -e
+clang++ -std=c++20 epoch_publish.cpp -o epoch_publish.exe -Wall -O2 -DNDEBUG
+# args: [max reader threads] [map size] [publish period ms] [samples]
+BENCH_JSON=report.json ./epoch_publish.exe | tee report.txt
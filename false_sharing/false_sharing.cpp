@@ -0,0 +1,112 @@
+#include "false_sharing.hpp"
+#include "../bench/bench.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace NFalseSharing;
+
+// What the instrumentation costs per access, and the classic case it is for: per thread counters
+// next to each other vs one per cache line. The report of the packed ones names the counters
+// of every thread in the shared line, the padded ones give an empty report.
+
+constexpr uint64_t IncrementsPerThread = 1 << 22;
+
+struct TPackedCounter {
+    uint64_t Value = 0;
+};
+
+struct alignas(LineSize) TPaddedCounter {
+    uint64_t Value = 0;
+};
+
+// one thread over a buffer of counters, every increment recorded as a write: the untracked lines
+// cost the sampling check only
+void RunOverhead(NBench::TReporter& reporter) {
+    std::vector<TPackedCounter> counters(1 << 16);
+    reporter.Add(NBench::Run("plain increment", [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            TPackedCounter& counter = counters[i % counters.size()];
+            counter.Value += 1;
+            NBench::ClobberMemory();
+        }
+    }));
+    for(uint32_t sampleEvery : {1u << 30, 64u, 1u}) {
+        LineSampleEvery = sampleEvery;
+        Reset();
+        reporter.Add(NBench::Run("instrumented increment, lines sampled 1/" + std::to_string(sampleEvery), [&](uint64_t iters) {
+            for(uint64_t i = 0; i < iters; ++i) {
+                TPackedCounter& counter = counters[i % counters.size()];
+                OnWrite(counter);
+                counter.Value += 1;
+                NBench::ClobberMemory();
+            }
+        }));
+    }
+}
+
+// threadsNum threads increment their own counters, the sample is the slowest thread, per increment
+template<class TCounter, bool Instrumented>
+NBench::TSample DoCounters(std::vector<TCounter>& counters) {
+    std::atomic<bool> start = false;
+    std::vector<double> elapsed(counters.size());
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < counters.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            TCounter& counter = counters[t];
+            while(!start.load()) {}
+            auto started = std::chrono::steady_clock::now();
+            for(uint64_t i = 0; i < IncrementsPerThread; ++i) {
+                if constexpr (Instrumented) {
+                    OnWrite(counter);
+                }
+                std::atomic_ref<uint64_t>(counter.Value).fetch_add(1, std::memory_order_relaxed);
+            }
+            elapsed[t] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+        });
+    }
+    start = true;
+    for(auto& t : threads) {
+        t.join();
+    }
+    return NBench::TSample{*std::max_element(elapsed.begin(), elapsed.end()), double(IncrementsPerThread)};
+}
+
+// the timed phases, then one more instrumented phase for the report: the threads are new in every phase,
+// a counter must have one writer in the report
+template<class TCounter>
+void RunCounters(NBench::TReporter& reporter, const std::string& name, size_t threadsNum) {
+    std::vector<TCounter> counters(threadsNum);
+    NBench::TOptions options;
+    options.Iterations = 1;
+    options.WarmupTime = {};
+    options.Samples = 5;
+    const std::string suffix = ", " + std::to_string(threadsNum) + " threads";
+    reporter.Add(NBench::RunManual(name + suffix, [&](uint64_t) {
+        return DoCounters<TCounter, false>(counters);
+    }, options));
+    reporter.Add(NBench::RunManual(name + ", instrumented" + suffix, [&](uint64_t) {
+        return DoCounters<TCounter, true>(counters);
+    }, options));
+    Reset();
+    DoCounters<TCounter, true>(counters);
+    std::cout << name << ": ";
+    Dump(std::cout);
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t threadsNum = argc > 1 ? atoll(argv[1]) : std::max(2u, std::min(8u, std::thread::hardware_concurrency()));
+    NBench::TReporter reporter("false_sharing");
+    RunOverhead(reporter);
+
+    // every line is tracked: a few counters have a few lines
+    LineSampleEvery = 1;
+    RunCounters<TPackedCounter>(reporter, "packed counters", threadsNum);
+    RunCounters<TPaddedCounter>(reporter, "padded counters", threadsNum);
+    return 0;
+}
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// False sharing detector without perf c2c or special hardware: the accesses to the data go through
+// OnRead / OnWrite (or OnAccess for a range), which record in shadow memory, per 64 byte line,
+// the threads that read and write it, the bytes each of them touched and how many times.
+//
+// The shadow is a fixed open addressing table keyed by the line address: 1 of LineSampleEvery lines
+// (by a hash of the address) is tracked, every access to a tracked line is recorded, so a sampled line
+// has all of its threads. An access to an untracked line costs a multiply and a mask.
+// A line keeps the bytes of up to MaxAccessors threads, the writer and reader sets are bit per thread id % 64.
+// A line that doesn't fit into MaxProbes slots is counted as an overflow and not tracked.
+//
+// Collect reports the lines written by more than one thread, the most written first: a line is false sharing
+// if no thread touches the bytes written by another one, true sharing otherwise. The threads' own counters in
+// a line are written by the owner only (as the sites of NLockProfiler), but the line sets and the shadow entry
+// itself are shared: the instrumented code is slower, this is a debugging mode, not a production profiler.
+//
+// Watch names a region (a pool of elements): the report of its lines gives element indexes and offsets
+// instead of raw addresses. Reset drops everything recorded, with no thread accessing the data.
+
+namespace NFalseSharing {
+
+constexpr size_t LineSize = 64;
+constexpr uint32_t MaxAccessors = 4;
+constexpr size_t ShadowLines = 1 << 16;
+constexpr uint32_t MaxProbes = 16;
+
+// a power of two, 1 tracks every line
+inline std::atomic<uint32_t> LineSampleEvery = 64;
+
+// the owner thread is the only writer
+inline void Increase(std::atomic<uint64_t>& x, uint64_t delta) {
+    x.store(x.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+// sets the bits with no write when they are set already: the common case after the first accesses
+inline void SetBits(std::atomic<uint64_t>& x, uint64_t bits) {
+    if ((x.load(std::memory_order_relaxed) & bits) != bits) {
+        x.fetch_or(bits, std::memory_order_relaxed);
+    }
+}
+
+struct TAccessor {
+    // thread id + 1, 0 while free
+    std::atomic<uint32_t> Thread = 0;
+    std::atomic<uint64_t> WrittenBytes = 0;
+    std::atomic<uint64_t> ReadBytes = 0;
+    std::atomic<uint64_t> Writes = 0;
+    std::atomic<uint64_t> Reads = 0;
+};
+
+struct TShadowLine {
+    // address / LineSize, 0 while free
+    std::atomic<uintptr_t> Line = 0;
+    std::atomic<uint64_t> Writers = 0;
+    std::atomic<uint64_t> Readers = 0;
+    TAccessor Accessors[MaxAccessors];
+};
+
+struct TRegion {
+    std::string Name;
+    uintptr_t Begin = 0;
+    uintptr_t End = 0;
+    size_t ElemSize = 1;
+};
+
+class TShadow {
+public:
+    static TShadow& Get() {
+        static TShadow shadow;
+        return shadow;
+    }
+
+    // nullptr if the probes are over
+    TShadowLine* Find(uintptr_t line) {
+        size_t index = size_t(line * 0x9e3779b97f4a7c15ULL >> 40) % ShadowLines;
+        for(uint32_t probes = 0; probes < MaxProbes; ++probes, index = (index + 1) % ShadowLines) {
+            TShadowLine& entry = Lines[index];
+            uintptr_t current = entry.Line.load(std::memory_order_acquire);
+            if (current == 0 && entry.Line.compare_exchange_strong(current, line, std::memory_order_acq_rel)) {
+                return &entry;
+            }
+            if (current == line) {
+                return &entry;
+            }
+        }
+        Overflows.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    template<class TFunc>
+    void ForEach(TFunc&& func) const {
+        for(size_t i = 0; i < ShadowLines; ++i) {
+            if (Lines[i].Line.load(std::memory_order_acquire)) {
+                func(Lines[i]);
+            }
+        }
+    }
+
+    void Reset() {
+        for(size_t i = 0; i < ShadowLines; ++i) {
+            TShadowLine& entry = Lines[i];
+            entry.Line.store(0, std::memory_order_relaxed);
+            entry.Writers.store(0, std::memory_order_relaxed);
+            entry.Readers.store(0, std::memory_order_relaxed);
+            for(TAccessor& accessor : entry.Accessors) {
+                accessor.Thread.store(0, std::memory_order_relaxed);
+                accessor.WrittenBytes.store(0, std::memory_order_relaxed);
+                accessor.ReadBytes.store(0, std::memory_order_relaxed);
+                accessor.Writes.store(0, std::memory_order_relaxed);
+                accessor.Reads.store(0, std::memory_order_relaxed);
+            }
+        }
+        Overflows.store(0, std::memory_order_relaxed);
+        std::lock_guard g(RegionsLock);
+        Regions.clear();
+    }
+
+    void Watch(TRegion region) {
+        std::lock_guard g(RegionsLock);
+        Regions.push_back(std::move(region));
+    }
+
+    std::vector<TRegion> GetRegions() const {
+        std::lock_guard g(RegionsLock);
+        return Regions;
+    }
+
+    uint64_t GetOverflows() const {
+        return Overflows.load(std::memory_order_relaxed);
+    }
+
+private:
+    TShadow()
+        : Lines(std::make_unique<TShadowLine[]>(ShadowLines))
+    {}
+
+    std::unique_ptr<TShadowLine[]> Lines;
+    std::atomic<uint64_t> Overflows = 0;
+    mutable std::mutex RegionsLock;
+    std::vector<TRegion> Regions;
+};
+
+inline std::atomic<uint32_t> NextThreadId = 0;
+// trivial thread_local, id + 1: no init guard on every access
+inline thread_local uint32_t CurrentThread = 0;
+
+inline uint32_t CurrentThreadId() {
+    if (!CurrentThread) [[unlikely]] {
+        CurrentThread = NextThreadId.fetch_add(1, std::memory_order_relaxed) + 1;
+    }
+    return CurrentThread - 1;
+}
+
+inline bool IsSampled(uintptr_t line) {
+    return ((line * 0x9e3779b97f4a7c15ULL >> 32) & (LineSampleEvery.load(std::memory_order_relaxed) - 1)) == 0;
+}
+
+// bytes [begin, end) of a line as a bit per byte
+inline uint64_t BytesMask(size_t begin, size_t end) {
+    return (end - begin == 64 ? ~0ULL : ((1ULL << (end - begin)) - 1)) << begin;
+}
+
+inline void Record(uintptr_t line, uint64_t bytes, bool write) {
+    TShadowLine* entry = TShadow::Get().Find(line);
+    if (!entry) {
+        return;
+    }
+    const uint32_t thread = CurrentThreadId();
+    SetBits(write ? entry->Writers : entry->Readers, 1ULL << (thread % 64));
+    for(TAccessor& accessor : entry->Accessors) {
+        uint32_t owner = accessor.Thread.load(std::memory_order_relaxed);
+        if (owner == 0 && accessor.Thread.compare_exchange_strong(owner, thread + 1, std::memory_order_relaxed)) {
+            owner = thread + 1;
+        }
+        if (owner == thread + 1) {
+            SetBits(write ? accessor.WrittenBytes : accessor.ReadBytes, bytes);
+            Increase(write ? accessor.Writes : accessor.Reads, 1);
+            return;
+        }
+    }
+}
+
+inline void OnAccess(const void* ptr, size_t size, bool write) {
+    const uintptr_t begin = uintptr_t(ptr);
+    const uintptr_t end = begin + size;
+    for(uintptr_t line = begin / LineSize; line * LineSize < end; ++line) {
+        if (IsSampled(line)) [[unlikely]] {
+            const uintptr_t lineBegin = line * LineSize;
+            Record(line, BytesMask(std::max(begin, lineBegin) - lineBegin, std::min(end, lineBegin + LineSize) - lineBegin), write);
+        }
+    }
+}
+
+template<class T>
+void OnRead(const T& obj) {
+    OnAccess(&obj, sizeof(T), false);
+}
+
+template<class T>
+void OnWrite(const T& obj) {
+    OnAccess(&obj, sizeof(T), true);
+}
+
+inline void Watch(std::string name, const void* begin, size_t bytes, size_t elemSize = 1) {
+    TShadow::Get().Watch({std::move(name), uintptr_t(begin), uintptr_t(begin) + bytes, elemSize});
+}
+
+inline void Reset() {
+    TShadow::Get().Reset();
+}
+
+struct TAccessorReport {
+    uint32_t Thread = 0;
+    uint64_t WrittenBytes = 0;
+    uint64_t ReadBytes = 0;
+    uint64_t Writes = 0;
+    uint64_t Reads = 0;
+};
+
+struct TLineReport {
+    uintptr_t Address = 0;
+    uint32_t WritersNum = 0;
+    uint32_t ReadersNum = 0;
+    uint64_t Writes = 0;
+    uint64_t Reads = 0;
+    // the threads that fit into the line's accessors
+    std::vector<TAccessorReport> Accessors;
+    // some bytes written by one thread are read or written by another
+    bool TrueSharing = false;
+};
+
+// lines written by more than one thread, the most written first
+inline std::vector<TLineReport> Collect() {
+    std::vector<TLineReport> res;
+    TShadow::Get().ForEach([&](const TShadowLine& entry) {
+        const uint64_t writers = entry.Writers.load(std::memory_order_relaxed);
+        if (std::popcount(writers) < 2) {
+            return;
+        }
+        TLineReport& report = res.emplace_back();
+        report.Address = entry.Line.load(std::memory_order_relaxed) * LineSize;
+        report.WritersNum = std::popcount(writers);
+        report.ReadersNum = std::popcount(entry.Readers.load(std::memory_order_relaxed));
+        for(const TAccessor& accessor : entry.Accessors) {
+            const uint32_t owner = accessor.Thread.load(std::memory_order_relaxed);
+            if (!owner) {
+                break;
+            }
+            TAccessorReport& a = report.Accessors.emplace_back();
+            a.Thread = owner - 1;
+            a.WrittenBytes = accessor.WrittenBytes.load(std::memory_order_relaxed);
+            a.ReadBytes = accessor.ReadBytes.load(std::memory_order_relaxed);
+            a.Writes = accessor.Writes.load(std::memory_order_relaxed);
+            a.Reads = accessor.Reads.load(std::memory_order_relaxed);
+            report.Writes += a.Writes;
+            report.Reads += a.Reads;
+        }
+        for(const TAccessorReport& a : report.Accessors) {
+            for(const TAccessorReport& b : report.Accessors) {
+                report.TrueSharing |= a.Thread != b.Thread && (a.WrittenBytes & (b.WrittenBytes | b.ReadBytes)) != 0;
+            }
+        }
+    });
+    std::sort(res.begin(), res.end(), [](const TLineReport& a, const TLineReport& b) {
+        return a.Writes > b.Writes || (a.Writes == b.Writes && a.Address < b.Address);
+    });
+    return res;
+}
+
+// runs of bytes of a line: "+0..2, +4..6" from the line start, or "elem 12 +0..2" inside a watched region;
+// up to maxRuns of them
+inline std::string FormatBytes(uintptr_t lineAddress, uint64_t bytes, const TRegion* region, uint32_t maxRuns = 4) {
+    std::string res;
+    uint32_t runs = 0;
+    for(uint32_t begin = 0; begin < 64;) {
+        if (!(bytes >> begin & 1)) {
+            ++begin;
+            continue;
+        }
+        uint32_t end = begin;
+        while(end < 64 && (bytes >> end & 1)) {
+            ++end;
+        }
+        if (++runs > maxRuns) {
+            res += ", ...";
+            break;
+        }
+        res += res.empty() ? "" : ", ";
+        if (region && lineAddress + begin >= region->Begin && lineAddress + begin < region->End) {
+            const uintptr_t offset = lineAddress + begin - region->Begin;
+            res += "elem " + std::to_string(offset / region->ElemSize) + " +" + std::to_string(offset % region->ElemSize)
+                + ".." + std::to_string(offset % region->ElemSize + end - begin);
+        } else {
+            res += "+" + std::to_string(begin) + ".." + std::to_string(end);
+        }
+        begin = end;
+    }
+    return res.empty() ? "-" : res;
+}
+
+inline void Dump(std::ostream& out, size_t top = 10) {
+    const std::vector<TLineReport> lines = Collect();
+    const std::vector<TRegion> regions = TShadow::Get().GetRegions();
+    out << "lines written by more than one thread: " << lines.size() << " of the sampled (1 of "
+        << LineSampleEvery.load() << "), " << TShadow::Get().GetOverflows() << " overflows, the most written first:" << std::endl;
+    for(size_t i = 0; i < std::min(top, lines.size()); ++i) {
+        const TLineReport& line = lines[i];
+        const TRegion* region = nullptr;
+        for(const TRegion& r : regions) {
+            if (r.Begin < line.Address + LineSize && line.Address < r.End) {
+                region = &r;
+            }
+        }
+        out << " -- " << (line.TrueSharing ? "true" : "false") << " sharing, line 0x" << std::hex << line.Address << std::dec;
+        if (region) {
+            out << " = " << region->Name << (line.Address >= region->Begin ? " +" + std::to_string(line.Address - region->Begin) : " start");
+        }
+        out << ", " << line.WritersNum << " writers, " << line.ReadersNum << " readers, "
+            << line.Writes << " writes, " << line.Reads << " reads" << std::endl;
+        for(const TAccessorReport& a : line.Accessors) {
+            out << "    thread " << a.Thread << ": " << a.Writes << " writes of " << FormatBytes(line.Address, a.WrittenBytes, region)
+                << "; " << a.Reads << " reads of " << FormatBytes(line.Address, a.ReadBytes, region) << std::endl;
+        }
+    }
+}
+
+}
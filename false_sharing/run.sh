@@ -0,0 +1,4 @@
+set -x -e
+clang++ -std=c++20 false_sharing.cpp -o false_sharing.exe -Wall -O2 -DNDEBUG
+# args: [threads]
+BENCH_JSON=report.json ./false_sharing.exe | tee report.txt
@@ -0,0 +1,249 @@
+#include "hashes.hpp"
+#include "../bench/bench.hpp"
+#include "../hdr_histogram/hdr_histogram.hpp"
+#include "../snapshot_pool/snapshot_pool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// The hashes of hashes.hpp under power-of-two tables: how fast they hash, how keys of different shapes
+// spread over the buckets, and what it all costs a lookup, vs std::unordered_map with its prime bucket counts.
+
+constexpr size_t KeysNum = 1 << 20;
+// linear probing at load 0.5
+constexpr size_t SlotsNum = KeysNum * 2;
+
+// libstdc++: identity for ints, murmur for strings
+struct TStdHash {
+    static constexpr std::string_view Name = "std::hash";
+
+    size_t operator()(uint64_t x) const {
+        return std::hash<uint64_t>()(x);
+    }
+    size_t operator()(std::string_view s) const {
+        return std::hash<std::string_view>()(s);
+    }
+};
+
+// what real ids look like
+std::vector<uint64_t> MakeKeys(std::string_view kind, size_t n) {
+    std::vector<uint64_t> res(n);
+    for(size_t i = 0; i < n; ++i) {
+        if (kind == "random") {
+            // splitmix64 is a bijection: no duplicates
+            res[i] = NSnapshotPool::CounterRandom(17, i);
+        } else if (kind == "sequential") {
+            res[i] = i;
+        } else if (kind == "stride 64") {
+            // cache line aligned pointers
+            res[i] = 0x7f0000000000ULL + i * 64;
+        } else {
+            // a shard or a type in the top bits
+            res[i] = uint64_t(i) << 32;
+        }
+    }
+    return res;
+}
+
+std::vector<std::string> MakeStringKeys(size_t n) {
+    std::vector<std::string> res(n);
+    for(size_t i = 0; i < n; ++i) {
+        res[i] = "user_" + std::to_string(i);
+    }
+    return res;
+}
+
+// linear probing set, the home slot is hash & (size - 1). Inserts find the next free slot through
+// a union-find over the occupied runs, so even a degenerate hash (every key in one run) builds in O(n)
+template<class TKey, class THash>
+class TLinearSet {
+public:
+    explicit TLinearSet(size_t slotsNum)
+        : Mask(slotsNum - 1)
+        , Keys(slotsNum)
+        , Used(slotsNum)
+        , NextFree(slotsNum)
+    {
+        std::iota(NextFree.begin(), NextFree.end(), 0);
+    }
+
+    // the probe length of the key: 1 for the home slot
+    size_t Insert(const TKey& key) {
+        const size_t home = Hash(key) & Mask;
+        const size_t slot = FindFree(home);
+        Keys[slot] = key;
+        Used[slot] = 1;
+        NextFree[slot] = (slot + 1) & Mask;
+        return ((slot - home) & Mask) + 1;
+    }
+
+    bool Contains(const TKey& key) const {
+        for(size_t slot = Hash(key) & Mask; Used[slot]; slot = (slot + 1) & Mask) {
+            if (Keys[slot] == key) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+private:
+    size_t FindFree(size_t slot) {
+        size_t root = slot;
+        while(NextFree[root] != root) {
+            root = NextFree[root];
+        }
+        while(NextFree[slot] != root) {
+            slot = std::exchange(NextFree[slot], root);
+        }
+        return root;
+    }
+
+    const size_t Mask;
+    THash Hash;
+    std::vector<TKey> Keys;
+    std::vector<uint8_t> Used;
+    std::vector<size_t> NextFree;
+};
+
+// a lookup per iteration over the shuffled keys, the cursor goes on between samples:
+// with a degenerate hash the keys inserted last are the expensive ones
+template<class TKey, class TContains>
+NBench::TStats RunLookups(std::string name, const std::vector<TKey>& keys, TContains&& contains) {
+    std::vector<const TKey*> queries;
+    for(const TKey& key : keys) {
+        queries.push_back(&key);
+    }
+    std::shuffle(queries.begin(), queries.end(), std::mt19937_64(2026));
+    NBench::TOptions options;
+    options.Samples = 10;
+    size_t cursor = 0;
+    size_t found = 0;
+    NBench::TStats stats = NBench::Run(std::move(name), [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            found += contains(*queries[cursor]);
+            cursor = cursor + 1 == queries.size() ? 0 : cursor + 1;
+        }
+    }, options);
+    NBench::DoNotOptimize(found);
+    return stats;
+}
+
+// bucket occupancy of a chained table with as many buckets as keys (ideal: 36.8% empty, max 8..10 for 1M keys),
+// probe lengths of the linear probing one at load 0.5 (ideal mean 1.5), lookups in both
+template<class THash, class TKey>
+void RunDistribution(NBench::TReporter& reporter, const std::string& keysName, const std::vector<TKey>& keys) {
+    const THash hash;
+    std::vector<uint32_t> buckets(keys.size());
+    for(const TKey& key : keys) {
+        buckets[hash(key) & (buckets.size() - 1)] += 1;
+    }
+    const size_t empty = std::count(buckets.begin(), buckets.end(), 0);
+    const uint32_t maxBucket = *std::max_element(buckets.begin(), buckets.end());
+
+    TLinearSet<TKey, THash> set(SlotsNum);
+    NHdrHistogram::THistogram probes;
+    for(const TKey& key : keys) {
+        probes.Record(set.Insert(key));
+    }
+
+    const std::string name = std::string(THash::Name) + ", " + keysName + " keys";
+    NBench::TStats stats = RunLookups(name + ", power-of-two linear probing lookup", keys, [&](const TKey& key) {
+        return set.Contains(key);
+    });
+    stats.AddCounter("empty_buckets_pct", 100.0 * empty / buckets.size())
+        .AddCounter("max_bucket", maxBucket)
+        .AddCounter("probe_mean", probes.Mean())
+        .AddCounter("probe_p99", probes.Quantile(0.99))
+        .AddCounter("probe_max", probes.GetMax());
+    reporter.Add(std::move(stats));
+
+    std::unordered_map<TKey, uint64_t, THash> map;
+    for(const TKey& key : keys) {
+        map.emplace(key, 0);
+    }
+    reporter.Add(RunLookups(name + ", std::unordered_map lookup", keys, [&](const TKey& key) {
+        return map.find(key) != map.end();
+    }).AddCounter("bucket_count", map.bucket_count()));
+}
+
+// ns per key of 8 bytes
+template<class THash>
+void RunIntHashing(NBench::TReporter& reporter) {
+    const std::vector<uint64_t> keys = MakeKeys("random", 4096);
+    const THash hash;
+    NBench::TOptions options;
+    options.ItemsPerIteration = keys.size();
+    size_t sum = 0;
+    NBench::TStats stats = NBench::Run(std::string(THash::Name) + ", hash uint64", [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            for(uint64_t key : keys) {
+                sum += hash(key);
+            }
+        }
+    }, options);
+    NBench::DoNotOptimize(sum);
+    stats.AddCounter("gb_per_s", 8 / stats.MedianNs);
+    reporter.Add(std::move(stats));
+}
+
+// ns per string of the length, strings at different offsets of a random buffer
+template<class THash>
+void RunStringHashing(NBench::TReporter& reporter, size_t length) {
+    constexpr size_t StringsNum = 64;
+    std::string buffer(StringsNum * (length + 7), 0);
+    for(size_t i = 0; i < buffer.size(); ++i) {
+        buffer[i] = char(NSnapshotPool::CounterRandom(3, i));
+    }
+    const THash hash;
+    NBench::TOptions options;
+    options.ItemsPerIteration = StringsNum;
+    size_t sum = 0;
+    NBench::TStats stats = NBench::Run(std::string(THash::Name) + ", hash " + std::to_string(length) + " bytes", [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            for(size_t s = 0; s < StringsNum; ++s) {
+                sum += hash(std::string_view(buffer.data() + s * (length + 7), length));
+            }
+        }
+    }, options);
+    NBench::DoNotOptimize(sum);
+    stats.AddCounter("gb_per_s", length / stats.MedianNs);
+    reporter.Add(std::move(stats));
+}
+
+template<class THash>
+void RunIntHash(NBench::TReporter& reporter) {
+    RunIntHashing<THash>(reporter);
+    for(std::string_view kind : {"random", "sequential", "stride 64", "high bits"}) {
+        RunDistribution<THash>(reporter, std::string(kind), MakeKeys(kind, KeysNum));
+    }
+}
+
+template<class THash>
+void RunStringHash(NBench::TReporter& reporter, const std::vector<std::string>& keys) {
+    for(size_t length : {8, 16, 32, 64, 256, 4096}) {
+        RunStringHashing<THash>(reporter, length);
+    }
+    RunDistribution<THash>(reporter, "\"user_<i>\"", keys);
+}
+
+int main() {
+    NBench::TReporter reporter("hash_bench");
+    RunIntHash<NHashes::TIdentityHash>(reporter);
+    RunIntHash<NHashes::TFibonacciHash>(reporter);
+    RunIntHash<NHashes::TCrc32cHash>(reporter);
+    RunIntHash<NHashes::TWyHash>(reporter);
+
+    const std::vector<std::string> keys = MakeStringKeys(KeysNum);
+    RunStringHash<TStdHash>(reporter, keys);
+    RunStringHash<NHashes::TCrc32cHash>(reporter, keys);
+    RunStringHash<NHashes::TWyHash>(reporter, keys);
+    return 0;
+}
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Hash functions for the map experiments, as hasher types: Name + operator() for uint64_t (ints convert)
+// and, where it makes sense, std::string_view.
+// - TIdentityHash: what libstdc++ std::hash<int> is. Fine with prime bucket counts, a disaster with
+//   power-of-two ones when keys differ in high bits only (aligned pointers, ids with a shard in the top)
+// - TFibonacciHash: one multiply by 2^64 / phi; the high bits of the product depend on all bits of the key,
+//   so they are rotated down to where a power-of-two table takes its index
+// - TCrc32cHash: crc32 instruction (sse4.2) if the cpu has it, a table otherwise; 32 bits of result
+// - TWyHash: wyhash-style 64x64->128 multiply-fold mixing, for ints and strings
+// A table indexes by hash & (size - 1) everywhere here: the low bits are the ones that matter.
+
+namespace NHashes {
+
+inline uint64_t Read8(const char* p) {
+    uint64_t res;
+    std::memcpy(&res, p, 8);
+    return res;
+}
+
+inline uint64_t Read4(const char* p) {
+    uint32_t res;
+    std::memcpy(&res, p, 4);
+    return res;
+}
+
+struct TIdentityHash {
+    static constexpr std::string_view Name = "identity";
+
+    size_t operator()(uint64_t x) const {
+        return x;
+    }
+};
+
+struct TFibonacciHash {
+    static constexpr std::string_view Name = "fibonacci";
+
+    size_t operator()(uint64_t x) const {
+        return std::rotl(x * 0x9e3779b97f4a7c15ULL, 32);
+    }
+};
+
+namespace NPrivate {
+
+// reflected Castagnoli polynomial, the one of the sse4.2 instruction
+constexpr std::array<uint32_t, 256> MakeCrc32cTable() {
+    std::array<uint32_t, 256> res = {};
+    for(uint32_t i = 0; i < 256; ++i) {
+        uint32_t crc = i;
+        for(int bit = 0; bit < 8; ++bit) {
+            crc = crc & 1 ? (crc >> 1) ^ 0x82f63b78u : crc >> 1;
+        }
+        res[i] = crc;
+    }
+    return res;
+}
+
+inline constexpr std::array<uint32_t, 256> Crc32cTable = MakeCrc32cTable();
+
+inline uint32_t Crc32cSoft(uint32_t crc, const char* data, size_t size) {
+    for(size_t i = 0; i < size; ++i) {
+        crc = Crc32cTable[(crc ^ uint8_t(data[i])) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+inline uint32_t Crc32cHard(uint32_t crc, const char* data, size_t size) {
+    uint64_t crc64 = crc;
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8) {
+        crc64 = _mm_crc32_u64(crc64, Read8(data + i));
+    }
+    crc = crc64;
+    for(; i < size; ++i) {
+        crc = _mm_crc32_u8(crc, data[i]);
+    }
+    return crc;
+}
+
+__attribute__((target("sse4.2")))
+inline uint32_t Crc32cHard64(uint32_t crc, uint64_t x) {
+    return _mm_crc32_u64(crc, x);
+}
+
+inline const bool HasSse42 = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+#endif
+
+inline uint64_t WyMix(uint64_t a, uint64_t b) {
+    const __uint128_t r = __uint128_t(a) * b;
+    return uint64_t(r) ^ uint64_t(r >> 64);
+}
+
+constexpr uint64_t WyP0 = 0xa0761d6478bd642fULL;
+constexpr uint64_t WyP1 = 0xe7037ed1a0b428dbULL;
+constexpr uint64_t WyP2 = 0x8ebc6af09c88c6e3ULL;
+constexpr uint64_t WyP3 = 0x589965cc75374cc3ULL;
+
+}
+
+struct TCrc32cHash {
+    static constexpr std::string_view Name = "crc32c";
+
+    size_t operator()(uint64_t x) const {
+#if defined(__x86_64__)
+        if (NPrivate::HasSse42) {
+            return NPrivate::Crc32cHard64(~0u, x);
+        }
+#endif
+        char bytes[8];
+        std::memcpy(bytes, &x, 8);
+        return NPrivate::Crc32cSoft(~0u, bytes, 8);
+    }
+
+    size_t operator()(std::string_view s) const {
+#if defined(__x86_64__)
+        if (NPrivate::HasSse42) {
+            return NPrivate::Crc32cHard(~0u, s.data(), s.size());
+        }
+#endif
+        return NPrivate::Crc32cSoft(~0u, s.data(), s.size());
+    }
+};
+
+struct TWyHash {
+    static constexpr std::string_view Name = "wyhash";
+
+    size_t operator()(uint64_t x) const {
+        using namespace NPrivate;
+        return WyMix(WyMix(x ^ WyP0, WyP1) ^ 8, WyP1);
+    }
+
+    // short strings are 2..4 overlapping loads, long ones go by 48 bytes in 3 independent lanes
+    size_t operator()(std::string_view s) const {
+        using namespace NPrivate;
+        const char* p = s.data();
+        const size_t len = s.size();
+        uint64_t seed = WyMix(WyP0, WyP1);
+        uint64_t a = 0;
+        uint64_t b = 0;
+        if (len <= 16) {
+            if (len >= 4) {
+                const size_t shift = (len >> 3) << 2;
+                a = (Read4(p) << 32) | Read4(p + shift);
+                b = (Read4(p + len - 4) << 32) | Read4(p + len - 4 - shift);
+            } else if (len > 0) {
+                a = (uint64_t(uint8_t(p[0])) << 16) | (uint64_t(uint8_t(p[len >> 1])) << 8) | uint8_t(p[len - 1]);
+            }
+        } else {
+            size_t i = len;
+            if (i > 48) {
+                uint64_t see1 = seed;
+                uint64_t see2 = seed;
+                do {
+                    seed = WyMix(Read8(p) ^ WyP1, Read8(p + 8) ^ seed);
+                    see1 = WyMix(Read8(p + 16) ^ WyP2, Read8(p + 24) ^ see1);
+                    see2 = WyMix(Read8(p + 32) ^ WyP3, Read8(p + 40) ^ see2);
+                    p += 48;
+                    i -= 48;
+                } while(i > 48);
+                seed ^= see1 ^ see2;
+            }
+            while(i > 16) {
+                seed = WyMix(Read8(p) ^ WyP1, Read8(p + 8) ^ seed);
+                p += 16;
+                i -= 16;
+            }
+            a = Read8(p + i - 16);
+            b = Read8(p + i - 8);
+        }
+        return WyMix(WyMix(a ^ WyP1, b ^ seed) ^ len, WyP1);
+    }
+};
+
+}
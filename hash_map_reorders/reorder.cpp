@@ -1,6 +1,11 @@
+#include "hashes.hpp"
+#include "../bench/bench.hpp"
+
 #include <cstdlib>
 #include <unordered_map>
 #include <iostream>
+#include <string>
+#include <string_view>
 
 constexpr size_t ElemsToStore = 100'000;
 constexpr size_t Seed = 27;
@@ -32,7 +37,6 @@ template<class T>
 T RefillReserved(const T& x) {
     T res;
     res.reserve(x.size());
-    std::cout << "--- reserved to " << res.bucket_count() << std::endl;
     for(auto& p : x) {
         res[p.first] = p.second;
     }
@@ -43,9 +47,9 @@ template<class T>
 struct TGetMaxLoadFactor;
 
 
-template<class K, class V>
-struct TGetMaxLoadFactor<std::unordered_map<K, V>> {
-    static float Get(const std::unordered_map<K, V>& x) {
+template<class K, class V, class THash>
+struct TGetMaxLoadFactor<std::unordered_map<K, V, THash>> {
+    static float Get(const std::unordered_map<K, V, THash>& x) {
         std::cerr << "x.max_load_factor()=" <<  x.max_load_factor() << std::endl;
         return x.max_load_factor();
     }
@@ -68,7 +72,6 @@ T RefillReserved2(const T& x) {
     T res;
     // res.reserve(x.bucket_count() * TGetMaxLoadFactor<std::remove_cvref_t<decltype(x)>>::Get(x));
     res.rehash(x.bucket_count());
-    std::cout << "--- reserved to " << res.bucket_count() << std::endl;
     for(auto& p : x) {
         res[p.first] = p.second;
     }
@@ -135,76 +138,64 @@ size_t CalcMissOrders(const auto& x) {
     return res;
 }
 
+// the refill is timed too (with the destruction of its result), per element of the source;
+// the order of the result is deterministic, miss orders and bucket counts go as counters
+template<class T, class TMake>
+void Variant(NBench::TReporter& reporter, const std::string& name, std::string_view variant, const T& data, TMake&& make) {
+    const T result = make();
+    const size_t missOrders = CalcMissOrders(result);
+    std::cout << name << " - " << variant << " MissOrders " << missOrders << std::endl;
+    std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << result.bucket_count() << std::endl;
+
+    NBench::TOptions options;
+    options.Samples = 10;
+    options.ItemsPerIteration = data.size();
+    NBench::TStats stats = NBench::Run(name + " " + std::string(variant), [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            T refilled = make();
+            NBench::DoNotOptimize(refilled);
+        }
+    }, options);
+    stats.AddCounter("miss_orders", missOrders).AddCounter("bucket_count", result.bucket_count());
+    reporter.Add(std::move(stats));
+}
+
 template<class T>
-void DoExp(std::string name) {
+void DoExp(NBench::TReporter& reporter, std::string name) {
     T data;
     InitialFill(data);
     std::cout << name << ":filled size " << data.size() << std::endl;
     std::cout << name << " - with MissOrders " << CalcMissOrders(data) << std::endl;
     ResetByOrders(data);
     std::cout << name << " - resorted MissOrders (expect 0) " << CalcMissOrders(data) << std::endl;
-    {
-        T simpleRefill = RefillSimple(data);
-        std::cout << name << " - simpleRefill MissOrders " << CalcMissOrders(simpleRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << simpleRefill.bucket_count() << std::endl;
-    }
-
-    {
-        T reservedRefill = RefillReserved(data);
-        std::cout << name << " - reservedRefill MissOrders " << CalcMissOrders(reservedRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << reservedRefill.bucket_count() << std::endl;
-    }
-
-    {
-        T reservedRefill = RefillReserved2(data);
-        std::cout << name << " - reservedRefill2 MissOrders " << CalcMissOrders(reservedRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << reservedRefill.bucket_count() << std::endl;
-    }
 
-    {
-        T reservedRefillRefill = RefillReserved2(RefillReserved2(data));
-        std::cout << name << " - reservedRefillRefill MissOrders " << CalcMissOrders(reservedRefillRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << reservedRefillRefill.bucket_count() << std::endl;
-    }
-
-    {
-        T rehashRefill = Rehash(data, 0 , false);
-        std::cout << name << " - rehash 0-0 MissOrders " << CalcMissOrders(rehashRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << rehashRefill.bucket_count() << std::endl;
-    }
-    {
-        T rehashRefill = Rehash(data, 0 , true);
-        std::cout << name << " - rehash 0-1 MissOrders " << CalcMissOrders(rehashRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << rehashRefill.bucket_count() << std::endl;
-    }
-    {
-        T rehashRefill = Rehash(data, 1 , false);
-        std::cout << name << " - rehash 1-0 MissOrders " << CalcMissOrders(rehashRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << rehashRefill.bucket_count() << std::endl;
-    }
-    {
-        T rehashRefill = Rehash(data, 1 , true);
-        std::cout << name << " - rehash 1-1 MissOrders " << CalcMissOrders(rehashRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << rehashRefill.bucket_count() << std::endl;
-    }
-    {
-        T rehashRefill = Rehash(data, 2 , false);
-        std::cout << name << " - rehash 2-0 MissOrders " << CalcMissOrders(rehashRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << rehashRefill.bucket_count() << std::endl;
-    }
-    {
-        T rehashRefill = Rehash(data, 2 , true);
-        std::cout << name << " - rehash 2-1 MissOrders " << CalcMissOrders(rehashRefill) << std::endl;
-        std::cout << name << " -- bucket count " << data.bucket_count() << " -> " << rehashRefill.bucket_count() << std::endl;
-    }
+    Variant(reporter, name, "simpleRefill", data, [&]() {return RefillSimple(data);});
+    Variant(reporter, name, "reservedRefill", data, [&]() {return RefillReserved(data);});
+    Variant(reporter, name, "reservedRefill2", data, [&]() {return RefillReserved2(data);});
+    Variant(reporter, name, "reservedRefillRefill", data, [&]() {return RefillReserved2(RefillReserved2(data));});
+    Variant(reporter, name, "rehash 0-0", data, [&]() {return Rehash(data, 0, false);});
+    Variant(reporter, name, "rehash 0-1", data, [&]() {return Rehash(data, 0, true);});
+    Variant(reporter, name, "rehash 1-0", data, [&]() {return Rehash(data, 1, false);});
+    Variant(reporter, name, "rehash 1-1", data, [&]() {return Rehash(data, 1, true);});
+    Variant(reporter, name, "rehash 2-0", data, [&]() {return Rehash(data, 2, false);});
+    Variant(reporter, name, "rehash 2-1", data, [&]() {return Rehash(data, 2, true);});
+}
 
+template<class THash>
+void DoExpHash(NBench::TReporter& reporter) {
+    DoExp<std::unordered_map<int, size_t, THash>>(reporter, "unordered_map<" + std::string(THash::Name) + ">");
 }
 
 int main() {
     std::cerr << "started" << std::endl;
-    DoExp<std::unordered_map<int, size_t>>("unordered_map");
+    NBench::TReporter reporter("hash_map_reorders");
+    DoExp<std::unordered_map<int, size_t>>(reporter, "unordered_map");
+    // the same with other hashes: prime bucket counts hide a weak hash, the reorders depend on it
+    DoExpHash<NHashes::TFibonacciHash>(reporter);
+    DoExpHash<NHashes::TCrc32cHash>(reporter);
+    DoExpHash<NHashes::TWyHash>(reporter);
     #ifdef ARCADIA
-    DoExp<THashMap<int, size_t>>("THashMap");
+    DoExp<THashMap<int, size_t>>(reporter, "THashMap");
     #endif
     return 0;
 }
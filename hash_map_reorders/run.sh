@@ -1,3 +1,5 @@
 set -x -e
 clang++ -std=c++23 reorder.cpp -o reorder.exe -Wall -O2 -DNDEBUG
-./reorder.exe | tee report.txt
+BENCH_JSON=report.json ./reorder.exe | tee report.txt
+clang++ -std=c++23 hash_bench.cpp -o hash_bench.exe -Wall -O2 -DNDEBUG
+BENCH_JSON=report_hash.json ./hash_bench.exe | tee report_hash.txt
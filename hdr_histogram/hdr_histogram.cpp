@@ -0,0 +1,142 @@
+#include "hdr_histogram.hpp"
+#include "../bench/bench.hpp"
+#include "../queue_sim/queue_sim.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace NHdrHistogram;
+
+// latencies of a service: lognormal around 1 ms with a heavy tail, in ns
+std::vector<uint64_t> GenerateLatencies(size_t n) {
+    NQueueSim::TRng rng(2026);
+    const NQueueSim::TLogNormalService service{1e6, 1};
+    std::vector<uint64_t> res(n);
+    for(auto& x : res) {
+        x = service.Next(rng);
+    }
+    return res;
+}
+
+void ReportAccuracy(std::vector<uint64_t> values) {
+    THistogram histogram;
+    for(uint64_t x : values) {
+        histogram.Record(x);
+    }
+    std::cout << values.size() << " lognormal latencies, median 1 ms: histogram vs exact quantile" << std::endl;
+    for(double q : {0.5, 0.9, 0.99, 0.999, 0.9999}) {
+        auto it = values.begin() + std::max<size_t>(1, std::ceil(q * values.size())) - 1;
+        std::nth_element(values.begin(), it, values.end());
+        const double estimate = histogram.Quantile(q);
+        std::cout << " -- q" << std::defaultfloat << q << ": " << std::fixed << std::setprecision(0) << estimate << " vs " << *it
+            << " ns, error " << std::setprecision(4) << (estimate - *it) / *it * 100 << "%" << std::endl;
+    }
+}
+
+// the same buckets with a fetch_add from every thread: what a histogram shared by threads costs
+class TSharedHistogram {
+public:
+    void Record(uint64_t value) {
+        Counts[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+private:
+    std::atomic<uint64_t> Counts[BucketsNum] = {};
+};
+
+template<class TRecord>
+NBench::TSample RecordFromThreads(size_t threadsNum, uint64_t iters, TRecord&& record) {
+    std::atomic<bool> start = false;
+    std::vector<std::thread> threads;
+    std::vector<double> elapsed(threadsNum);
+    for(size_t t = 0; t < threadsNum; ++t) {
+        threads.emplace_back([&, t]() {
+            while(!start.load()) {}
+            auto started = std::chrono::high_resolution_clock::now();
+            record(t, iters);
+            auto finished = std::chrono::high_resolution_clock::now();
+            elapsed[t] = std::chrono::duration<double, std::nano>(finished - started).count();
+        });
+    }
+    start = true;
+    for(auto& t : threads) {
+        t.join();
+    }
+    // the cost per record of the slowest thread
+    return NBench::TSample{*std::max_element(elapsed.begin(), elapsed.end()), double(iters)};
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t valuesNum = argc > 1 ? atoll(argv[1]) : 10'000'000;
+    const size_t maxThreads = argc > 2 ? atoll(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    const std::vector<uint64_t> values = GenerateLatencies(valuesNum);
+    ReportAccuracy(values);
+
+    // values are walked by a mask, they must be a power of 2
+    const size_t mask = std::bit_floor(values.size()) - 1;
+    NBench::TReporter reporter("hdr_histogram");
+    std::cout << "\nrecord cost" << std::endl;
+    {
+        auto histogram = std::make_unique<THistogram>();
+        reporter.Add(NBench::Run("THistogram::Record", [&](uint64_t iters) {
+            for(uint64_t i = 0; i < iters; ++i) {
+                histogram->Record(values[i & mask]);
+            }
+        }));
+        std::vector<uint64_t> stats;
+        reporter.Add(NBench::Run("vector push_back + sort", [&](uint64_t iters) {
+            stats.clear();
+            for(uint64_t i = 0; i < iters; ++i) {
+                stats.push_back(values[i & mask]);
+            }
+            std::sort(stats.begin(), stats.end());
+            NBench::DoNotOptimize(stats[stats.size() * 99 / 100]);
+        }));
+    }
+
+    NBench::TOptions options;
+    options.Iterations = 1'000'000;
+    options.WarmupTime = {};
+    options.Samples = 10;
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        const std::string suffix = ", " + std::to_string(threadsNum) + " threads";
+        TConcurrentHistogram concurrent;
+        std::vector<TConcurrentHistogram::TRecorder> recorders;
+        for(size_t t = 0; t < threadsNum; ++t) {
+            recorders.push_back(concurrent.GetRecorder());
+        }
+        reporter.Add(NBench::RunManual("TConcurrentHistogram recorders" + suffix, [&](uint64_t iters) {
+            return RecordFromThreads(threadsNum, iters, [&](size_t t, uint64_t n) {
+                for(uint64_t i = 0; i < n; ++i) {
+                    recorders[t].Record(values[(i + t * 4096) & mask]);
+                }
+            });
+        }, options));
+
+        auto shared = std::make_unique<TSharedHistogram>();
+        reporter.Add(NBench::RunManual("shared fetch_add histogram" + suffix, [&](uint64_t iters) {
+            return RecordFromThreads(threadsNum, iters, [&](size_t t, uint64_t n) {
+                for(uint64_t i = 0; i < n; ++i) {
+                    shared->Record(values[(i + t * 4096) & mask]);
+                }
+            });
+        }, options));
+
+        reporter.Add(NBench::Run("TConcurrentHistogram::Snapshot" + suffix, [&](uint64_t iters) {
+            for(uint64_t i = 0; i < iters; ++i) {
+                THistogram snapshot = concurrent.Snapshot();
+                NBench::DoNotOptimize(snapshot);
+            }
+        }));
+        std::cout << " -- recorded " << concurrent.Snapshot().Describe() << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <sstream>
+#include <string>
+
+// Log-linear (HDR style) histogram of uint64 values, nanoseconds usually: values below 2^PrecisionBits
+// are exact, above them every power of two is split into 2^(PrecisionBits - 1) buckets,
+// so a quantile is off by at most 1/256 of the value (reported at the bucket middle), from 1 ns to 584 years,
+// in 7424 counters.
+//
+// THistogram is the plain one: merging, quantiles. TConcurrentHistogram hands out a TRecorder per thread:
+// a shard with a single writer, so a record is a relaxed load + store of one counter, no RMW and no
+// shared cache lines; Snapshot merges shards while they are written.
+
+namespace NHdrHistogram {
+
+constexpr uint32_t PrecisionBits = 8;
+constexpr uint32_t HalfBucket = 1u << (PrecisionBits - 1);
+constexpr uint32_t BucketsNum = (64 - PrecisionBits + 1) * HalfBucket + HalfBucket;
+
+inline uint32_t BucketIndex(uint64_t value) {
+    if (value < (uint64_t(1) << PrecisionBits)) {
+        return value;
+    }
+    // value >> shift keeps the PrecisionBits top bits, the highest of them is 1
+    const uint32_t shift = std::bit_width(value) - PrecisionBits;
+    return shift * HalfBucket + (value >> shift);
+}
+
+inline uint64_t BucketLow(uint32_t index) {
+    if (index < (1u << PrecisionBits)) {
+        return index;
+    }
+    const uint32_t shift = index / HalfBucket - 1;
+    return uint64_t(index - shift * HalfBucket) << shift;
+}
+
+inline uint64_t BucketWidth(uint32_t index) {
+    return index < (1u << PrecisionBits) ? 1 : uint64_t(1) << (index / HalfBucket - 1);
+}
+
+class THistogram {
+public:
+    void Record(uint64_t value, uint64_t count = 1) {
+        Counts[BucketIndex(value)] += count;
+        TotalCount += count;
+        Sum += value * count;
+        Min = std::min(Min, value);
+        Max = std::max(Max, value);
+    }
+
+    void Merge(const THistogram& other) {
+        for(uint32_t i = 0; i < BucketsNum; ++i) {
+            Counts[i] += other.Counts[i];
+        }
+        TotalCount += other.TotalCount;
+        Sum += other.Sum;
+        Min = std::min(Min, other.Min);
+        Max = std::max(Max, other.Max);
+    }
+
+    // the middle of the bucket holding the value of rank ceil(q * count), clamped by the exact min and max
+    double Quantile(double q) const {
+        if (!TotalCount) {
+            return 0;
+        }
+        const uint64_t rank = std::max<uint64_t>(1, uint64_t(std::ceil(q * TotalCount)));
+        uint64_t seen = 0;
+        for(uint32_t i = 0; i < BucketsNum; ++i) {
+            seen += Counts[i];
+            if (seen >= rank) {
+                const double middle = BucketLow(i) + (BucketWidth(i) - 1) / 2.0;
+                return std::clamp(middle, double(Min), double(Max));
+            }
+        }
+        return Max;
+    }
+
+    uint64_t Count() const {return TotalCount;}
+    double Mean() const {return TotalCount ? double(Sum) / TotalCount : 0;}
+    uint64_t GetMin() const {return TotalCount ? Min : 0;}
+    uint64_t GetMax() const {return Max;}
+
+    // "p50 12 p90 15 p99 40 p99.9 120 max 3000"
+    std::string Describe() const {
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(0) << "p50 " << Quantile(0.5) << " p90 " << Quantile(0.9) << " p99 " << Quantile(0.99)
+            << " p99.9 " << Quantile(0.999) << " max " << Max;
+        return out.str();
+    }
+
+private:
+    friend class TConcurrentHistogram;
+
+    uint64_t Counts[BucketsNum] = {};
+    uint64_t TotalCount = 0;
+    uint64_t Sum = 0;
+    uint64_t Min = std::numeric_limits<uint64_t>::max();
+    uint64_t Max = 0;
+};
+
+class TConcurrentHistogram {
+    struct alignas(64) TShard {
+        // written by the owner thread only, read by Snapshot
+        std::atomic<uint64_t> Counts[BucketsNum] = {};
+        std::atomic<uint64_t> Sum = 0;
+        std::atomic<uint64_t> Min = std::numeric_limits<uint64_t>::max();
+        std::atomic<uint64_t> Max = 0;
+    };
+
+    static void Increase(std::atomic<uint64_t>& x, uint64_t delta) {
+        x.store(x.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+    }
+
+public:
+    // a thread's handle, keep it for the thread life: one per thread, it must not outlive the histogram
+    class TRecorder {
+    public:
+        void Record(uint64_t value) {
+            Increase(Shard->Counts[BucketIndex(value)], 1);
+            Increase(Shard->Sum, value);
+            if (value < Shard->Min.load(std::memory_order_relaxed)) {
+                Shard->Min.store(value, std::memory_order_relaxed);
+            }
+            if (value > Shard->Max.load(std::memory_order_relaxed)) {
+                Shard->Max.store(value, std::memory_order_relaxed);
+            }
+        }
+
+    private:
+        friend class TConcurrentHistogram;
+        explicit TRecorder(TShard* shard)
+            : Shard(shard)
+        {}
+
+        TShard* Shard;
+    };
+
+    TRecorder GetRecorder() {
+        std::lock_guard g(Lock);
+        return TRecorder(&Shards.emplace_back());
+    }
+
+    // the counts and the sum of a shard being written may be a few records apart
+    THistogram Snapshot() const {
+        THistogram res;
+        std::lock_guard g(Lock);
+        for(const TShard& shard : Shards) {
+            for(uint32_t i = 0; i < BucketsNum; ++i) {
+                const uint64_t count = shard.Counts[i].load(std::memory_order_relaxed);
+                res.Counts[i] += count;
+                res.TotalCount += count;
+            }
+            res.Sum += shard.Sum.load(std::memory_order_relaxed);
+            res.Min = std::min(res.Min, shard.Min.load(std::memory_order_relaxed));
+            res.Max = std::max(res.Max, shard.Max.load(std::memory_order_relaxed));
+        }
+        return res;
+    }
+
+private:
+    mutable std::mutex Lock;
+    // a deque never moves its elements
+    std::deque<TShard> Shards;
+};
+
+}
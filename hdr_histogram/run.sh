@@ -0,0 +1,4 @@
+set -x -e
+clang++ -std=c++20 hdr_histogram.cpp -o hdr_histogram.exe -Wall -O2 -DNDEBUG
+# args: [latencies for the accuracy check] [max threads]
+BENCH_JSON=report.json ./hdr_histogram.exe | tee report.txt
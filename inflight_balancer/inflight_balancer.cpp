@@ -0,0 +1,217 @@
+#include "inflight_balancer.hpp"
+#include "../queue_sim/queue_sim.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <queue>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using namespace NInflightBalancer;
+
+// pick + release with limits high enough to never reject: the cost of the fast path,
+// and of the cache lines of the counters bouncing between cores
+void BenchPickCost(std::string_view name, TBalancerOptions options, uint32_t podsNum, size_t threadsNum, uint64_t iters) {
+    TInflightBalancer balancer(podsNum, 1 << 30, options);
+    auto started = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < threadsNum; ++t) {
+        threads.emplace_back([&]() {
+            for(uint64_t i = 0; i < iters; ++i) {
+                const int pod = balancer.TryPick();
+                balancer.Release(pod);
+            }
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    auto finished = std::chrono::high_resolution_clock::now();
+    const double ns = std::chrono::duration<double, std::nano>(finished - started).count();
+    std::cout << std::setw(20) << name << ", " << std::setw(3) << podsNum << " pods, " << threadsNum << " threads: "
+        << std::fixed << std::setprecision(1) << ns / iters << " ns per pick+release per thread, "
+        << iters * threadsNum / (ns / 1e3) << "M picks/s total" << std::endl;
+}
+
+// real threads holding slots of 5 pods with the limit 2 for a while and then pausing:
+// an offered load about the 10 slots, instant rejects vs a short wait queue
+void BenchWaitQueue(uint32_t waitQueueSize, size_t threadsNum, std::chrono::milliseconds duration) {
+    TBalancerOptions options;
+    options.WaitQueueSize = waitQueueSize;
+    options.WaitTimeout = std::chrono::microseconds(2000);
+    TInflightBalancer balancer(5, 2, options);
+    std::atomic<bool> stop = false;
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < threadsNum; ++t) {
+        threads.emplace_back([&]() {
+            while(!stop.load(std::memory_order_relaxed)) {
+                {
+                    TInflightLease lease(&balancer, balancer.Pick());
+                    if (lease) {
+                        // the request itself
+                        std::this_thread::sleep_for(std::chrono::microseconds(200));
+                    }
+                }
+                std::this_thread::sleep_for(std::chrono::microseconds(100));
+            }
+        });
+    }
+    std::this_thread::sleep_for(duration);
+    stop = true;
+    for(auto& t : threads) {
+        t.join();
+    }
+    std::cout << "wait queue " << waitQueueSize << ", " << threadsNum << " threads for 10 slots: picks " << balancer.PicksCount()
+        << ", rejects " << std::setprecision(3) << balancer.RejectsCount() * 100.0 / balancer.PicksCount() << "%"
+        << ", waited " << balancer.WaitedCount() * 100.0 / balancer.PicksCount() << "%" << std::endl;
+}
+
+struct TVirtualResult {
+    double RejectRate = 0;
+    double MeanMs = 0;
+    double P99Ms = 0;
+    double HedgeRate = 0;
+};
+
+// the balancer driven in virtual time by the model of math_posts/queue_rejects.md, single threaded:
+// poisson arrivals, 7 + exp(15) ms cut at 60 ms. A request not finished in hedgeDelayMs gets a hedge
+// to another pod, the first answer wins and the other attempt is cancelled, freeing its slot
+TVirtualResult ReplayVirtual(TBalancerOptions options, uint32_t podsNum, uint32_t limit, double hedgeDelayMs, uint64_t requests) {
+    TInflightBalancer balancer(podsNum, limit, options);
+    NQueueSim::TRng rng(2026);
+    const NQueueSim::TPoissonArrivals arrivals{130};
+    const NQueueSim::TShiftedExponentialService service{7, 15, 60};
+
+    enum EKind : uint32_t {Completion, HedgeTimer};
+    struct TEvent {
+        double Time;
+        EKind Kind;
+        int Pod;
+        uint64_t Request;
+        bool operator>(const TEvent& other) const {return Time > other.Time;}
+    };
+    struct TRequest {
+        double Start;
+        int Pods[2];
+    };
+    std::priority_queue<TEvent, std::vector<TEvent>, std::greater<>> events;
+    std::unordered_map<uint64_t, TRequest> active;
+    std::vector<double> latencies;
+    latencies.reserve(requests);
+
+    auto handle = [&](const TEvent& event) {
+        auto it = active.find(event.Request);
+        if (it == active.end()) {
+            // the request is done: the completion of a cancelled attempt or an obsolete timer
+            return;
+        }
+        TRequest& request = it->second;
+        if (event.Kind == HedgeTimer) {
+            const int pod = balancer.TryPickHedge(request.Pods[0]);
+            if (pod != TInflightBalancer::NoPod) {
+                request.Pods[1] = pod;
+                events.push(TEvent{event.Time + service.Next(rng), Completion, pod, event.Request});
+            }
+            return;
+        }
+        latencies.push_back(event.Time - request.Start);
+        for(int pod : request.Pods) {
+            if (pod != TInflightBalancer::NoPod) {
+                balancer.Release(pod);
+            }
+        }
+        active.erase(it);
+    };
+
+    double now = 0;
+    for(uint64_t i = 0; i < requests; ++i) {
+        now += arrivals.NextGap(rng);
+        while(!events.empty() && events.top().Time <= now) {
+            const TEvent event = events.top();
+            events.pop();
+            handle(event);
+        }
+        const int pod = balancer.TryPick();
+        if (pod == TInflightBalancer::NoPod) {
+            continue;
+        }
+        active[i] = TRequest{now, {pod, TInflightBalancer::NoPod}};
+        events.push(TEvent{now + service.Next(rng), Completion, pod, i});
+        if (hedgeDelayMs > 0) {
+            events.push(TEvent{now + hedgeDelayMs, HedgeTimer, pod, i});
+        }
+    }
+
+    TVirtualResult result;
+    result.RejectRate = double(balancer.RejectsCount()) / balancer.PicksCount();
+    result.HedgeRate = double(balancer.HedgesCount()) / balancer.PicksCount();
+    for(double latency : latencies) {
+        result.MeanMs += latency / latencies.size();
+    }
+    std::nth_element(latencies.begin(), latencies.begin() + latencies.size() * 99 / 100, latencies.end());
+    result.P99Ms = latencies[latencies.size() * 99 / 100];
+    return result;
+}
+
+void ReportVirtual(std::string_view name, TBalancerOptions options, uint32_t limit, double hedgeDelayMs, uint64_t requests) {
+    const TVirtualResult result = ReplayVirtual(options, 5, limit, hedgeDelayMs, requests);
+    std::cout << std::setw(34) << name << ", inflight " << limit << ": rejects " << std::scientific << std::setprecision(3) << result.RejectRate
+        << std::fixed << std::setprecision(1) << ", mean " << result.MeanMs << " ms, p99 " << result.P99Ms << " ms, hedges " << result.HedgeRate * 100 << "%" << std::endl;
+}
+
+// the same model in the simulator: the least loaded of all pods must match its full scan and erlang B,
+// p2c rejects there only when the less loaded of two is full, so both are, as here
+void ReportSimulator(uint32_t limit, uint64_t requests) {
+    using namespace NQueueSim;
+    const TShiftedExponentialService service{7, 15, 60};
+    const TSimStats fullScan = Simulate(TPoolConfig{5, limit}, TBinaryHeap{}, TPoissonArrivals{130}, service, TFullScan{}, requests, 2026);
+    const TSimStats p2c = Simulate(TPoolConfig{5, limit}, TBinaryHeap{}, TPoissonArrivals{130}, service, TPowerOfTwoChoices{}, requests, 2026);
+    std::cout << std::setw(34) << "queue_sim full scan" << ", inflight " << limit << ": rejects " << std::scientific << std::setprecision(3) << fullScan.RejectRate()
+        << ", erlang B " << ErlangB(5 * limit, 130 * 21.56 / 1000) << "\n"
+        << std::setw(34) << "queue_sim p2c" << ", inflight " << limit << ": rejects " << p2c.RejectRate()
+        << std::fixed << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    const uint64_t iters = argc > 1 ? atoll(argv[1]) : 10'000'000;
+    const uint64_t requests = argc > 2 ? atoll(argv[2]) : 10'000'000;
+    const size_t maxThreads = argc > 3 ? atoll(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+    TBalancerOptions p2c;
+    TBalancerOptions leastLoaded;
+    leastLoaded.Policy = EPolicy::LeastLoaded;
+    TBalancerOptions leastLoadedAll = leastLoaded;
+    leastLoadedAll.ScanLimit = 1 << 30;
+
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        BenchPickCost("p2c", p2c, 5, threadsNum, iters);
+        BenchPickCost("p2c", p2c, 100, threadsNum, iters);
+        BenchPickCost("least loaded of 8", leastLoaded, 100, threadsNum, iters);
+    }
+
+    std::cout << std::endl;
+    BenchWaitQueue(0, 16, std::chrono::milliseconds(300));
+    BenchWaitQueue(4, 16, std::chrono::milliseconds(300));
+
+    std::cout << "\n130 rps, 5 pods, 7 + exp(15) ms cut at 60, " << requests << " requests in virtual time" << std::endl;
+    TBalancerOptions noHedges = leastLoadedAll;
+    noHedges.HedgeBudgetPercent = 0;
+    TBalancerOptions p2cNoHedges = p2c;
+    p2cNoHedges.HedgeBudgetPercent = 0;
+    // 22% of requests are slower than 30ms, the budget must cover them
+    leastLoadedAll.HedgeBudgetPercent = 25;
+    p2c.HedgeBudgetPercent = 25;
+    for(uint32_t limit : {5, 2}) {
+        ReportSimulator(limit, requests);
+        ReportVirtual("least loaded of all", noHedges, limit, 0, requests);
+        ReportVirtual("p2c", p2cNoHedges, limit, 0, requests);
+        ReportVirtual("least loaded of all, hedge at 30ms", leastLoadedAll, limit, 30, requests);
+        ReportVirtual("p2c, hedge at 30ms", p2c, limit, 30, requests);
+    }
+    return 0;
+}
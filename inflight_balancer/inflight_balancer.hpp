@@ -0,0 +1,283 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+// Client side balancer over pods with an inflight limit (see incedent_posts/balancing_inc.md
+// and math_posts/queue_rejects.md): a pick takes a slot of a pod, Release gives it back.
+//
+// The fast path is lock free: per-pod inflight counters, each on its own cache line, a slot is taken
+// by a CAS that never goes above the limit. Only requests that found every candidate full and
+// are allowed to wait touch a mutex, and releases only lock it when somebody waits.
+// The pick and reject counts are sharded by thread as well and summed on read.
+
+namespace NInflightBalancer {
+
+enum class EPolicy {
+    // the less loaded of two distinct random pods, then the other one
+    PowerOfTwoChoices,
+    // the least loaded of ScanLimit pods starting from a random one (all pods when ScanLimit >= pods)
+    LeastLoaded,
+};
+
+struct TBalancerOptions {
+    EPolicy Policy = EPolicy::PowerOfTwoChoices;
+    uint32_t ScanLimit = 8;
+    // requests that may wait for a free slot instead of an instant reject, 0 disables waiting
+    uint32_t WaitQueueSize = 0;
+    std::chrono::microseconds WaitTimeout{1000};
+    // hedges allowed per 100 picks: hedges are retries too, and retries must be limited
+    uint32_t HedgeBudgetPercent = 10;
+};
+
+class TInflightBalancer {
+public:
+    static constexpr int NoPod = -1;
+
+    TInflightBalancer(uint32_t podsNum, uint32_t inflightLimit, TBalancerOptions options = {})
+        : PodsNum(podsNum)
+        , InflightLimit(inflightLimit)
+        , Options(options)
+        , Pods(new TPod[podsNum])
+    {}
+
+    // a pod with a taken slot, or NoPod if candidates are full
+    int TryPick(int excludedPod = NoPod) {
+        TStatsSlot& stats = ThreadStats();
+        stats.Picks.fetch_add(1, std::memory_order_relaxed);
+        const int pod = TryPickImpl(excludedPod);
+        if (pod == NoPod) {
+            stats.Rejects.fetch_add(1, std::memory_order_relaxed);
+        }
+        return pod;
+    }
+
+    // TryPick, then waits for a release up to WaitTimeout if the wait queue is not full
+    int Pick() {
+        TStatsSlot& stats = ThreadStats();
+        stats.Picks.fetch_add(1, std::memory_order_relaxed);
+        int pod = TryPickImpl(NoPod);
+        if (pod == NoPod && Options.WaitQueueSize) {
+            pod = WaitAndPick();
+        }
+        if (pod == NoPod) {
+            stats.Rejects.fetch_add(1, std::memory_order_relaxed);
+        }
+        return pod;
+    }
+
+    // a second attempt for a slow request on a pod other than the primary one; NoPod if the budget is spent.
+    // Summing the picks reads all the stats slots: fine for the slow requests only
+    int TryPickHedge(int primaryPod) {
+        const uint64_t picks = PicksCount();
+        if (Hedges.load(std::memory_order_relaxed) * 100 >= picks * Options.HedgeBudgetPercent) {
+            return NoPod;
+        }
+        const int pod = TryPickImpl(primaryPod);
+        if (pod != NoPod) {
+            Hedges.fetch_add(1, std::memory_order_relaxed);
+        }
+        return pod;
+    }
+
+    void Release(int pod) {
+        // seq_cst pairs with the waiter: either it sees the freed slot, or we see it waiting
+        Pods[pod].Inflight.fetch_sub(1, std::memory_order_seq_cst);
+        if (Waiters.load(std::memory_order_seq_cst)) [[unlikely]] {
+            std::lock_guard g(WaitLock);
+            WaitCondition.notify_one();
+        }
+    }
+
+    uint32_t Inflight(int pod) const {return Pods[pod].Inflight.load(std::memory_order_relaxed);}
+    uint32_t PodsCount() const {return PodsNum;}
+    uint64_t PicksCount() const {
+        uint64_t res = 0;
+        for(const TStatsSlot& slot : Stats) {
+            res += slot.Picks.load(std::memory_order_relaxed);
+        }
+        return res;
+    }
+    uint64_t RejectsCount() const {
+        uint64_t res = 0;
+        for(const TStatsSlot& slot : Stats) {
+            res += slot.Rejects.load(std::memory_order_relaxed);
+        }
+        return res;
+    }
+    uint64_t WaitedCount() const {return Waited.load(std::memory_order_relaxed);}
+    uint64_t HedgesCount() const {return Hedges.load(std::memory_order_relaxed);}
+
+private:
+    struct alignas(64) TPod {
+        std::atomic<uint32_t> Inflight = 0;
+    };
+
+    static constexpr uint32_t StatsShardsNum = 16;
+
+    // the counts of the threads of a slot: a request touches only its thread's line
+    struct alignas(64) TStatsSlot {
+        std::atomic<uint64_t> Picks = 0;
+        std::atomic<uint64_t> Rejects = 0;
+    };
+
+    // slots are given to threads round robin, as in TShardedRwLockElem of test_locks
+    TStatsSlot& ThreadStats() {
+        static std::atomic<uint32_t> nextSlot = 0;
+        thread_local const uint32_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % StatsShardsNum;
+        return Stats[slot];
+    }
+
+    // xorshift64*, per thread: a shared generator would be one more contended cache line
+    static uint32_t Random(uint32_t n) {
+        thread_local uint64_t state = 0x9e3779b97f4a7c15ULL ^ reinterpret_cast<uintptr_t>(&state);
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return uint32_t((((state * 0x2545f4914f6cdd1dULL) >> 32) * n) >> 32);
+    }
+
+    bool TryTakeSlot(int pod) {
+        uint32_t current = Pods[pod].Inflight.load(std::memory_order_relaxed);
+        while(current < InflightLimit) {
+            if (Pods[pod].Inflight.compare_exchange_weak(current, current + 1, std::memory_order_acquire)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int TryPickImpl(int excludedPod) {
+        if (Options.Policy == EPolicy::PowerOfTwoChoices) {
+            // two distinct pods, none of them excluded
+            const uint32_t candidates = PodsNum - (excludedPod != NoPod);
+            if (candidates == 0) {
+                return NoPod;
+            }
+            uint32_t first = Random(candidates);
+            uint32_t second = candidates > 1 ? Random(candidates - 1) : first;
+            second += candidates > 1 && second >= first;
+            if (excludedPod != NoPod) {
+                first += first >= uint32_t(excludedPod);
+                second += second >= uint32_t(excludedPod);
+            }
+            const bool firstIsBetter = Inflight(first) <= Inflight(second);
+            if (TryTakeSlot(firstIsBetter ? first : second)) {
+                return firstIsBetter ? first : second;
+            }
+            if (TryTakeSlot(firstIsBetter ? second : first)) {
+                return firstIsBetter ? second : first;
+            }
+            return NoPod;
+        }
+
+        // a concurrent pick may take the slot between the scan and the CAS, so one more scan then
+        for(int round = 0; round < 2; ++round) {
+            const uint32_t scanned = std::min(Options.ScanLimit, PodsNum);
+            uint32_t pod = Random(PodsNum);
+            int best = NoPod;
+            uint32_t bestInflight = InflightLimit;
+            for(uint32_t i = 0; i < scanned; ++i, pod = pod + 1 == PodsNum ? 0 : pod + 1) {
+                const uint32_t inflight = Inflight(pod);
+                if (int(pod) != excludedPod && inflight < bestInflight) {
+                    best = pod;
+                    bestInflight = inflight;
+                }
+            }
+            if (best == NoPod) {
+                return NoPod;
+            }
+            if (TryTakeSlot(best)) {
+                return best;
+            }
+        }
+        return NoPod;
+    }
+
+    // a waiter was woken by some release, the two random candidates of p2c would likely miss it
+    int TryPickAny() {
+        for(uint32_t pod = 0; pod < PodsNum; ++pod) {
+            if (TryTakeSlot(pod)) {
+                return pod;
+            }
+        }
+        return NoPod;
+    }
+
+    int WaitAndPick() {
+        const auto deadline = std::chrono::steady_clock::now() + Options.WaitTimeout;
+        std::unique_lock g(WaitLock);
+        if (Waiters.load(std::memory_order_relaxed) >= Options.WaitQueueSize) {
+            return NoPod;
+        }
+        Waiters.fetch_add(1, std::memory_order_seq_cst);
+        // the counters below are read after Waiters is published, see Release
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        Waited.fetch_add(1, std::memory_order_relaxed);
+        int pod = NoPod;
+        while(true) {
+            pod = TryPickAny();
+            if (pod != NoPod || WaitCondition.wait_until(g, deadline) == std::cv_status::timeout) {
+                break;
+            }
+        }
+        if (pod == NoPod) {
+            pod = TryPickAny();
+        }
+        Waiters.fetch_sub(1, std::memory_order_relaxed);
+        return pod;
+    }
+
+    const uint32_t PodsNum;
+    const uint32_t InflightLimit;
+    const TBalancerOptions Options;
+    std::unique_ptr<TPod[]> Pods;
+
+    // statistics: picks and rejects are touched by every request, so they are per thread slot
+    TStatsSlot Stats[StatsShardsNum];
+    alignas(64) std::atomic<uint64_t> Waited = 0;
+    std::atomic<uint64_t> Hedges = 0;
+
+    alignas(64) std::atomic<uint32_t> Waiters = 0;
+    std::mutex WaitLock;
+    std::condition_variable WaitCondition;
+};
+
+// a taken slot, released at destruction
+class TInflightLease {
+public:
+    TInflightLease() = default;
+    TInflightLease(TInflightBalancer* balancer, int pod)
+        : Balancer(pod == TInflightBalancer::NoPod ? nullptr : balancer)
+        , Pod(pod)
+    {}
+    TInflightLease(TInflightLease&& other) noexcept
+        : Balancer(std::exchange(other.Balancer, nullptr))
+        , Pod(other.Pod)
+    {}
+    TInflightLease& operator=(TInflightLease&& other) noexcept {
+        std::swap(Balancer, other.Balancer);
+        std::swap(Pod, other.Pod);
+        return *this;
+    }
+    ~TInflightLease() {
+        if (Balancer) {
+            Balancer->Release(Pod);
+        }
+    }
+
+    int GetPod() const {return Pod;}
+    explicit operator bool() const {return Balancer != nullptr;}
+
+private:
+    TInflightBalancer* Balancer = nullptr;
+    int Pod = TInflightBalancer::NoPod;
+};
+
+}
@@ -0,0 +1,3 @@
+set -x -e
+clang++ -std=c++20 inflight_balancer.cpp -o inflight_balancer.exe -Wall -O2 -DNDEBUG
+./inflight_balancer.exe | tee report.txt
@@ -0,0 +1,106 @@
+#include "lock_profiler.hpp"
+#include "../bench/bench.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace NLockProfiler;
+
+// lock + unlock from one thread: what the profiler adds to every acquire
+template<class TLock>
+void RunUncontended(NBench::TReporter& reporter, const std::string& name, TLock& lock) {
+    uint64_t counter = 0;
+    reporter.Add(NBench::Run(name, [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            lock.lock();
+            counter += 1;
+            NBench::DoNotOptimize(counter);
+            lock.unlock();
+        }
+    }));
+}
+
+// two sites of one lock: a short critical section and a 4 times longer one, every thread takes both
+template<class TGuardType, class TLock>
+void Hammer(TLock& lock, uint64_t iters, uint64_t& counter) {
+    for(uint64_t i = 0; i < iters; ++i) {
+        if (i % 2) {
+            TGuardType g(lock);
+            counter += 1;
+        } else {
+            TGuardType g(lock);
+            for(int j = 0; j < 4; ++j) {
+                counter = counter * 3 + 1;
+                NBench::DoNotOptimize(counter);
+            }
+        }
+    }
+}
+
+// the sample is the slowest thread, per acquire
+template<class TGuardType, class TLock>
+NBench::TStats RunContended(const std::string& name, TLock& lock, size_t threadsNum) {
+    NBench::TOptions options;
+    options.Iterations = 100'000;
+    options.WarmupTime = {};
+    options.Samples = 10;
+    uint64_t counter = 0;
+    return NBench::RunManual(name + ", " + std::to_string(threadsNum) + " threads", [&](uint64_t iters) {
+        std::atomic<bool> start = false;
+        std::vector<double> elapsed(threadsNum);
+        std::vector<std::thread> threads;
+        for(size_t t = 0; t < threadsNum; ++t) {
+            threads.emplace_back([&, t]() {
+                while(!start.load()) {}
+                auto started = std::chrono::steady_clock::now();
+                Hammer<TGuardType>(lock, iters, counter);
+                elapsed[t] = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+            });
+        }
+        start = true;
+        for(auto& t : threads) {
+            t.join();
+        }
+        return NBench::TSample{*std::max_element(elapsed.begin(), elapsed.end()), double(iters)};
+    }, options);
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t maxThreads = argc > 1 ? atoll(argv[1]) : std::max(4u, std::thread::hardware_concurrency());
+    const std::chrono::milliseconds dumpPeriod(argc > 2 ? atoll(argv[2]) : 250);
+    NBench::TReporter reporter("lock_profiler");
+    std::cout << "rdtsc ticks per ns " << TicksPerNs() << std::endl;
+
+    std::mutex plain;
+    RunUncontended(reporter, "std::mutex, uncontended", plain);
+    TProfiledLock<std::mutex> profiled;
+    for(uint32_t sampleEvery : {1, 16, 1024}) {
+        SampleEvery = sampleEvery;
+        RunUncontended(reporter, "profiled std::mutex, uncontended, hold sampled 1/" + std::to_string(sampleEvery), profiled);
+    }
+
+    SampleEvery = 16;
+    {
+        // the live view of a production process: the top sites on stderr while the contended runs go,
+        // the report on stdout stays clean
+        std::optional<TPeriodicDump> periodicDump;
+        if (dumpPeriod.count()) {
+            periodicDump.emplace(std::cerr, dumpPeriod, 2);
+        }
+        for(size_t threadsNum = 2; threadsNum <= maxThreads; threadsNum *= 2) {
+            reporter.Add(RunContended<std::lock_guard<std::mutex>>("std::mutex", plain, threadsNum));
+            reporter.Add(RunContended<TGuard<std::mutex>>("profiled std::mutex", profiled, threadsNum));
+        }
+    }
+
+    // the uncontended runs are one site each, the contended ones two: short and long critical sections
+    Dump(std::cout);
+    return 0;
+}
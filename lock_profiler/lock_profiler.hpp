@@ -0,0 +1,406 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <source_location>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <x86intrin.h>
+#endif
+
+// Contention profile of locks by the place they are taken at, cheap enough to stay on in production.
+//
+// The site is the std::source_location of the Lock call (a default argument, so no macros, see
+// just_post/source_location.md). Every thread keeps its own table of sites, written by it only
+// (relaxed load + store, as NHdrHistogram::TConcurrentHistogram), and Collect merges the tables of all
+// threads, alive or finished, by file:line.
+// - an acquire is a try lock first: if it succeeds, it was not contended and nothing is timed
+// - a contended acquire is timed, the wait goes into the site's histogram
+// - the hold time is timed for contended acquires and for one of SampleEvery uncontended ones
+// Time is rdtsc ticks on x86 (converted on Collect), steady_clock elsewhere; histograms are powers of two.
+//
+// TProfiledLock<TLockable> wraps std::mutex or anything with TryLock/Lock/UnLock, TGuard is its lock_guard
+// (std::lock_guard would report the line of <mutex>). Acquire/Release do the same for a lock kept elsewhere,
+// AcquireByAddress/ReleaseByAddress too, for a lock that has no room for the THeld: the thread keeps it.
+
+namespace NLockProfiler {
+
+// bit_width of the ticks: bucket i holds [2^(i-1), 2^i)
+constexpr uint32_t HistogramBuckets = 65;
+constexpr uint32_t SitesPerThread = 256;
+
+inline std::atomic<uint32_t> SampleEvery = 16;
+
+inline uint64_t Now() {
+#if defined(__x86_64__)
+    return __rdtsc();
+#else
+    return std::chrono::steady_clock::now().time_since_epoch().count();
+#endif
+}
+
+// measured on the first call, it takes 20 ms
+inline double TicksPerNs() {
+#if defined(__x86_64__)
+    static const double res = []() {
+        const auto started = std::chrono::steady_clock::now();
+        const uint64_t ticks = Now();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        return double(Now() - ticks) / std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count();
+    }();
+    return res;
+#else
+    return 1;
+#endif
+}
+
+// the owner thread is the only writer
+inline void Increase(std::atomic<uint64_t>& x, uint64_t delta) {
+    x.store(x.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+struct TSiteStats {
+    const char* File = nullptr;
+    const char* Function = nullptr;
+    uint32_t Line = 0;
+    std::atomic<uint64_t> Acquires = 0;
+    std::atomic<uint64_t> Contended = 0;
+    std::atomic<uint64_t> WaitTicks = 0;
+    std::atomic<uint64_t> HoldTicks = 0;
+    std::atomic<uint64_t> HoldSamples = 0;
+    std::atomic<uint64_t> Waits[HistogramBuckets] = {};
+    std::atomic<uint64_t> Holds[HistogramBuckets] = {};
+};
+
+// what the holder keeps from the acquire to the release
+struct THeld {
+    TSiteStats* Site = nullptr;
+    // 0 when the hold is not sampled
+    uint64_t Acquired = 0;
+};
+
+// sites of one thread: an open addressing table of pointers, published for Collect
+class TThreadSites {
+public:
+    TSiteStats& Get(const std::source_location& location) {
+        const uint32_t line = location.line();
+        const char* file = location.file_name();
+        uint32_t index = uint32_t((uintptr_t(file) >> 3) ^ (line * 0x9e3779b9u)) % SitesPerThread;
+        for(uint32_t probes = 0; probes < SitesPerThread; ++probes, index = (index + 1) % SitesPerThread) {
+            TSiteStats* site = Sites[index].load(std::memory_order_relaxed);
+            if (!site) {
+                site = &Storage.emplace_back();
+                site->File = file;
+                site->Function = location.function_name();
+                site->Line = line;
+                Sites[index].store(site, std::memory_order_release);
+                return *site;
+            }
+            if (site->Line == line && site->File == file) {
+                return *site;
+            }
+        }
+        return Overflow;
+    }
+
+    template<class TFunc>
+    void ForEach(TFunc&& func) const {
+        for(const auto& ptr : Sites) {
+            if (const TSiteStats* site = ptr.load(std::memory_order_acquire)) {
+                func(*site);
+            }
+        }
+        func(Overflow);
+    }
+
+    uint32_t SampleCounter = 0;
+    // the locks of AcquireByAddress held by the thread, the last taken at the back
+    std::vector<std::pair<const void*, THeld>> HeldByAddress;
+
+private:
+    std::atomic<TSiteStats*> Sites[SitesPerThread] = {};
+    // a deque never moves its elements
+    std::deque<TSiteStats> Storage;
+    TSiteStats Overflow{"<more sites than the table holds>", "", 0};
+};
+
+// tables of all threads that ever locked, they outlive the threads
+class TRegistry {
+public:
+    static TRegistry& Get() {
+        static TRegistry registry;
+        return registry;
+    }
+
+    TThreadSites* Add() {
+        std::lock_guard g(Lock);
+        return Threads.emplace_back(std::make_unique<TThreadSites>()).get();
+    }
+
+    template<class TFunc>
+    void ForEach(TFunc&& func) const {
+        std::lock_guard g(Lock);
+        for(const auto& thread : Threads) {
+            func(*thread);
+        }
+    }
+
+private:
+    mutable std::mutex Lock;
+    std::vector<std::unique_ptr<TThreadSites>> Threads;
+};
+
+// trivial thread_local: a single fs-relative load, no init guard on every acquire
+inline thread_local TThreadSites* CurrentSites = nullptr;
+
+inline TThreadSites& CurrentThreadSites() {
+    if (!CurrentSites) [[unlikely]] {
+        CurrentSites = TRegistry::Get().Add();
+    }
+    return *CurrentSites;
+}
+
+template<class TLockable>
+bool TryLockOf(TLockable& lock) {
+    if constexpr (requires {lock.try_lock();}) {
+        return lock.try_lock();
+    } else {
+        return lock.TryLock();
+    }
+}
+
+template<class TLockable>
+void LockOf(TLockable& lock) {
+    if constexpr (requires {lock.lock();}) {
+        lock.lock();
+    } else {
+        lock.Lock();
+    }
+}
+
+template<class TLockable>
+void UnLockOf(TLockable& lock) {
+    if constexpr (requires {lock.unlock();}) {
+        lock.unlock();
+    } else {
+        lock.UnLock();
+    }
+}
+
+template<class TLockable>
+THeld Acquire(TLockable& lock, const std::source_location& location = std::source_location::current()) {
+    TThreadSites& sites = CurrentThreadSites();
+    TSiteStats& site = sites.Get(location);
+    Increase(site.Acquires, 1);
+    if (TryLockOf(lock)) {
+        if (++sites.SampleCounter < SampleEvery.load(std::memory_order_relaxed)) {
+            return {&site, 0};
+        }
+        sites.SampleCounter = 0;
+        return {&site, Now()};
+    }
+    const uint64_t started = Now();
+    LockOf(lock);
+    const uint64_t acquired = Now();
+    Increase(site.Contended, 1);
+    Increase(site.WaitTicks, acquired - started);
+    Increase(site.Waits[std::bit_width(acquired - started)], 1);
+    return {&site, acquired};
+}
+
+template<class TLockable>
+void Release(TLockable& lock, const THeld& held) {
+    if (held.Acquired) {
+        const uint64_t ticks = Now() - held.Acquired;
+        Increase(held.Site->HoldTicks, ticks);
+        Increase(held.Site->HoldSamples, 1);
+        Increase(held.Site->Holds[std::bit_width(ticks)], 1);
+    }
+    UnLockOf(lock);
+}
+
+template<class TLockable>
+void AcquireByAddress(TLockable& lock, const std::source_location& location = std::source_location::current()) {
+    const THeld held = Acquire(lock, location);
+    CurrentThreadSites().HeldByAddress.emplace_back(&lock, held);
+}
+
+// locks are mostly released in the reverse order: the search from the back is a step
+template<class TLockable>
+void ReleaseByAddress(TLockable& lock) {
+    auto& heldLocks = CurrentThreadSites().HeldByAddress;
+    auto it = heldLocks.end();
+    do {
+        --it;
+    } while(it->first != &lock);
+    const THeld held = it->second;
+    heldLocks.erase(it);
+    Release(lock, held);
+}
+
+template<class TLockable = std::mutex>
+class TProfiledLock {
+public:
+    void lock(const std::source_location& location = std::source_location::current()) {
+        THeld held = Acquire(Lock, location);
+        Held = held;
+    }
+    void unlock() {
+        Release(Lock, Held);
+    }
+
+private:
+    TLockable Lock;
+    // written and read by the holder only
+    THeld Held;
+};
+
+template<class TLockable>
+class TGuard {
+public:
+    explicit TGuard(TProfiledLock<TLockable>& lock, const std::source_location& location = std::source_location::current())
+        : Lock(lock)
+    {
+        Lock.lock(location);
+    }
+    TGuard(const TGuard&) = delete;
+    TGuard& operator=(const TGuard&) = delete;
+    ~TGuard() {
+        Lock.unlock();
+    }
+
+private:
+    TProfiledLock<TLockable>& Lock;
+};
+
+struct TSiteReport {
+    std::string File;
+    std::string Function;
+    uint32_t Line = 0;
+    uint64_t Acquires = 0;
+    uint64_t Contended = 0;
+    double WaitNs = 0;
+    double HoldNs = 0;
+    uint64_t HoldSamples = 0;
+    uint64_t Waits[HistogramBuckets] = {};
+    uint64_t Holds[HistogramBuckets] = {};
+
+    double MeanHoldNs() const {return HoldSamples ? HoldNs / HoldSamples : 0;}
+
+    // the middle of the power of two bucket, in ns
+    static double Quantile(const uint64_t (&counts)[HistogramBuckets], double q) {
+        uint64_t total = 0;
+        for(uint64_t c : counts) {
+            total += c;
+        }
+        if (!total) {
+            return 0;
+        }
+        const uint64_t rank = std::max<uint64_t>(1, uint64_t(q * total + 0.5));
+        uint64_t seen = 0;
+        for(uint32_t i = 0; i < HistogramBuckets; ++i) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return (i ? 1.5 * std::ldexp(1.0, i - 1) : 0) / TicksPerNs();
+            }
+        }
+        return 0;
+    }
+};
+
+// all sites of all threads, the most waited for first
+inline std::vector<TSiteReport> Collect() {
+    std::map<std::pair<std::string, uint32_t>, TSiteReport> merged;
+    const double ticksPerNs = TicksPerNs();
+    TRegistry::Get().ForEach([&](const TThreadSites& sites) {
+        sites.ForEach([&](const TSiteStats& site) {
+            const uint64_t acquires = site.Acquires.load(std::memory_order_relaxed);
+            if (!acquires) {
+                return;
+            }
+            TSiteReport& report = merged[{site.File, site.Line}];
+            report.File = site.File;
+            report.Function = site.Function;
+            report.Line = site.Line;
+            report.Acquires += acquires;
+            report.Contended += site.Contended.load(std::memory_order_relaxed);
+            report.WaitNs += site.WaitTicks.load(std::memory_order_relaxed) / ticksPerNs;
+            report.HoldNs += site.HoldTicks.load(std::memory_order_relaxed) / ticksPerNs;
+            report.HoldSamples += site.HoldSamples.load(std::memory_order_relaxed);
+            for(uint32_t i = 0; i < HistogramBuckets; ++i) {
+                report.Waits[i] += site.Waits[i].load(std::memory_order_relaxed);
+                report.Holds[i] += site.Holds[i].load(std::memory_order_relaxed);
+            }
+        });
+    });
+    std::vector<TSiteReport> res;
+    for(auto& [key, report] : merged) {
+        res.push_back(std::move(report));
+    }
+    std::sort(res.begin(), res.end(), [](const TSiteReport& a, const TSiteReport& b) {
+        return a.WaitNs > b.WaitNs || (a.WaitNs == b.WaitNs && a.Acquires > b.Acquires);
+    });
+    return res;
+}
+
+inline void Dump(std::ostream& out, size_t top = 10) {
+    const std::vector<TSiteReport> sites = Collect();
+    const std::ios_base::fmtflags flags = out.flags();
+    out << "lock sites, the most waited for first:" << std::fixed << std::setprecision(1) << std::endl;
+    for(size_t i = 0; i < std::min(top, sites.size()); ++i) {
+        const TSiteReport& s = sites[i];
+        out << " -- " << s.File << ":" << s.Line << " " << s.Function << std::endl
+            << "    acquires " << s.Acquires << ", contended " << s.Contended
+            << " (" << (s.Acquires ? 100.0 * s.Contended / s.Acquires : 0) << "%)"
+            << ", wait total " << s.WaitNs / 1e6 << " ms"
+            << ", wait p50 " << TSiteReport::Quantile(s.Waits, 0.5) << " p99 " << TSiteReport::Quantile(s.Waits, 0.99) << " ns"
+            << ", hold mean " << s.MeanHoldNs() << " p99 " << TSiteReport::Quantile(s.Holds, 0.99) << " ns" << std::endl;
+    }
+    out.flags(flags);
+}
+
+// Dump every period from a background thread, until destroyed
+class TPeriodicDump {
+public:
+    TPeriodicDump(std::ostream& out, std::chrono::milliseconds period, size_t top = 10)
+        : Thread([&out, period, top, this]() {
+            std::unique_lock g(Lock);
+            while(!Stop) {
+                if (!Wake.wait_for(g, period, [this]() {return Stop;})) {
+                    Dump(out, top);
+                }
+            }
+        })
+    {}
+    ~TPeriodicDump() {
+        {
+            std::lock_guard g(Lock);
+            Stop = true;
+        }
+        Wake.notify_all();
+        Thread.join();
+    }
+
+private:
+    std::mutex Lock;
+    std::condition_variable Wake;
+    bool Stop = false;
+    std::thread Thread;
+};
+
+}
@@ -0,0 +1,4 @@
+set -x -e
+clang++ -std=c++20 lock_profiler.cpp -o lock_profiler.exe -Wall -O2 -DNDEBUG
+# args: [max threads] [dump period ms to stderr=250, 0 for none]
+BENCH_JSON=report.json ./lock_profiler.exe | tee report.txt
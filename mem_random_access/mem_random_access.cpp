@@ -1,43 +1,102 @@
+#include "../bench/bench.hpp"
+#include "../hdr_histogram/hdr_histogram.hpp"
+#include "../snapshot_pool/snapshot_pool.hpp"
+#include "../work_stealing/work_stealing.hpp"
+#include "stream_kernels.hpp"
+
 #include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <numeric>
+#include <random>
 #include <string>
+#include <string_view>
+#include <thread>
 #include <vector>
 #include <chrono>
 
+#include <unistd.h>
+
+constexpr uint64_t PoolSeed = 2026;
+
+enum class EPoolSource {
+    // the original: std::rand() for every element, byte by byte
+    RandFill,
+    // CounterRandom(PoolSeed, elemId) on all cores
+    ParallelFill,
+    // mmap of a snapshot written before, read only; the parallel fill if it can't be opened
+    Snapshot,
+};
+
+struct TPoolSource {
+    EPoolSource Kind = EPoolSource::ParallelFill;
+    std::string SnapshotPath;
+    NSnapshotPool::TMapOptions MapOptions;
+};
+
 template<size_t ElemSize>
 struct TDataHolder {
-    std::vector<uint8_t> Data;
-    uint8_t* EffectiveDataPtr = nullptr;
+    // not a vector: it would zero 128 mb serially before the fill
+    std::unique_ptr<uint8_t[]> Data;
+    NSnapshotPool::TMappedSnapshot Snapshot;
+    const uint8_t* EffectiveDataPtr = nullptr;
     size_t ElemsNum = 0;
 
-    TDataHolder(float mbs) {
-        std::srand(2026);
-
+    TDataHolder(float mbs, const TPoolSource& source = {}) {
         const size_t recommendedSizeBytes = mbs * 1024 * 1024;
         ElemsNum = recommendedSizeBytes / ElemSize + 1;
+
+        if (source.Kind == EPoolSource::Snapshot) {
+            Snapshot = NSnapshotPool::TMappedSnapshot::Open(source.SnapshotPath, source.MapOptions);
+            if (Snapshot && Snapshot.Header().ElemSize == ElemSize && Snapshot.Header().ElemsNum == ElemsNum && Snapshot.Header().Tag == PoolSeed) {
+                EffectiveDataPtr = static_cast<const uint8_t*>(Snapshot.Data());
+                return;
+            }
+            std::cerr << "snapshot is not usable, " << (Snapshot ? "another pool in " + source.SnapshotPath : Snapshot.GetError()) << std::endl;
+            Snapshot = {};
+        }
+
         const size_t alignment = 1024 * 4;
         const size_t finalSize = ElemsNum * ElemSize + alignment;
-        std::cout << "finalSize=" << finalSize / 1024 / 1024 << " mb" << std::endl;
-        std::cout << "elemsnum=" << ElemsNum / 1e6 << " mln" << std::endl;
+        Data.reset(new uint8_t[finalSize]);
+        uint8_t* dataPtr = (uint8_t*)( size_t(Data.get()) / alignment * alignment + alignment );
+        EffectiveDataPtr = dataPtr;
 
-        Data.resize(finalSize);
-        EffectiveDataPtr = (uint8_t*)( size_t(&Data.front()) / alignment * alignment + alignment );
-
-        for(size_t elemId = 0; elemId < ElemsNum; ++elemId) {
-            int rand = std::rand();
-            for(size_t i = 0; i < ElemSize; ++i) {
-                EffectiveDataPtr[ElemSize * elemId + i] =  rand % std::numeric_limits<uint8_t>::max();
+        if (source.Kind == EPoolSource::RandFill) {
+            std::srand(PoolSeed);
+            for(size_t elemId = 0; elemId < ElemsNum; ++elemId) {
+                int rand = std::rand();
+                for(size_t i = 0; i < ElemSize; ++i) {
+                    dataPtr[ElemSize * elemId + i] =  rand % std::numeric_limits<uint8_t>::max();
+                }
             }
+        } else {
+            NSnapshotPool::ParallelFill(ElemsNum, [&](size_t begin, size_t end) {
+                for(size_t elemId = begin; elemId < end; ++elemId) {
+                    const uint8_t value = NSnapshotPool::CounterRandom(PoolSeed, elemId) % std::numeric_limits<uint8_t>::max();
+                    std::memset(dataPtr + ElemSize * elemId, value, ElemSize);
+                }
+            });
         }
     }
 
+    bool WriteSnapshot(const std::string& path) const {
+        std::string error;
+        if (!NSnapshotPool::WriteSnapshot(path, EffectiveDataPtr, ElemSize, ElemsNum, PoolSeed, &error)) {
+            std::cerr << error << std::endl;
+            return false;
+        }
+        return true;
+    }
+
     size_t DoActions(const std::vector<size_t>& shifts, std::vector<size_t>& dst) const {
         for(size_t shiftId = 0; shiftId < shifts.size(); shiftId += 1) {
             int64_t localAccum = 0;
-            const int64_t* ptr = (int64_t*)( EffectiveDataPtr + ElemSize * shifts[shiftId] );
+            const int64_t* ptr = (const int64_t*)( EffectiveDataPtr + ElemSize * shifts[shiftId] );
             for(size_t i = 0; i < ElemSize / sizeof(*ptr); i += 2) {
                 localAccum +=  ptr[i] * ptr[i];
             }
@@ -45,49 +104,278 @@ struct TDataHolder {
         }
         return std::accumulate(dst.begin(), dst.end(), 0);
     }
+
+    // DoActions with the clock read around every element. On linux steady_clock is rdtsc after lfence,
+    // so the second read waits for the loads of the element; the clock cost itself is in the latency too
+    size_t DoActionsTimed(const std::vector<size_t>& shifts, std::vector<size_t>& dst, NHdrHistogram::THistogram& latencies) const {
+        for(size_t shiftId = 0; shiftId < shifts.size(); shiftId += 1) {
+            auto started = std::chrono::steady_clock::now();
+            int64_t localAccum = 0;
+            const int64_t* ptr = (const int64_t*)( EffectiveDataPtr + ElemSize * shifts[shiftId] );
+            for(size_t i = 0; i < ElemSize / sizeof(*ptr); i += 2) {
+                localAccum +=  ptr[i] * ptr[i];
+            }
+            dst[shiftId] = localAccum;
+            auto finished = std::chrono::steady_clock::now();
+            latencies.Record((finished - started).count());
+        }
+        return std::accumulate(dst.begin(), dst.end(), 0);
+    }
 };
 
+// the latency of an empty timed region, to subtract from the access latencies
+void ReportClockCost() {
+    NHdrHistogram::THistogram latencies;
+    for(size_t i = 0; i < 1'000'000; ++i) {
+        auto started = std::chrono::steady_clock::now();
+        auto finished = std::chrono::steady_clock::now();
+        latencies.Record((finished - started).count());
+    }
+    std::cout << "clock cost: " << latencies.Describe() << " ns" << std::endl;
+}
+
 template<size_t elemSize>
-void DoWork(float poolSizeMb) {
-    TDataHolder<elemSize> dataHolder(poolSizeMb);
+void DoWork(NBench::TReporter& reporter, float poolSizeMb, const TPoolSource& source = {}) {
+    TDataHolder<elemSize> dataHolder(poolSizeMb, source);
+    std::cout << "finalSize=" << dataHolder.ElemsNum * elemSize / 1024 / 1024 << " mb" << std::endl;
+    std::cout << "elemsnum=" << dataHolder.ElemsNum / 1e6 << " mln" << (dataHolder.Snapshot ? ", mmapped snapshot" : "") << std::endl;
     uint32_t actionsNum = 1e4;
 
     std::srand(2027);
 
     size_t controlSum = 0;
-    std::vector<size_t> stats(1000);
     std::vector<size_t> actions(actionsNum);
     std::vector<size_t> buf(actionsNum);
-    for(size_t iter = 0; iter < stats.size(); ++iter) {
+    // fresh random shifts for every batch, generated out of the measurement:
+    // the same 1e4 elements again would be cached
+    NBench::TOptions options;
+    options.MinSampleTime = std::chrono::milliseconds(5);
+    char name[64];
+    std::snprintf(name, sizeof(name), "%zu bytes elems, %g mb pool%s", elemSize, poolSizeMb, dataHolder.Snapshot ? ", snapshot" : "");
+    NBench::TStats stats = NBench::RunManual(name, [&](uint64_t iters) {
+        NBench::TSample sample;
+        for(uint64_t iter = 0; iter < iters; ++iter) {
+            for(auto& x : actions) {
+                x = rand() % dataHolder.ElemsNum;
+            }
+            auto actionsStarted = std::chrono::high_resolution_clock::now();
+            controlSum += dataHolder.DoActions(actions, buf);
+            auto actionsFinished = std::chrono::high_resolution_clock::now();
+            sample.Ns += std::chrono::duration<double, std::nano>(actionsFinished - actionsStarted).count();
+        }
+        sample.Items = iters * actions.size();
+        return sample;
+    }, options);
+
+    // per access latencies of 100 more batches, the tail is what the batch mean hides
+    NHdrHistogram::THistogram latencies;
+    for(size_t iter = 0; iter < 100; ++iter) {
         for(auto& x : actions) {
             x = rand() % dataHolder.ElemsNum;
         }
-        auto actionsStarted = std::chrono::high_resolution_clock::now();
-        controlSum += dataHolder.DoActions(actions, buf);
-        auto actionsFinished = std::chrono::high_resolution_clock::now();
-
-        stats[iter] = (actionsFinished - actionsStarted).count();
+        controlSum += dataHolder.DoActionsTimed(actions, buf, latencies);
     }
+    std::cout << elemSize << ": per access latency " << latencies.Describe() << " ns" << std::endl;
 
     std::cerr << "conrol sum = " << controlSum << std::endl;
-    std::sort(stats.begin(), stats.end());
+    stats.AddQuantiles("access_", latencies);
+    reporter.Add(std::move(stats));
+}
 
-    std::cout << elemSize << ": Elapsed q50: " << stats[stats.size() / 2] / 1e3 << "k ticks" << std::endl;
-    std::cout << elemSize << ": Elapsed q90: " << stats[stats.size() * 0.9] / 1e3 << "k ticks" << std::endl;
+struct TStartupCase {
+    std::string_view Name;
+    TPoolSource Source;
+    // the snapshot is evicted from the page cache before every sample
+    bool Cold = false;
+};
 
+// time to first query: the pool is built (or mapped) and the first batch of 1e4 random reads is done.
+// A sample per fresh pool, the snapshot is written once by the parallel fill
+template<size_t elemSize>
+void ReportStartup(NBench::TReporter& reporter, float poolSizeMb, const std::string& snapshotPath, uint32_t samples) {
+    {
+        auto started = std::chrono::high_resolution_clock::now();
+        TDataHolder<elemSize> dataHolder(poolSizeMb);
+        if (!dataHolder.WriteSnapshot(snapshotPath)) {
+            return;
+        }
+        auto finished = std::chrono::high_resolution_clock::now();
+        std::cout << "snapshot " << snapshotPath << " generated and written in " << std::chrono::duration<double, std::milli>(finished - started).count() << " ms" << std::endl;
+    }
+
+    using NSnapshotPool::ELoad;
+    auto snapshot = [&](ELoad load, bool verify = false) {
+        return TPoolSource{EPoolSource::Snapshot, snapshotPath, NSnapshotPool::TMapOptions{load, verify}};
+    };
+    const TStartupCase cases[] = {
+        {"rand fill", {EPoolSource::RandFill, {}, {}}},
+        {"parallel fill", {EPoolSource::ParallelFill, {}, {}}},
+        {"page cache snapshot, lazy", snapshot(ELoad::Lazy)},
+        {"page cache snapshot, populate", snapshot(ELoad::Populate)},
+        {"page cache snapshot, lazy + checksum", snapshot(ELoad::Lazy, true)},
+        {"cold snapshot, lazy", snapshot(ELoad::Lazy), true},
+        {"cold snapshot, lazy random", snapshot(ELoad::LazyRandom), true},
+        {"cold snapshot, populate", snapshot(ELoad::Populate), true},
+        {"cold snapshot, willneed", snapshot(ELoad::WillNeed), true},
+    };
+
+    std::vector<size_t> actions(1e4);
+    std::vector<size_t> buf(actions.size());
+    std::mt19937_64 rng(2027);
+    for(const TStartupCase& startupCase : cases) {
+        NBench::TOptions options;
+        options.Iterations = 1;
+        options.WarmupTime = {};
+        options.Samples = samples;
+        double constructNs = 0;
+        double queryNs = 0;
+        size_t controlSum = 0;
+        char name[96];
+        std::snprintf(name, sizeof(name), "startup %zu bytes elems, %s", elemSize, startupCase.Name.data());
+        NBench::TStats stats = NBench::RunManual(name, [&](uint64_t) {
+            if (startupCase.Cold) {
+                NSnapshotPool::DropFromPageCache(snapshotPath);
+            }
+            auto started = std::chrono::high_resolution_clock::now();
+            TDataHolder<elemSize> dataHolder(poolSizeMb, startupCase.Source);
+            auto constructed = std::chrono::high_resolution_clock::now();
+            for(auto& x : actions) {
+                x = rng() % dataHolder.ElemsNum;
+            }
+            auto queryStarted = std::chrono::high_resolution_clock::now();
+            controlSum += dataHolder.DoActions(actions, buf);
+            auto finished = std::chrono::high_resolution_clock::now();
+            constructNs += std::chrono::duration<double, std::nano>(constructed - started).count();
+            queryNs += std::chrono::duration<double, std::nano>(finished - queryStarted).count();
+            return NBench::TSample{std::chrono::duration<double, std::nano>((constructed - started) + (finished - queryStarted)).count(), 1};
+        }, options);
+        std::cerr << "conrol sum = " << controlSum << std::endl;
+        stats.AddCounter("construct_ms", constructNs / samples / 1e6).AddCounter("first_query_ms", queryNs / samples / 1e6);
+        reporter.Add(std::move(stats));
+    }
+}
+
+// stream mode: sequential bandwidth of the NStream kernels, the TDataHolder pool is the source of read and copy
+// and b of the triad. Pools below and above the last level cache, the threads are pool workers, each on
+// a contiguous 64 byte aligned chunk. GB/s as STREAM counts the bytes (stream_kernels.hpp)
+
+size_t LlcBytes() {
+    const long res = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    return res > 0 ? res : 32 << 20;
+}
+
+// destination of write, copy and triad: page aligned, touched before the measurement
+struct TStreamArray {
+    explicit TStreamArray(size_t words, double value)
+        : Data(static_cast<double*>(std::aligned_alloc(4096, (words * sizeof(double) + 4095) / 4096 * 4096)), &std::free)
+    {
+        NSnapshotPool::ParallelFill(words, [&](size_t begin, size_t end) {
+            std::fill(Data.get() + begin, Data.get() + end, value);
+        });
+    }
+
+    double* Doubles() {return Data.get();}
+    uint64_t* Words() {return reinterpret_cast<uint64_t*>(Data.get());}
+
+    std::unique_ptr<double, decltype(&std::free)> Data;
+};
+
+// kernel(begin, end) over the words in threadsNum chunks, ns per byte moved
+template<class TKernel>
+void RunStreamKernel(NBench::TReporter& reporter, NWorkStealing::TPool& workers, const std::string& name, size_t threadsNum,
+    size_t words, size_t wordsMovedPerIndex, TKernel&& kernel)
+{
+    NBench::TOptions options;
+    options.ItemsPerIteration = words * wordsMovedPerIndex * sizeof(uint64_t);
+    options.Samples = 10;
+    NBench::TStats stats = NBench::Run(name, [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            workers.ParallelFor(0, threadsNum, 1, [&](size_t t, size_t) {
+                const size_t begin = words * t / threadsNum / 8 * 8;
+                const size_t end = t + 1 == threadsNum ? words : words * (t + 1) / threadsNum / 8 * 8;
+                kernel(begin, end);
+            });
+        }
+    }, options);
+    stats.AddCounter("gb_per_s", 1 / stats.MedianNs).AddCounter("threads", threadsNum);
+    reporter.Add(std::move(stats));
+}
+
+void DoStream(NBench::TReporter& reporter, float poolSizeMb, size_t maxThreads) {
+    TDataHolder<64> dataHolder(poolSizeMb);
+    const size_t words = dataHolder.ElemsNum * 64 / sizeof(uint64_t);
+    const uint64_t* src = reinterpret_cast<const uint64_t*>(dataHolder.EffectiveDataPtr);
+    // the pool bytes as doubles are normal numbers or zeros: no denormal slowdown in the triad
+    const double* b = reinterpret_cast<const double*>(dataHolder.EffectiveDataPtr);
+    TStreamArray a(words, 0);
+    TStreamArray c(words, 1);
+    const std::string size = std::to_string(int(poolSizeMb)) + " mb pool" + (poolSizeMb * 1024 * 1024 < LlcBytes() ? " (below llc)" : " (above llc)");
+
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        NWorkStealing::TPool workers({.Workers = threadsNum});
+        const std::string suffix = ", " + size + ", " + std::to_string(threadsNum) + " threads";
+        for(const NStream::TKernels& kernels : NStream::AvailableKernels()) {
+            const std::string prefix = "stream " + std::string(kernels.Name);
+            if (kernels.Read) {
+                RunStreamKernel(reporter, workers, prefix + " read" + suffix, threadsNum, words, 1, [&](size_t begin, size_t end) {
+                    NBench::DoNotOptimize(kernels.Read(src + begin, end - begin));
+                });
+            }
+            if (kernels.Write) {
+                RunStreamKernel(reporter, workers, prefix + " write" + suffix, threadsNum, words, 1, [&](size_t begin, size_t end) {
+                    kernels.Write(a.Words() + begin, end - begin, 0);
+                });
+            }
+            if (kernels.Copy) {
+                RunStreamKernel(reporter, workers, prefix + " copy" + suffix, threadsNum, words, 2, [&](size_t begin, size_t end) {
+                    kernels.Copy(a.Words() + begin, src + begin, end - begin);
+                });
+            }
+            if (kernels.Triad) {
+                RunStreamKernel(reporter, workers, prefix + " triad" + suffix, threadsNum, words, 3, [&](size_t begin, size_t end) {
+                    kernels.Triad(a.Doubles() + begin, b + begin, c.Doubles() + begin, end - begin, 3.0);
+                });
+            }
+        }
+    }
+}
+
+// args: stream [max threads] [pool mb below llc] [pool mb above llc]
+int RunStream(int argc, const char* argv[]) {
+    const size_t maxThreads = argc > 2 ? atoll(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+    const float smallMb = argc > 3 ? atof(argv[3]) : LlcBytes() / 8 / 1024.0 / 1024;
+    const float largeMb = argc > 4 ? atof(argv[4]) : LlcBytes() * 4 / 1024.0 / 1024;
+    std::cout << "llc " << LlcBytes() / 1024 / 1024 << " mb" << std::endl;
+    NBench::TReporter reporter("mem_random_access_stream");
+    DoStream(reporter, smallMb, maxThreads);
+    DoStream(reporter, largeMb, maxThreads);
+    return 0;
 }
 
 int main(int argc, const char* argv[]) {
+    if (argc >= 2 && std::string_view(argv[1]) == "stream") {
+        return RunStream(argc, argv);
+    }
+
     float poolSizeMb = 128;
 
     if (argc >= 2) {
         poolSizeMb = std::stof(argv[2 - 1]);
     }
+    const std::string snapshotPath = argc >= 3 ? argv[3 - 1] : "pool_" + std::to_string(int(poolSizeMb)) + "mb.snap";
+    const uint32_t startupSamples = argc >= 4 ? atoi(argv[4 - 1]) : 3;
+
+    NBench::TReporter reporter("mem_random_access");
+    ReportClockCost();
+    DoWork<48>(reporter, poolSizeMb);
+    DoWork<64>(reporter, poolSizeMb);
+    DoWork<48>(reporter, poolSizeMb);
+    DoWork<64>(reporter, poolSizeMb);
 
-    DoWork<48>(poolSizeMb);
-    DoWork<64>(poolSizeMb);
-    DoWork<48>(poolSizeMb);
-    DoWork<64>(poolSizeMb);
+    std::cout << std::endl;
+    ReportStartup<64>(reporter, poolSizeMb, snapshotPath, startupSamples);
+    // a file mapping has 4k pages and no transparent huge pages: more tlb misses than the anonymous pool
+    DoWork<64>(reporter, poolSizeMb, TPoolSource{EPoolSource::Snapshot, snapshotPath, {}});
 
     return 0;
 }
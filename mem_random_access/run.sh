@@ -3,8 +3,12 @@ clang++ -std=c++20 mem_random_access.cpp -o exe_mem_random_access -O2 -DNDEBUG
 
 echo "" > report.txt
 
-./exe_mem_random_access 1 | tee -a report.txt
+# args: pool mb, snapshot path (written by the run, reused by the next one), startup samples
+BENCH_JSON=report_1.json ./exe_mem_random_access 1 | tee -a report.txt
 echo "" >> report.txt
-./exe_mem_random_access 128 | tee -a report.txt
+BENCH_JSON=report_128.json ./exe_mem_random_access 128 | tee -a report.txt
+
+# args: stream [max threads] [pool mb below llc] [pool mb above llc]
+BENCH_JSON=report_stream.json ./exe_mem_random_access stream | tee report_stream.txt
 
 cat report.txt
@@ -0,0 +1,276 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// STREAM-like sequential kernels (McCalpin): read (a sum), write (a fill), copy, triad a = b + q * c.
+// Sizes are in 8 byte words, the bytes moved are 1, 1, 2 and 3 words per index, as STREAM counts them:
+// the read for ownership of a normal store's destination line is not counted, so a kernel whose
+// non-temporal stores skip it shows up as faster.
+//
+// A TKernels is one way to do them:
+// - scalar: a word per instruction, KeepScalar stops the compiler from vectorizing or calling memset/memcpy
+// - avx2, avx512: 4 vectors per iteration, unaligned loads and stores (the pool is page aligned anyway)
+// - rep movsb / rep stosb: what memcpy and memset do for large sizes on cpus with ERMS; write and copy only
+// - sse2 stream: _mm_stream non-temporal stores straight to memory and an sfence at the end; no read
+// Kernels are function pointers, nullptr where the variant has no such kernel; the ISA ones are built with
+// target attributes and listed by AvailableKernels only if the cpu has the ISA.
+
+namespace NStream {
+
+struct TKernels {
+    std::string_view Name;
+    uint64_t (*Read)(const uint64_t* src, size_t n);
+    void (*Write)(uint64_t* dst, size_t n, uint64_t value);
+    void (*Copy)(uint64_t* dst, const uint64_t* src, size_t n);
+    void (*Triad)(double* a, const double* b, const double* c, size_t n, double q);
+};
+
+namespace NPrivate {
+
+template<class T>
+inline void KeepScalar(T& x) {
+    asm volatile("" : "+r"(x));
+}
+
+inline void KeepScalar(double& x) {
+    asm volatile("" : "+x"(x));
+}
+
+inline uint64_t ScalarRead(const uint64_t* src, size_t n) {
+    uint64_t sum = 0;
+    for(size_t i = 0; i < n; ++i) {
+        sum += src[i];
+        KeepScalar(sum);
+    }
+    return sum;
+}
+
+inline void ScalarWrite(uint64_t* dst, size_t n, uint64_t value) {
+    for(size_t i = 0; i < n; ++i) {
+        KeepScalar(value);
+        dst[i] = value;
+    }
+}
+
+inline void ScalarCopy(uint64_t* dst, const uint64_t* src, size_t n) {
+    for(size_t i = 0; i < n; ++i) {
+        uint64_t x = src[i];
+        KeepScalar(x);
+        dst[i] = x;
+    }
+}
+
+inline void ScalarTriad(double* a, const double* b, const double* c, size_t n, double q) {
+    for(size_t i = 0; i < n; ++i) {
+        double x = b[i] + q * c[i];
+        KeepScalar(x);
+        a[i] = x;
+    }
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2")))
+inline uint64_t Avx2Read(const uint64_t* src, size_t n) {
+    __m256i sum0 = _mm256_setzero_si256();
+    __m256i sum1 = _mm256_setzero_si256();
+    __m256i sum2 = _mm256_setzero_si256();
+    __m256i sum3 = _mm256_setzero_si256();
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        sum0 = _mm256_add_epi64(sum0, _mm256_loadu_si256((const __m256i*)(src + i)));
+        sum1 = _mm256_add_epi64(sum1, _mm256_loadu_si256((const __m256i*)(src + i + 4)));
+        sum2 = _mm256_add_epi64(sum2, _mm256_loadu_si256((const __m256i*)(src + i + 8)));
+        sum3 = _mm256_add_epi64(sum3, _mm256_loadu_si256((const __m256i*)(src + i + 12)));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256((__m256i*)lanes, _mm256_add_epi64(_mm256_add_epi64(sum0, sum1), _mm256_add_epi64(sum2, sum3)));
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + ScalarRead(src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline void Avx2Write(uint64_t* dst, size_t n, uint64_t value) {
+    const __m256i v = _mm256_set1_epi64x(value);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        _mm256_storeu_si256((__m256i*)(dst + i), v);
+        _mm256_storeu_si256((__m256i*)(dst + i + 4), v);
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), v);
+        _mm256_storeu_si256((__m256i*)(dst + i + 12), v);
+    }
+    ScalarWrite(dst + i, n - i, value);
+}
+
+__attribute__((target("avx2")))
+inline void Avx2Copy(uint64_t* dst, const uint64_t* src, size_t n) {
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        const __m256i x0 = _mm256_loadu_si256((const __m256i*)(src + i));
+        const __m256i x1 = _mm256_loadu_si256((const __m256i*)(src + i + 4));
+        const __m256i x2 = _mm256_loadu_si256((const __m256i*)(src + i + 8));
+        const __m256i x3 = _mm256_loadu_si256((const __m256i*)(src + i + 12));
+        _mm256_storeu_si256((__m256i*)(dst + i), x0);
+        _mm256_storeu_si256((__m256i*)(dst + i + 4), x1);
+        _mm256_storeu_si256((__m256i*)(dst + i + 8), x2);
+        _mm256_storeu_si256((__m256i*)(dst + i + 12), x3);
+    }
+    ScalarCopy(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx2")))
+inline void Avx2Triad(double* a, const double* b, const double* c, size_t n, double q) {
+    const __m256d vq = _mm256_set1_pd(q);
+    size_t i = 0;
+    for(; i + 16 <= n; i += 16) {
+        for(size_t j = 0; j < 16; j += 4) {
+            _mm256_storeu_pd(a + i + j, _mm256_add_pd(_mm256_loadu_pd(b + i + j), _mm256_mul_pd(vq, _mm256_loadu_pd(c + i + j))));
+        }
+    }
+    ScalarTriad(a + i, b + i, c + i, n - i, q);
+}
+
+__attribute__((target("avx512f")))
+inline uint64_t Avx512Read(const uint64_t* src, size_t n) {
+    __m512i sum0 = _mm512_setzero_si512();
+    __m512i sum1 = _mm512_setzero_si512();
+    __m512i sum2 = _mm512_setzero_si512();
+    __m512i sum3 = _mm512_setzero_si512();
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        sum0 = _mm512_add_epi64(sum0, _mm512_loadu_si512(src + i));
+        sum1 = _mm512_add_epi64(sum1, _mm512_loadu_si512(src + i + 8));
+        sum2 = _mm512_add_epi64(sum2, _mm512_loadu_si512(src + i + 16));
+        sum3 = _mm512_add_epi64(sum3, _mm512_loadu_si512(src + i + 24));
+    }
+    alignas(64) uint64_t lanes[8];
+    _mm512_store_si512(lanes, _mm512_add_epi64(_mm512_add_epi64(sum0, sum1), _mm512_add_epi64(sum2, sum3)));
+    uint64_t sum = 0;
+    for(uint64_t lane : lanes) {
+        sum += lane;
+    }
+    return sum + ScalarRead(src + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+inline void Avx512Write(uint64_t* dst, size_t n, uint64_t value) {
+    const __m512i v = _mm512_set1_epi64(value);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        _mm512_storeu_si512(dst + i, v);
+        _mm512_storeu_si512(dst + i + 8, v);
+        _mm512_storeu_si512(dst + i + 16, v);
+        _mm512_storeu_si512(dst + i + 24, v);
+    }
+    ScalarWrite(dst + i, n - i, value);
+}
+
+__attribute__((target("avx512f")))
+inline void Avx512Copy(uint64_t* dst, const uint64_t* src, size_t n) {
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        const __m512i x0 = _mm512_loadu_si512(src + i);
+        const __m512i x1 = _mm512_loadu_si512(src + i + 8);
+        const __m512i x2 = _mm512_loadu_si512(src + i + 16);
+        const __m512i x3 = _mm512_loadu_si512(src + i + 24);
+        _mm512_storeu_si512(dst + i, x0);
+        _mm512_storeu_si512(dst + i + 8, x1);
+        _mm512_storeu_si512(dst + i + 16, x2);
+        _mm512_storeu_si512(dst + i + 24, x3);
+    }
+    ScalarCopy(dst + i, src + i, n - i);
+}
+
+__attribute__((target("avx512f")))
+inline void Avx512Triad(double* a, const double* b, const double* c, size_t n, double q) {
+    const __m512d vq = _mm512_set1_pd(q);
+    size_t i = 0;
+    for(; i + 32 <= n; i += 32) {
+        for(size_t j = 0; j < 32; j += 8) {
+            _mm512_storeu_pd(a + i + j, _mm512_add_pd(_mm512_loadu_pd(b + i + j), _mm512_mul_pd(vq, _mm512_loadu_pd(c + i + j))));
+        }
+    }
+    ScalarTriad(a + i, b + i, c + i, n - i, q);
+}
+
+inline void RepStosbWrite(uint64_t* dst, size_t n, uint64_t value) {
+    // a byte pattern: stosb repeats al
+    size_t bytes = n * sizeof(uint64_t);
+    asm volatile("rep stosb" : "+D"(dst), "+c"(bytes) : "a"(uint8_t(value)) : "memory");
+}
+
+inline void RepMovsbCopy(uint64_t* dst, const uint64_t* src, size_t n) {
+    size_t bytes = n * sizeof(uint64_t);
+    asm volatile("rep movsb" : "+D"(dst), "+S"(src), "+c"(bytes) : : "memory");
+}
+
+// 16 byte aligned destinations: the pool and the chunks of it are
+inline void StreamWrite(uint64_t* dst, size_t n, uint64_t value) {
+    const __m128i v = _mm_set1_epi64x(value);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        _mm_stream_si128((__m128i*)(dst + i), v);
+        _mm_stream_si128((__m128i*)(dst + i + 2), v);
+        _mm_stream_si128((__m128i*)(dst + i + 4), v);
+        _mm_stream_si128((__m128i*)(dst + i + 6), v);
+    }
+    _mm_sfence();
+    ScalarWrite(dst + i, n - i, value);
+}
+
+inline void StreamCopy(uint64_t* dst, const uint64_t* src, size_t n) {
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        const __m128i x0 = _mm_loadu_si128((const __m128i*)(src + i));
+        const __m128i x1 = _mm_loadu_si128((const __m128i*)(src + i + 2));
+        const __m128i x2 = _mm_loadu_si128((const __m128i*)(src + i + 4));
+        const __m128i x3 = _mm_loadu_si128((const __m128i*)(src + i + 6));
+        _mm_stream_si128((__m128i*)(dst + i), x0);
+        _mm_stream_si128((__m128i*)(dst + i + 2), x1);
+        _mm_stream_si128((__m128i*)(dst + i + 4), x2);
+        _mm_stream_si128((__m128i*)(dst + i + 6), x3);
+    }
+    _mm_sfence();
+    ScalarCopy(dst + i, src + i, n - i);
+}
+
+inline void StreamTriad(double* a, const double* b, const double* c, size_t n, double q) {
+    const __m128d vq = _mm_set1_pd(q);
+    size_t i = 0;
+    for(; i + 8 <= n; i += 8) {
+        for(size_t j = 0; j < 8; j += 2) {
+            _mm_stream_pd(a + i + j, _mm_add_pd(_mm_loadu_pd(b + i + j), _mm_mul_pd(vq, _mm_loadu_pd(c + i + j))));
+        }
+    }
+    _mm_sfence();
+    ScalarTriad(a + i, b + i, c + i, n - i, q);
+}
+
+#endif
+
+}
+
+inline std::vector<TKernels> AvailableKernels() {
+    using namespace NPrivate;
+    std::vector<TKernels> res = {{"scalar", &ScalarRead, &ScalarWrite, &ScalarCopy, &ScalarTriad}};
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        res.push_back({"avx2", &Avx2Read, &Avx2Write, &Avx2Copy, &Avx2Triad});
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        res.push_back({"avx512", &Avx512Read, &Avx512Write, &Avx512Copy, &Avx512Triad});
+    }
+    res.push_back({"rep movsb", nullptr, &RepStosbWrite, &RepMovsbCopy, nullptr});
+    res.push_back({"sse2 stream", nullptr, &StreamWrite, &StreamCopy, &StreamTriad});
+#endif
+    return res;
+}
+
+}
@@ -1,7 +1,15 @@
+#include "../bench/bench.hpp"
+#include "../work_stealing/work_stealing.hpp"
+
 #include <atomic>
+#include <chrono>
 #include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <iostream>
+#include <vector>
 
 void write(std::atomic<int64_t>& x, int64_t v) {
     x.store(v, std::memory_order_seq_cst);
@@ -10,19 +18,21 @@ int64_t read(std::atomic<int64_t>& x) {
     return x.load(std::memory_order_seq_cst);
 }
 
+// two writers and a reader at once: a worker each
 void test(std::atomic<int64_t>& x) {
     constexpr size_t ITERS = 100'000'000;
-    std::thread writePart1([&x]() {
-        for(size_t i = 0; i < ITERS; ++i) {
-            write(x, -1);
-        }
-    });
-    std::thread writePart2([&x]() {
-        for(size_t i = 0; i < ITERS; ++i) {
-            write(x, 2);
-        }
-    });
-    std::thread reader([&x]() {
+    NWorkStealing::TPool workers({.Workers = 3});
+    workers.Join([&]() {
+        workers.Join([&x]() {
+            for(size_t i = 0; i < ITERS; ++i) {
+                write(x, -1);
+            }
+        }, [&x]() {
+            for(size_t i = 0; i < ITERS; ++i) {
+                write(x, 2);
+            }
+        });
+    }, [&x]() {
         for(size_t i = 0; i < ITERS; ++i) {
             int64_t r = read(x);
             if ((r & 1) == 0 && r < 0) {
@@ -32,13 +42,149 @@ void test(std::atomic<int64_t>& x) {
             }
         }
     });
-    writePart1.join();
-    writePart2.join();
-    reader.join();
     std::cout << "finish, not found non atomic behaviour" << std::endl;
 }
 
-int main(int argc, const char* _ []) {
+// benchmark mode: cost of split atomics for the thread doing them and for everybody else on the socket
+
+constexpr size_t PageSize = 4096;
+constexpr size_t CacheLineSize = 64;
+
+struct TPlacement {
+    std::string_view Name;
+    size_t Offset; // offset of the atomic from a page start
+};
+
+constexpr TPlacement Placements[] = {
+    {"aligned", 0},
+    {"cacheline split", CacheLineSize - 4},
+    {"page split", PageSize - 4},
+};
+
+std::atomic<int64_t>* PlaceAtomic(char* pageAlignedBuf, const TPlacement& placement) {
+    return new((void*)(pageAlignedBuf + placement.Offset)) std::atomic<int64_t>(0);
+}
+
+// a split lock may be trapped (and throttled) by the kernel with bus lock detection enabled:
+// calibrated samples keep a phase about Samples * MinSampleTime long whatever the op costs
+void BenchOps(NBench::TReporter& reporter, char* pageAlignedBuf) {
+    std::cout << "single thread cost" << std::endl;
+    for(const TPlacement& placement : Placements) {
+        std::atomic<int64_t>& x = *PlaceAtomic(pageAlignedBuf, placement);
+        const std::string prefix = std::string(placement.Name) + " (offset " + std::to_string(placement.Offset) + ")";
+        reporter.Add(NBench::Run(prefix + " store", [&](uint64_t iters) {
+            for(uint64_t i = 0; i < iters; ++i) {
+                x.store(i, std::memory_order_seq_cst);
+            }
+        }));
+        reporter.Add(NBench::Run(prefix + " load", [&](uint64_t iters) {
+            int64_t accum = 0;
+            for(uint64_t i = 0; i < iters; ++i) {
+                accum += x.load(std::memory_order_seq_cst);
+            }
+            NBench::DoNotOptimize(accum);
+        }));
+        reporter.Add(NBench::Run(prefix + " fetch_add", [&](uint64_t iters) {
+            for(uint64_t i = 0; i < iters; ++i) {
+                x.fetch_add(1, std::memory_order_seq_cst);
+            }
+        }));
+        reporter.Add(NBench::Run(prefix + " cas", [&](uint64_t iters) {
+            for(uint64_t i = 0; i < iters; ++i) {
+                int64_t expected = x.load(std::memory_order_relaxed);
+                x.compare_exchange_strong(expected, i, std::memory_order_seq_cst);
+            }
+        }));
+    }
+}
+
+volatile int64_t Sink = 0;
+
+// unrelated threads stream over their own private buffers; we measure how much of their bandwidth survives
+// while one more thread hammers fetch_add on an atomic with the given placement.
+// The threads are pool workers, one more sleeps for the phase: the pool has victimBufs.size() + 2 of them.
+// The buffers are allocated by the caller once: the page faults of 64mb buffers are not in any sample.
+// The sample is the phase time and the bytes streamed by all victims
+NBench::TSample MeasureVictimsBandwidth(NWorkStealing::TPool& workers, std::vector<std::vector<int64_t>>& victimBufs, std::chrono::milliseconds duration, std::atomic<int64_t>* hammered) {
+    const size_t victimsNum = victimBufs.size();
+    std::atomic<bool> stop = false;
+    std::atomic<size_t> bytesDone = 0;
+    auto started = std::chrono::high_resolution_clock::now();
+    workers.ParallelFor(0, victimsNum + 2, 1, [&](size_t task, size_t) {
+        if (task == victimsNum) {
+            std::this_thread::sleep_for(duration);
+            stop = true;
+        } else if (task == victimsNum + 1) {
+            while(hammered && !stop.load(std::memory_order_relaxed)) {
+                for(size_t i = 0; i < 16; ++i) {
+                    hammered->fetch_add(1, std::memory_order_seq_cst);
+                }
+            }
+        } else {
+            std::vector<int64_t>& buf = victimBufs[task];
+            size_t localBytes = 0;
+            int64_t accum = 0;
+            while(!stop.load(std::memory_order_relaxed)) {
+                for(size_t i = 0; i < buf.size(); i += CacheLineSize / sizeof(int64_t)) {
+                    accum += buf[i];
+                    buf[i] = accum;
+                }
+                localBytes += buf.size() * sizeof(int64_t);
+            }
+            Sink = accum;
+            bytesDone += localBytes;
+        }
+    });
+    auto finished = std::chrono::high_resolution_clock::now();
+    return NBench::TSample{std::chrono::duration<double, std::nano>(finished - started).count(), double(bytesDone)};
+}
+
+void BenchCollateral(NBench::TReporter& reporter, char* pageAlignedBuf, size_t victimsNum, std::chrono::milliseconds duration) {
+    constexpr size_t VictimBufMb = 64;
+    std::cout << "collateral slowdown, " << victimsNum << " victim threads streaming over own " << VictimBufMb << "mb buffers, ns per byte" << std::endl;
+    // a sample is a phase of the pool workers
+    NWorkStealing::TPool workers({.Workers = victimsNum + 2});
+    std::vector<std::vector<int64_t>> victimBufs(victimsNum, std::vector<int64_t>(VictimBufMb * 1024 * 1024 / sizeof(int64_t), 1));
+    NBench::TOptions options;
+    options.Iterations = 1;
+    options.WarmupTime = {};
+    options.Samples = 5;
+    auto measure = [&](const std::string& name, std::atomic<int64_t>* hammered) {
+        return NBench::RunManual(name, [&](uint64_t) {
+            return MeasureVictimsBandwidth(workers, victimBufs, duration, hammered);
+        }, options);
+    };
+    NBench::TStats baseline = measure("no hammer", nullptr);
+    baseline.AddCounter("victims_gbps", 1 / baseline.MedianNs);
+    const double baselineNs = baseline.MedianNs;
+    reporter.Add(std::move(baseline));
+    for(const TPlacement& placement : Placements) {
+        std::atomic<int64_t>* x = PlaceAtomic(pageAlignedBuf, placement);
+        NBench::TStats withHammer = measure("fetch_add hammer on " + std::string(placement.Name), x);
+        withHammer.AddCounter("victims_gbps", 1 / withHammer.MedianNs)
+            .AddCounter("percent_of_no_hammer", baselineNs / withHammer.MedianNs * 100);
+        reporter.Add(std::move(withHammer));
+    }
+}
+
+int RunBench(int argc, const char* argv[]) {
+    size_t victimsNum = argc > 2 ? atoll(argv[2]) : std::max(2u, std::thread::hardware_concurrency()) - 1;
+    std::chrono::milliseconds duration(argc > 3 ? atoll(argv[3]) : 1000);
+
+    char* buf = (char*)std::aligned_alloc(PageSize, PageSize * 2);
+    std::memset(buf, 0, PageSize * 2);
+    NBench::TReporter reporter("non_atomic_atomic");
+    BenchOps(reporter, buf);
+    BenchCollateral(reporter, buf, victimsNum, duration);
+    std::free(buf);
+    return 0;
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc >= 2 && std::string_view(argv[1]) == "bench") {
+        return RunBench(argc, argv);
+    }
+
     constexpr size_t alignment = 4096;
     char* buf [alignment * 3];
     size_t ptr = size_t(buf) / alignment * alignment + alignment - 4;
@@ -2,3 +2,5 @@ set -x -e
 clang++ -std=c++23 main.cpp -o nonatomic.exe -Wall -O2 -DNDEBUG 
 ./nonatomic.exe
 ./nonatomic.exe "aligned"
+# args: bench [victim threads] [collateral phase, ms]
+BENCH_JSON=report_bench.json ./nonatomic.exe bench | tee report_bench.txt
@@ -0,0 +1,86 @@
+#include "queue_sim.hpp"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <thread>
+
+using namespace NQueueSim;
+
+// the numbers of math_posts/queue_rejects.md: ~130 rps, 5 pods, service 7..60 ms with 22 ms on average
+constexpr double Rps = 130;
+constexpr uint32_t PodsNum = 5;
+// 7 + exponential(15) cut at 60 has the mean of 21.6 ms
+const TShiftedExponentialService PostService{7, 15, 60};
+
+struct TRunConfig {
+    uint64_t RequestsPerConfig = 100'000'000;
+    size_t ReplicasNum = 32;
+    size_t ThreadsNum = std::max(1u, std::thread::hardware_concurrency());
+};
+
+template<class TBalancer, class TQueue = TBinaryHeap, class TService = TShiftedExponentialService>
+void Report(const TRunConfig& run, uint32_t limit, TBalancer balancer, TQueue queue = {}, TService service = PostService) {
+    const TPoolConfig pool{PodsNum, limit};
+    const uint64_t perReplica = run.RequestsPerConfig / run.ReplicasNum;
+    auto started = std::chrono::high_resolution_clock::now();
+    const TReplicasStats stats = RunReplicas(run.ReplicasNum, run.ThreadsNum, [&](uint64_t seed) {
+        return Simulate(pool, queue, TPoissonArrivals{Rps}, service, balancer, perReplica, seed);
+    });
+    auto finished = std::chrono::high_resolution_clock::now();
+    const double seconds = std::chrono::duration<double>(finished - started).count();
+
+    std::cout << "inflight " << limit << ", " << std::setw(28) << balancer.Name() << ", " << std::setw(14) << TQueue::Name << ", " << std::setw(19) << TService::Name
+        << ": rejects " << std::scientific << std::setprecision(3) << stats.RejectRate << " +- " << std::setprecision(1) << stats.RejectRateCi95
+        << " (" << std::fixed << std::setprecision(3) << stats.RejectRate * Rps << " rps)"
+        << ", mean inflight " << std::setprecision(2) << stats.MeanInflight
+        << ", " << std::setprecision(1) << stats.Requests / seconds / 1e6 << "M requests/s" << std::endl;
+}
+
+void ReportAnalytic(uint32_t limit) {
+    // the mean of the simulated service time, by a long enough sample
+    TRng rng(1);
+    double sum = 0;
+    constexpr size_t samples = 10'000'000;
+    for(size_t i = 0; i < samples; ++i) {
+        sum += PostService.Next(rng);
+    }
+    const double load = Rps * sum / samples / 1000;
+    std::cout << "inflight " << limit << ", offered load " << std::setprecision(3) << load
+        << ": post's poisson estimate P(N >= " << PodsNum * limit << ") = " << std::scientific << PoissonTail(PodsNum * limit, load)
+        << ", erlang B = " << ErlangB(PodsNum * limit, load) << std::fixed << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    TRunConfig run;
+    if (argc > 1) {
+        run.RequestsPerConfig = atoll(argv[1]);
+    }
+    if (argc > 2) {
+        run.ThreadsNum = atoll(argv[2]);
+    }
+    std::cout << Rps << " rps, " << PodsNum << " pods, " << run.RequestsPerConfig << " requests per config in "
+        << run.ReplicasNum << " replicas on " << run.ThreadsNum << " threads" << std::endl;
+
+    // the config change of the incident and the values around it
+    for(uint32_t limit : {5, 4, 3, 2}) {
+        std::cout << std::endl;
+        ReportAnalytic(limit);
+        Report(run, limit, TRoundRobin{1});
+        Report(run, limit, TRoundRobin{PodsNum});
+        Report(run, limit, TRandomChoice{1});
+        Report(run, limit, TRandomChoice{3});
+        Report(run, limit, TPowerOfTwoChoices{});
+        Report(run, limit, TFullScan{});
+    }
+
+    // the queue holds at most PodsNum * limit events here, too few for the calendar queue to win;
+    // the loss rate of the full scan depends only on the mean service time (erlang B)
+    std::cout << "\nevent queues, service distributions" << std::endl;
+    Report(run, 2, TFullScan{}, TCalendarQueue{1, 64});
+    // all with the same mean of 21.6 ms
+    Report(run, 2, TFullScan{}, TBinaryHeap{}, TExponentialService{21.6});
+    Report(run, 2, TFullScan{}, TBinaryHeap{}, TLogNormalService{18.04, 0.6});
+    Report(run, 2, TFullScan{}, TBinaryHeap{}, TConstantService{21.6});
+    return 0;
+}
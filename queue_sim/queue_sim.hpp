@@ -0,0 +1,412 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Discrete event simulation of a pool of pods with an inflight limit behind a client side balancer,
+// the model of math_posts/queue_rejects.md: requests arrive, the balancer picks a pod with a free slot
+// or rejects the request (a scheduling error), the pod frees the slot after the service time.
+//
+// Everything is a template parameter, so the hot loop has no virtual calls:
+// - TQueue: pending completions, TBinaryHeap or TCalendarQueue
+// - TArrivals: `double NextGap(TRng&)`, ms between requests
+// - TService: `double Next(TRng&)`, ms of service
+// - TBalancer: `int Choose(const std::vector<uint32_t>& inflight, uint32_t limit, TRng&)`, pod or -1
+// Time is in milliseconds.
+
+namespace NQueueSim {
+
+// xoshiro256+, seeded by splitmix64: std::mt19937_64 would be a third of the time per request
+class TRng {
+public:
+    explicit TRng(uint64_t seed) {
+        for(auto& s : State) {
+            seed += 0x9e3779b97f4a7c15ULL;
+            uint64_t z = seed;
+            z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+            s = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t operator()() {
+        const uint64_t result = State[0] + State[3];
+        const uint64_t t = State[1] << 17;
+        State[2] ^= State[0];
+        State[3] ^= State[1];
+        State[1] ^= State[2];
+        State[0] ^= State[3];
+        State[2] ^= t;
+        State[3] = (State[3] << 45) | (State[3] >> 19);
+        return result;
+    }
+
+    // (0, 1]: safe for log
+    double Uniform() {
+        return ((*this)() >> 11) * 0x1.0p-53 + 0x1.0p-54;
+    }
+
+    double Exponential(double mean) {
+        return -std::log(Uniform()) * mean;
+    }
+
+    uint32_t Below(uint32_t n) {
+        return uint32_t((((*this)() >> 32) * n) >> 32);
+    }
+
+private:
+    uint64_t State[4];
+};
+
+struct TEvent {
+    double Time;
+    uint32_t Pod;
+};
+
+class TBinaryHeap {
+public:
+    static constexpr std::string_view Name = "binary heap";
+
+    bool Empty() const {return Events.empty();}
+    const TEvent& Top() const {return Events.front();}
+
+    void Push(TEvent event) {
+        Events.push_back(event);
+        std::push_heap(Events.begin(), Events.end(), Later);
+    }
+    void Pop() {
+        std::pop_heap(Events.begin(), Events.end(), Later);
+        Events.pop_back();
+    }
+
+private:
+    static bool Later(const TEvent& a, const TEvent& b) {return a.Time > b.Time;}
+
+    std::vector<TEvent> Events;
+};
+
+// calendar queue (R. Brown, 1988): a ring of buckets ("days") of Width ms each; an event goes to the bucket
+// of its time modulo the ring ("year"). The minimum is searched from the current day on,
+// so with a width about the gap between events push and pop are O(1) at any queue size.
+// Buckets are kept sorted with the earliest event at the back
+class TCalendarQueue {
+public:
+    static constexpr std::string_view Name = "calendar queue";
+
+    explicit TCalendarQueue(double width = 1, size_t bucketsNum = 128)
+        : Width(width)
+        , Buckets(bucketsNum)
+    {}
+
+    bool Empty() const {return Size == 0;}
+
+    const TEvent& Top() {
+        FindMin();
+        return Buckets[CurrentDay % Buckets.size()].back();
+    }
+
+    void Push(TEvent event) {
+        const uint64_t day = DayOf(event.Time);
+        auto& bucket = Buckets[day % Buckets.size()];
+        auto it = bucket.begin();
+        while(it != bucket.end() && it->Time > event.Time) {
+            ++it;
+        }
+        bucket.insert(it, event);
+        // the current day may have been moved past `now` to the earliest pending event
+        if (Size == 0 || day < CurrentDay) {
+            CurrentDay = day;
+        }
+        ++Size;
+    }
+
+    void Pop() {
+        FindMin();
+        Buckets[CurrentDay % Buckets.size()].pop_back();
+        --Size;
+    }
+
+private:
+    // days are integers, so the day of an event and the current day never disagree by rounding
+    uint64_t DayOf(double time) const {
+        return uint64_t(time / Width);
+    }
+
+    // moves CurrentDay to the day of the earliest event; days before CurrentDay are empty
+    void FindMin() {
+        assert(Size);
+        for(size_t i = 0; i < Buckets.size(); ++i) {
+            const auto& bucket = Buckets[CurrentDay % Buckets.size()];
+            if (!bucket.empty() && DayOf(bucket.back().Time) == CurrentDay) {
+                return;
+            }
+            ++CurrentDay;
+        }
+        // a sparse year: jump straight to the earliest event
+        double minTime = INFINITY;
+        for(const auto& bucket : Buckets) {
+            if (!bucket.empty()) {
+                minTime = std::min(minTime, bucket.back().Time);
+            }
+        }
+        CurrentDay = DayOf(minTime);
+    }
+
+    double Width;
+    std::vector<std::vector<TEvent>> Buckets;
+    size_t Size = 0;
+    uint64_t CurrentDay = 0;
+};
+
+struct TPoissonArrivals {
+    double Rps;
+
+    double NextGap(TRng& rng) const {return rng.Exponential(1000 / Rps);}
+};
+
+// two poisson phases switching after exponential periods: traffic with bursts of the same mean rate
+struct TBurstyArrivals {
+    double LowRps;
+    double HighRps;
+    double MeanPhaseMs;
+    bool High = false;
+    double PhaseLeft = 0;
+
+    double NextGap(TRng& rng) {
+        double gap = 0;
+        while(true) {
+            const double candidate = rng.Exponential(1000 / (High ? HighRps : LowRps));
+            if (candidate < PhaseLeft) {
+                PhaseLeft -= candidate;
+                return gap + candidate;
+            }
+            // memoryless: drop the candidate and continue in the other phase
+            gap += PhaseLeft;
+            High = !High;
+            PhaseLeft = rng.Exponential(MeanPhaseMs);
+        }
+    }
+};
+
+struct TConstantService {
+    static constexpr std::string_view Name = "constant";
+
+    double Ms;
+
+    double Next(TRng&) const {return Ms;}
+};
+
+struct TExponentialService {
+    static constexpr std::string_view Name = "exponential";
+
+    double MeanMs;
+
+    double Next(TRng& rng) const {return rng.Exponential(MeanMs);}
+};
+
+// Min + exponential tail, cut at Max: "from 7 to 60 ms, 22 on average" of the post
+struct TShiftedExponentialService {
+    static constexpr std::string_view Name = "shifted exponential";
+
+    double MinMs;
+    double TailMeanMs;
+    double MaxMs;
+
+    double Next(TRng& rng) const {return std::min(MinMs + rng.Exponential(TailMeanMs), MaxMs);}
+};
+
+struct TLogNormalService {
+    static constexpr std::string_view Name = "lognormal";
+
+    double MedianMs;
+    double Sigma;
+
+    double Next(TRng& rng) const {
+        // Box-Muller, one of the pair is enough here
+        const double normal = std::sqrt(-2 * std::log(rng.Uniform())) * std::cos(2 * M_PI * rng.Uniform());
+        return MedianMs * std::exp(Sigma * normal);
+    }
+};
+
+// next pod after the previous choice, up to Attempts pods
+struct TRoundRobin {
+    uint32_t Attempts = 1;
+    uint32_t Next = 0;
+
+    std::string Name() const {return "round robin, " + std::to_string(Attempts) + " attempts";}
+
+    int Choose(const std::vector<uint32_t>& inflight, uint32_t limit, TRng&) {
+        for(uint32_t attempt = 0; attempt < Attempts; ++attempt) {
+            const uint32_t pod = Next;
+            Next = Next + 1 == inflight.size() ? 0 : Next + 1;
+            if (inflight[pod] < limit) {
+                return pod;
+            }
+        }
+        return -1;
+    }
+};
+
+// independent random pods, up to Attempts
+struct TRandomChoice {
+    uint32_t Attempts = 1;
+
+    std::string Name() const {return "random, " + std::to_string(Attempts) + " attempts";}
+
+    int Choose(const std::vector<uint32_t>& inflight, uint32_t limit, TRng& rng) const {
+        for(uint32_t attempt = 0; attempt < Attempts; ++attempt) {
+            const uint32_t pod = rng.Below(inflight.size());
+            if (inflight[pod] < limit) {
+                return pod;
+            }
+        }
+        return -1;
+    }
+};
+
+// the less loaded of two distinct random pods
+struct TPowerOfTwoChoices {
+    std::string Name() const {return "power of two choices";}
+
+    int Choose(const std::vector<uint32_t>& inflight, uint32_t limit, TRng& rng) const {
+        const uint32_t first = rng.Below(inflight.size());
+        // a single pod is its own second choice, as in NInflightBalancer::TryPickImpl
+        const uint32_t candidates = inflight.size();
+        uint32_t second = candidates > 1 ? rng.Below(candidates - 1) : first;
+        second += candidates > 1 && second >= first;
+        const uint32_t pod = inflight[second] < inflight[first] ? second : first;
+        return inflight[pod] < limit ? pod : -1;
+    }
+};
+
+// the least loaded pod: rejects only when every pod is full, the M/G/c/c loss system
+struct TFullScan {
+    std::string Name() const {return "full scan";}
+
+    int Choose(const std::vector<uint32_t>& inflight, uint32_t limit, TRng&) const {
+        const auto it = std::min_element(inflight.begin(), inflight.end());
+        return *it < limit ? it - inflight.begin() : -1;
+    }
+};
+
+struct TPoolConfig {
+    uint32_t PodsNum = 5;
+    uint32_t InflightLimit = 2;
+};
+
+struct TSimStats {
+    uint64_t Requests = 0;
+    uint64_t Rejected = 0;
+    // inflight over all pods at arrivals, to compare with the poisson estimate of the post
+    double InflightSum = 0;
+
+    double RejectRate() const {return Requests ? double(Rejected) / Requests : 0;}
+    double MeanInflight() const {return Requests ? InflightSum / Requests : 0;}
+};
+
+template<class TQueue, class TArrivals, class TService, class TBalancer>
+TSimStats Simulate(TPoolConfig config, TQueue queue, TArrivals arrivals, TService service, TBalancer balancer,
+    uint64_t requests, uint64_t seed)
+{
+    TRng rng(seed);
+    std::vector<uint32_t> inflight(config.PodsNum, 0);
+    uint32_t totalInflight = 0;
+    TSimStats stats;
+    double now = 0;
+    for(uint64_t i = 0; i < requests; ++i) {
+        now += arrivals.NextGap(rng);
+        // completions are the only queued events: the next arrival is always known
+        while(!queue.Empty() && queue.Top().Time <= now) {
+            --inflight[queue.Top().Pod];
+            --totalInflight;
+            queue.Pop();
+        }
+        stats.InflightSum += totalInflight;
+        const int pod = balancer.Choose(inflight, config.InflightLimit, rng);
+        if (pod < 0) {
+            ++stats.Rejected;
+            continue;
+        }
+        ++inflight[pod];
+        ++totalInflight;
+        queue.Push(TEvent{now + service.Next(rng), uint32_t(pod)});
+    }
+    stats.Requests = requests;
+    return stats;
+}
+
+struct TReplicasStats {
+    double RejectRate = 0;
+    // of the mean over replicas, normal approximation
+    double RejectRateCi95 = 0;
+    double MeanInflight = 0;
+    uint64_t Requests = 0;
+};
+
+// independent replicas with different seeds, spread over threadsNum threads.
+// runReplica(seed) -> TSimStats; every replica is long enough for its own warmup to not matter
+template<class TRunReplica>
+TReplicasStats RunReplicas(size_t replicasNum, size_t threadsNum, TRunReplica&& runReplica) {
+    std::vector<TSimStats> results(replicasNum);
+    std::atomic<size_t> next = 0;
+    auto worker = [&]() {
+        for(size_t i = next++; i < replicasNum; i = next++) {
+            results[i] = runReplica(0x5eed + i * 7919);
+        }
+    };
+    std::vector<std::thread> threads;
+    for(size_t t = 1; t < std::min(threadsNum, replicasNum); ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for(auto& t : threads) {
+        t.join();
+    }
+
+    TReplicasStats stats;
+    double sum = 0;
+    double sumSquares = 0;
+    for(const auto& r : results) {
+        sum += r.RejectRate();
+        sumSquares += r.RejectRate() * r.RejectRate();
+        stats.MeanInflight += r.MeanInflight() / replicasNum;
+        stats.Requests += r.Requests;
+    }
+    stats.RejectRate = sum / replicasNum;
+    if (replicasNum > 1) {
+        const double variance = std::max(0.0, (sumSquares - sum * sum / replicasNum) / (replicasNum - 1));
+        stats.RejectRateCi95 = 1.96 * std::sqrt(variance / replicasNum);
+    }
+    return stats;
+}
+
+// Erlang B: loss probability of M/G/c/c with offered load `load` = rps * mean service,
+// does not depend on the service time distribution; exact for TFullScan with poisson arrivals
+inline double ErlangB(uint32_t servers, double load) {
+    double b = 1;
+    for(uint32_t c = 1; c <= servers; ++c) {
+        b = load * b / (c + load * b);
+    }
+    return b;
+}
+
+// the estimate of the post: P(N >= servers) for N ~ Poisson(load)
+inline double PoissonTail(uint32_t servers, double load) {
+    double term = std::exp(-load);
+    double below = 0;
+    for(uint32_t i = 0; i < servers; ++i) {
+        below += term;
+        term = term * load / (i + 1);
+    }
+    return std::max(0.0, 1 - below);
+}
+
+}
@@ -0,0 +1,3 @@
+set -x -e
+clang++ -std=c++20 queue_sim.cpp -o queue_sim.exe -Wall -O2 -DNDEBUG
+./queue_sim.exe | tee report.txt
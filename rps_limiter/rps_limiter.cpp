@@ -0,0 +1,228 @@
+#include "rps_limiter.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace NRpsLimiter;
+
+constexpr uint64_t Second = 1'000'000'000;
+
+// E[max(0, N - limit)] for N ~ Poisson(lambda): rejects per window of an ideal fixed window limiter.
+// The notebook computes (E[N | N >= limit + 1] - (limit + 1)) * P(N >= limit + 1), which is E[max(0, N - limit - 1)]
+double ExpectedFixedWindowRejects(double lambda, uint64_t limit) {
+    double mult = std::exp(-lambda);
+    double result = 0;
+    for(uint64_t i = 0; i < limit + 20 * uint64_t(lambda + 10); ++i) {
+        if (i > limit) {
+            result += (i - limit) * mult;
+        }
+        mult = mult * lambda / (i + 1);
+    }
+    return result;
+}
+
+// poisson flow of requests: exponential gaps with the given mean rate, in virtual nanoseconds
+struct TPoissonFlow {
+    std::mt19937_64 Rng;
+    std::exponential_distribution<double> Gap;
+    double NowNs = 0;
+
+    TPoissonFlow(double rps, uint64_t seed)
+        : Rng(seed)
+        , Gap(rps / Second)
+    {}
+
+    uint64_t Next() {
+        NowNs += Gap(Rng);
+        return NowNs;
+    }
+};
+
+struct TSimResult {
+    double RejectedRps = 0;
+    // the most requests admitted inside any sliding Window: the fixed window lets through up to 2 * Limit
+    uint64_t MaxAdmittedPerWindow = 0;
+};
+
+template<class TAlgo>
+TSimResult SimulateOneLimiter(TLimitConfig config, double rps, uint64_t seconds, uint64_t seed) {
+    TAlgo algo(config);
+    typename TAlgo::TState state;
+    TPoissonFlow flow(rps, seed);
+    // start the traffic at a random phase of the window
+    flow.NowNs = std::uniform_real_distribution<double>(0, config.WindowNs)(flow.Rng) + config.WindowNs;
+    const uint64_t finish = flow.NowNs + seconds * Second;
+
+    TSimResult result;
+    uint64_t rejected = 0;
+    std::deque<uint64_t> admitted;
+    for(uint64_t now = flow.Next(); now < finish; now = flow.Next()) {
+        if (!algo.TryAcquire(state, now)) {
+            ++rejected;
+            continue;
+        }
+        admitted.push_back(now);
+        while(admitted.front() + config.WindowNs <= now) {
+            admitted.pop_front();
+        }
+        result.MaxAdmittedPerWindow = std::max<uint64_t>(result.MaxAdmittedPerWindow, admitted.size());
+    }
+    result.RejectedRps = double(rejected) / seconds;
+    return result;
+}
+
+// the setup from the post: limitersNum independent pods, each with Limit / limitersNum,
+// requests are routed at random, a rejected request is retried once on a random pod
+template<class TAlgo>
+double SimulatePods(TLimitConfig config, size_t limitersNum, double rps, uint64_t seconds, uint64_t seed) {
+    TAlgo algo(TLimitConfig{config.Limit / limitersNum, config.WindowNs});
+    std::vector<typename TAlgo::TState> states(limitersNum);
+    TPoissonFlow flow(rps, seed);
+    std::uniform_int_distribution<size_t> pod(0, limitersNum - 1);
+    constexpr uint64_t RetryDelayNs = 1'000'000;
+
+    uint64_t rejected = 0;
+    const uint64_t finish = seconds * Second;
+    for(uint64_t now = flow.Next(); now < finish; now = flow.Next()) {
+        if (algo.TryAcquire(states[pod(flow.Rng)], now)) {
+            continue;
+        }
+        ++rejected;
+        // retries are rare, so checking them in place instead of merging into the flow barely changes the picture
+        if (!algo.TryAcquire(states[pod(flow.Rng)], now + RetryDelayNs)) {
+            ++rejected;
+        }
+    }
+    return double(rejected) / seconds;
+}
+
+template<class TAlgo>
+void ReportOneLimiter(TLimitConfig config, const std::vector<double>& rpsList, uint64_t seconds) {
+    std::cout << std::setw(24) << TAlgo::Name;
+    for(double rps : rpsList) {
+        TSimResult result = SimulateOneLimiter<TAlgo>(config, rps, seconds, 2026);
+        std::cout << std::setw(10) << std::fixed << std::setprecision(2) << result.RejectedRps
+            << " (" << std::setw(3) << result.MaxAdmittedPerWindow << ")";
+    }
+    std::cout << std::endl;
+}
+
+void ReportRejectCurves(uint64_t seconds) {
+    const TLimitConfig config{150, Second};
+    const std::vector<double> rpsList = {100, 120, 129.01 + 7.27, 150, 180};
+    std::cout << "one limiter of " << config.Limit << " per second, poisson traffic, " << seconds << " s simulated\n"
+        << "rejected rps (max admitted in any sliding second)\n"
+        << std::setw(24) << "rps";
+    for(double rps : rpsList) {
+        std::cout << std::setw(16) << rps;
+    }
+    std::cout << "\n" << std::setw(24) << "analytic fixed window";
+    for(double rps : rpsList) {
+        std::cout << std::setw(16) << std::fixed << std::setprecision(2) << ExpectedFixedWindowRejects(rps, config.Limit);
+    }
+    std::cout << std::endl;
+    ReportOneLimiter<TFixedWindow>(config, rpsList, seconds);
+    ReportOneLimiter<TSlidingLog>(config, rpsList, seconds);
+    ReportOneLimiter<TSlidingWindowCounter>(config, rpsList, seconds);
+    ReportOneLimiter<TTokenBucket>(config, rpsList, seconds);
+    ReportOneLimiter<TGcra>(config, rpsList, seconds);
+}
+
+void ReportPods(uint64_t seconds) {
+    const TLimitConfig config{150, Second};
+    const size_t limitersNum = 6;
+    const double rps = 129.01 + 7.27 / 2;
+    // as in the notebook: the limit + 1 off by one included, and rejects doubled for the retry
+    const double notebook = ExpectedFixedWindowRejects(rps / limitersNum, config.Limit / limitersNum + 1) * limitersNum * 2;
+    std::cout << "\n" << limitersNum << " pods with " << config.Limit / limitersNum << " per second each, "
+        << rps << " rps of original requests, one retry; observed in production: 7.27 rejected rps\n"
+        << std::setw(24) << "notebook fixed window" << std::setw(10) << notebook << std::endl;
+    std::cout << std::setw(24) << TFixedWindow::Name << std::setw(10) << SimulatePods<TFixedWindow>(config, limitersNum, rps, seconds, 7) << std::endl;
+    std::cout << std::setw(24) << TSlidingLog::Name << std::setw(10) << SimulatePods<TSlidingLog>(config, limitersNum, rps, seconds, 7) << std::endl;
+    std::cout << std::setw(24) << TSlidingWindowCounter::Name << std::setw(10) << SimulatePods<TSlidingWindowCounter>(config, limitersNum, rps, seconds, 7) << std::endl;
+    std::cout << std::setw(24) << TTokenBucket::Name << std::setw(10) << SimulatePods<TTokenBucket>(config, limitersNum, rps, seconds, 7) << std::endl;
+    std::cout << std::setw(24) << TGcra::Name << std::setw(10) << SimulatePods<TGcra>(config, limitersNum, rps, seconds, 7) << std::endl;
+}
+
+enum class EKeys {
+    // 1024 keys per thread, mostly allowed
+    PerThread,
+    // one key of all threads, mostly rejected
+    Hot,
+    // a new key every check: the table of 1 << 16 slots is full after the first windows, the rest is
+    // reclaimed idle slots (or fail open overflows if nothing goes idle)
+    Churn,
+};
+
+constexpr std::string_view KeysNames[] = {"1024 keys per thread", "one hot key", "a new key every check"};
+
+// cost of one check through the keyed table with the real clock, read once per 64 checks as a server
+// would reuse the request start time.
+// The window is 1ms and not 1s to keep the sliding log of 1024 keys small
+template<class TAlgo>
+void BenchCheckCost(size_t threadsNum, EKeys keys, uint64_t iters) {
+    TKeyedLimiter<TAlgo> limiter(1 << 16, TLimitConfig{1000, 1'000'000});
+    std::atomic<uint64_t> allowed = 0;
+    auto started = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for(size_t t = 0; t < threadsNum; ++t) {
+        threads.emplace_back([&, t]() {
+            uint64_t localAllowed = 0;
+            uint64_t now = 0;
+            for(uint64_t i = 0; i < iters; ++i) {
+                if (i % 64 == 0) {
+                    now = Now();
+                }
+                const uint64_t key = keys == EKeys::Hot ? 1 : t * iters + (keys == EKeys::Churn ? i : i % 1024);
+                localAllowed += limiter.TryAcquire(key, now);
+            }
+            allowed += localAllowed;
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    auto finished = std::chrono::high_resolution_clock::now();
+    std::cout << std::setw(24) << TAlgo::Name << ", " << threadsNum << " threads, " << KeysNames[size_t(keys)]
+        << ": " << std::setprecision(2) << std::chrono::duration<double, std::nano>(finished - started).count() / iters
+        << " ns/check, allowed " << std::setprecision(1) << allowed * 100.0 / (iters * threadsNum) << "%";
+    if (keys == EKeys::Churn) {
+        std::cout << ", reclaimed " << limiter.ReclaimedNum() << ", failed open " << limiter.OverflowsNum();
+    }
+    std::cout << std::endl;
+}
+
+template<class TAlgo>
+void BenchCheckCostAll(size_t maxThreads, uint64_t iters) {
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        BenchCheckCost<TAlgo>(threadsNum, EKeys::PerThread, iters);
+        BenchCheckCost<TAlgo>(threadsNum, EKeys::Hot, iters);
+        BenchCheckCost<TAlgo>(threadsNum, EKeys::Churn, iters);
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    const uint64_t seconds = argc > 1 ? atoll(argv[1]) : 10000;
+    const uint64_t iters = argc > 2 ? atoll(argv[2]) : 10'000'000;
+    const size_t maxThreads = argc > 3 ? atoll(argv[3]) : std::max(1u, std::thread::hardware_concurrency());
+
+    ReportRejectCurves(seconds);
+    ReportPods(seconds);
+
+    std::cout << "\nper check cost" << std::endl;
+    BenchCheckCostAll<TFixedWindow>(maxThreads, iters);
+    BenchCheckCostAll<TSlidingLog>(maxThreads, iters);
+    BenchCheckCostAll<TSlidingWindowCounter>(maxThreads, iters);
+    BenchCheckCostAll<TTokenBucket>(maxThreads, iters);
+    BenchCheckCostAll<TGcra>(maxThreads, iters);
+    return 0;
+}
@@ -0,0 +1,418 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+// Rps limiters: "not more than Limit requests per Window" with different semantics of "per window".
+// See math_posts/rps_limiting.md for why the semantics matter: a fixed window of 150 per second
+// rejects poisson traffic of 136 rps, and lets through bursts of up to 2 * 150 around a window border.
+//
+// Every algorithm is a stateless policy with a small per-key TState changed by a single CAS
+// (the sliding log is the exception, see there), time is passed explicitly in nanoseconds,
+// so the same code runs in production with Now() and in the simulator with virtual time.
+
+namespace NRpsLimiter {
+
+struct TLimitConfig {
+    uint64_t Limit = 150;
+    uint64_t WindowNs = 1'000'000'000;
+};
+
+inline uint64_t Now() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Window numbers and times are kept modulo mask + 1. A thread may read the time and lose the CAS
+// to a thread that read it later: a value up to maxLag behind the stored one is such a straggler,
+// anything else is ahead (a key idle for most of the modulo wraps around, as it did before)
+inline bool IsStraggler(uint64_t value, uint64_t stored, uint64_t mask, uint64_t maxLag) {
+    const uint64_t behind = (stored - value) & mask;
+    return behind != 0 && behind <= maxLag;
+}
+
+// stragglers from more windows back than this are taken for a new window
+constexpr uint64_t MaxLagWindows = 1024;
+
+// counter reset at every window start: cheap, but allows 2 * Limit in a Window around the border
+// and rejects when a window gets more than Limit by chance
+class TFixedWindow {
+public:
+    static constexpr std::string_view Name = "fixed window";
+
+    // window number in the high bits, requests admitted in it in the low ones
+    struct TState {
+        std::atomic<uint64_t> Packed = 0;
+    };
+
+    explicit TFixedWindow(TLimitConfig config)
+        : Config(config)
+    {
+        assert(Config.Limit <= CountMask && "the count of a window has CountBits");
+    }
+
+    bool TryAcquire(TState& state, uint64_t nowNs) const {
+        uint64_t window = (nowNs / Config.WindowNs) & WindowMask;
+        uint64_t current = state.Packed.load(std::memory_order_relaxed);
+        while(true) {
+            const uint64_t stateWindow = current >> CountBits;
+            // a straggler from an older window is counted in the current one, it doesn't reset it
+            if (IsStraggler(window, stateWindow, WindowMask, MaxLagWindows)) {
+                window = stateWindow;
+            }
+            const uint64_t count = stateWindow == window ? (current & CountMask) : 0;
+            if (count >= Config.Limit) {
+                return false;
+            }
+            if (state.Packed.compare_exchange_weak(current, (window << CountBits) | (count + 1), std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    // a state untouched that long acts as a new one: its window is over
+    uint64_t IdleNs() const {
+        return Config.WindowNs;
+    }
+
+private:
+    static constexpr int CountBits = 24;
+    static constexpr uint64_t CountMask = (uint64_t(1) << CountBits) - 1;
+    static constexpr uint64_t WindowMask = (uint64_t(1) << (64 - CountBits)) - 1;
+
+    TLimitConfig Config;
+};
+
+// remembers the time of each of the last Limit admitted requests: exact, but Limit * 8 bytes per key.
+// A ring of timestamps can't be updated with one CAS, so each key has a tiny spinlock;
+// keys don't share locks, so it is only contended by requests for the same key
+class TSlidingLog {
+public:
+    static constexpr std::string_view Name = "sliding log";
+
+    struct TState {
+        std::atomic<bool> Locked = false;
+        uint64_t Head = 0;
+        std::unique_ptr<uint64_t[]> Stamps;
+    };
+
+    explicit TSlidingLog(TLimitConfig config)
+        : Config(config)
+    {}
+
+    bool TryAcquire(TState& state, uint64_t nowNs) const {
+        while(state.Locked.exchange(true, std::memory_order_acquire)) {
+            while(state.Locked.load(std::memory_order_relaxed)) {
+            }
+        }
+        if (!state.Stamps) [[unlikely]] {
+            state.Stamps.reset(new uint64_t[Config.Limit]);
+            std::fill_n(state.Stamps.get(), Config.Limit, NeverStamp);
+        }
+        // the oldest of the last Limit admitted requests
+        uint64_t& oldest = state.Stamps[state.Head];
+        const bool allowed = oldest == NeverStamp || nowNs - oldest >= Config.WindowNs;
+        if (allowed) {
+            oldest = nowNs;
+            state.Head = state.Head + 1 == Config.Limit ? 0 : state.Head + 1;
+        }
+        state.Locked.store(false, std::memory_order_release);
+        return allowed;
+    }
+
+    // a state untouched that long acts as a new one: every stamp is out of the window
+    uint64_t IdleNs() const {
+        return Config.WindowNs;
+    }
+
+private:
+    static constexpr uint64_t NeverStamp = ~uint64_t(0);
+
+    TLimitConfig Config;
+};
+
+// fixed window counters, but the previous window is counted with the weight of its part still inside
+// the sliding window: an approximation of the sliding log in 8 bytes
+class TSlidingWindowCounter {
+public:
+    static constexpr std::string_view Name = "sliding window counter";
+
+    // window number, count of the current window, count of the previous one
+    struct TState {
+        std::atomic<uint64_t> Packed = 0;
+    };
+
+    explicit TSlidingWindowCounter(TLimitConfig config)
+        : Config(config)
+    {
+        assert(Config.Limit <= CountMask && "the counts of the windows have CountBits");
+    }
+
+    bool TryAcquire(TState& state, uint64_t nowNs) const {
+        const uint64_t nowWindow = (nowNs / Config.WindowNs) & WindowMask;
+        const uint64_t nowElapsed = nowNs % Config.WindowNs;
+        uint64_t current = state.Packed.load(std::memory_order_relaxed);
+        while(true) {
+            const uint64_t stateWindow = current >> (2 * CountBits);
+            uint64_t packedWindow = nowWindow;
+            uint64_t elapsed = nowElapsed;
+            // a straggler from an older window is counted in the current one, as if at its start:
+            // the previous window has its whole weight, the straggler can't let more through
+            if (IsStraggler(nowWindow, stateWindow, WindowMask, MaxLagWindows)) {
+                packedWindow = stateWindow;
+                elapsed = 0;
+            }
+            uint64_t count = 0;
+            uint64_t previous = 0;
+            if (stateWindow == packedWindow) {
+                count = current & CountMask;
+                previous = (current >> CountBits) & CountMask;
+            } else if (((stateWindow + 1) & WindowMask) == packedWindow) {
+                previous = current & CountMask;
+            }
+            // previous * (Window - elapsed) / Window + count < Limit, in integers
+            const unsigned __int128 weighted = (unsigned __int128)previous * (Config.WindowNs - elapsed)
+                + (unsigned __int128)count * Config.WindowNs;
+            if (weighted + Config.WindowNs > (unsigned __int128)Config.Limit * Config.WindowNs) {
+                return false;
+            }
+            const uint64_t next = (packedWindow << (2 * CountBits)) | (previous << CountBits) | (count + 1);
+            if (state.Packed.compare_exchange_weak(current, next, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    // a state untouched that long acts as a new one: the previous window is over too
+    uint64_t IdleNs() const {
+        return 2 * Config.WindowNs;
+    }
+
+private:
+    static constexpr int CountBits = 20;
+    static constexpr uint64_t CountMask = (uint64_t(1) << CountBits) - 1;
+    static constexpr uint64_t WindowMask = (uint64_t(1) << (64 - 2 * CountBits)) - 1;
+
+    TLimitConfig Config;
+};
+
+// refills Limit / Window tokens continuously up to Burst, a request takes one token
+class TTokenBucket {
+public:
+    static constexpr std::string_view Name = "token bucket";
+
+    // last refill time in microseconds in the high bits, tokens in 1/TokenScale units in the low ones
+    struct TState {
+        std::atomic<uint64_t> Packed = NotInitialized;
+    };
+
+    explicit TTokenBucket(TLimitConfig config, uint64_t burst = 0)
+        : Config(config)
+        , Burst(std::min<uint64_t>(burst ? burst : config.Limit, TokensMask / TokenScale))
+    {}
+
+    bool TryAcquire(TState& state, uint64_t nowNs) const {
+        const uint64_t nowUs = (nowNs / 1000) & TimeMask;
+        uint64_t current = state.Packed.load(std::memory_order_relaxed);
+        while(true) {
+            uint64_t tokens = Burst * TokenScale;
+            uint64_t refilledUs = nowUs;
+            if (current != NotInitialized) {
+                const uint64_t lastUs = current >> TokensBits;
+                // a straggler behind the last refill gets no refill and doesn't move the time back
+                const uint64_t elapsedUs = IsStraggler(nowUs, lastUs, TimeMask, MaxLagUs) ? 0 : (nowUs - lastUs) & TimeMask;
+                const unsigned __int128 refill = (unsigned __int128)elapsedUs * 1000 * Config.Limit * TokenScale / Config.WindowNs;
+                if ((current & TokensMask) + refill < Burst * TokenScale) {
+                    tokens = (current & TokensMask) + (uint64_t)refill;
+                    // time is advanced only by the part converted into whole token units,
+                    // otherwise frequent checks would round every refill down to nothing
+                    refilledUs = (lastUs + (uint64_t)(refill * Config.WindowNs / (1000 * Config.Limit * TokenScale))) & TimeMask;
+                }
+            }
+            if (tokens < TokenScale) {
+                return false;
+            }
+            const uint64_t next = (refilledUs << TokensBits) | (tokens - TokenScale);
+            if (state.Packed.compare_exchange_weak(current, next, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    // a state untouched that long acts as a new one: the bucket has refilled (and a microsecond of rounding)
+    uint64_t IdleNs() const {
+        return Burst * Config.WindowNs / Config.Limit + 1000;
+    }
+
+private:
+    static constexpr int TokensBits = 24;
+    static constexpr uint64_t TokenScale = 256;
+    static constexpr uint64_t TokensMask = (uint64_t(1) << TokensBits) - 1;
+    // ~12.7 days of microseconds
+    static constexpr uint64_t TimeMask = (uint64_t(1) << (64 - TokensBits)) - 1;
+    // the refill time is behind the thread that did it by its delay after Now(), a straggler by more is not expected
+    static constexpr uint64_t MaxLagUs = 1'000'000;
+    static constexpr uint64_t NotInitialized = ~uint64_t(0);
+
+    TLimitConfig Config;
+    uint64_t Burst;
+};
+
+// generic cell rate algorithm: the token bucket as a single "theoretical arrival time" (TAT).
+// Each admitted request moves TAT by Window / Limit, a request is rejected if TAT is further in the future
+// than the burst tolerance. Smooth, exact to a nanosecond, one word of state
+class TGcra {
+public:
+    static constexpr std::string_view Name = "gcra";
+
+    struct TState {
+        std::atomic<uint64_t> Tat = 0;
+    };
+
+    explicit TGcra(TLimitConfig config, uint64_t burst = 0)
+        : EmissionIntervalNs(std::max<uint64_t>(1, config.WindowNs / config.Limit))
+        , ToleranceNs(EmissionIntervalNs * ((burst ? burst : config.Limit) - 1))
+    {}
+
+    bool TryAcquire(TState& state, uint64_t nowNs) const {
+        uint64_t tat = state.Tat.load(std::memory_order_relaxed);
+        while(true) {
+            const uint64_t start = std::max(tat, nowNs);
+            if (start - nowNs > ToleranceNs) {
+                return false;
+            }
+            if (state.Tat.compare_exchange_weak(tat, start + EmissionIntervalNs, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+    }
+
+    // a state untouched that long acts as a new one: TAT is in the past
+    uint64_t IdleNs() const {
+        return ToleranceNs + EmissionIntervalNs;
+    }
+
+private:
+    uint64_t EmissionIntervalNs;
+    uint64_t ToleranceNs;
+};
+
+// per-key states in an open addressing table split into shards.
+// Keys are claimed with a CAS on the slot key, states are changed in place, nothing is ever locked
+// (except the per-key spinlock of the sliding log). Every slot has its own cache line,
+// so hot keys don't slow down their neighbours.
+// A slot untouched for TAlgo::IdleNs() is reclaimed by a new key that finds no empty slot: its state acts
+// as a new one, so it is taken as it is. A request of the old key racing with the takeover may count
+// against the new key once, and two threads reclaiming for one new key may take two slots (the later one
+// just goes idle again). Only when the probes find neither an empty nor an idle slot a key fails open
+template<class TAlgo>
+class TKeyedLimiter {
+public:
+    template<class... TArgs>
+    explicit TKeyedLimiter(size_t capacity, TArgs&&... algoArgs)
+        : Algo(std::forward<TArgs>(algoArgs)...)
+    {
+        size_t shardCapacity = 1;
+        while(shardCapacity * ShardsNum < capacity * 2) {
+            shardCapacity *= 2;
+        }
+        ShardMask = shardCapacity - 1;
+        for(auto& shard : Shards) {
+            shard.reset(new TSlot[shardCapacity]);
+        }
+    }
+
+    // false means the request must be rejected; when the table is full of active keys new keys are let through (fail open)
+    bool TryAcquire(uint64_t key, uint64_t nowNs = Now()) {
+        typename TAlgo::TState* state = FindOrInsert(key, nowNs);
+        if (!state) [[unlikely]] {
+            Overflows.fetch_add(1, std::memory_order_relaxed);
+            return true;
+        }
+        return Algo.TryAcquire(*state, nowNs);
+    }
+
+    uint64_t OverflowsNum() const {
+        return Overflows.load(std::memory_order_relaxed);
+    }
+
+    uint64_t ReclaimedNum() const {
+        return Reclaimed.load(std::memory_order_relaxed);
+    }
+
+private:
+    static constexpr size_t ShardsNum = 64;
+    static constexpr uint64_t EmptyKey = 0;
+    static constexpr size_t MaxProbes = 64;
+
+    struct alignas(64) TSlot {
+        std::atomic<uint64_t> Key = EmptyKey;
+        // the last use, updated once per quarter of IdleNs: a rejected request mostly writes nothing
+        std::atomic<uint64_t> UsedNs = 0;
+        typename TAlgo::TState State;
+    };
+
+    static uint64_t Mix(uint64_t key) {
+        // murmur3 finalizer; 0 is a fixed point, so it is moved away to keep EmptyKey free
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ULL;
+        key ^= key >> 33;
+        return key ? key : 1;
+    }
+
+    typename TAlgo::TState* Use(TSlot& slot, uint64_t nowNs) {
+        if (nowNs > slot.UsedNs.load(std::memory_order_relaxed) + Algo.IdleNs() / 4) {
+            slot.UsedNs.store(nowNs, std::memory_order_relaxed);
+        }
+        return &slot.State;
+    }
+
+    typename TAlgo::TState* FindOrInsert(uint64_t key, uint64_t nowNs) {
+        const uint64_t hash = Mix(key);
+        TSlot* shard = Shards[hash >> 58].get();
+        TSlot* idle = nullptr;
+        uint64_t idleKey = EmptyKey;
+        for(size_t probe = 0; probe < MaxProbes; ++probe) {
+            TSlot& slot = shard[(hash + probe) & ShardMask];
+            uint64_t slotKey = slot.Key.load(std::memory_order_acquire);
+            if (slotKey == EmptyKey) {
+                if (slot.Key.compare_exchange_strong(slotKey, hash, std::memory_order_acq_rel)) {
+                    return Use(slot, nowNs);
+                }
+            }
+            // hash collisions of distinct keys share a state: with 64 bit hashes that is acceptable for a limiter
+            if (slotKey == hash) {
+                return Use(slot, nowNs);
+            }
+            if (!idle && nowNs > slot.UsedNs.load(std::memory_order_relaxed) + Algo.IdleNs()) {
+                idle = &slot;
+                idleKey = slotKey;
+            }
+        }
+        // the key is not further: the probes end at the first empty slot and no slot is ever emptied
+        if (idle && idle->Key.compare_exchange_strong(idleKey, hash, std::memory_order_acq_rel)) {
+            Reclaimed.fetch_add(1, std::memory_order_relaxed);
+            return Use(*idle, nowNs);
+        }
+        return nullptr;
+    }
+
+    static_assert(ShardsNum == 64, "shard is taken from the 6 highest bits of the hash");
+
+    TAlgo Algo;
+    size_t ShardMask = 0;
+    std::unique_ptr<TSlot[]> Shards[ShardsNum];
+    std::atomic<uint64_t> Overflows = 0;
+    std::atomic<uint64_t> Reclaimed = 0;
+};
+
+}
@@ -0,0 +1,3 @@
+set -x -e
+clang++ -std=c++20 rps_limiter.cpp -o rps_limiter.exe -Wall -O2 -DNDEBUG
+./rps_limiter.exe | tee report.txt
@@ -0,0 +1,3 @@
+set -x -e
+clang++ -std=c++20 singletons_init.cpp -o singletons_init.exe -Wall -O2 -DNDEBUG
+./singletons_init.exe | tee report.txt
@@ -0,0 +1,206 @@
+#pragma once
+
+#include "../work_stealing/work_stealing.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Singletons with a fast path of one plain load (an acquire load is a plain mov on x86),
+// eager parallel initialization and a deterministic destruction order.
+//
+// T must have a default constructor and `static constexpr std::string_view Name`,
+// and may have `static constexpr int Priority` (0 by default):
+// higher priority singletons are created in earlier waves and destroyed later, as Singleton<T> in arcadia.
+// Singletons of the same wave are created in parallel on a work stealing pool; a constructor may use singletons
+// of any priority, those are created on demand (so there must be no cycles).
+// A singleton used after its destruction (by a destructor of a later one) aborts instead of being created again,
+// in release builds too; the next CreateAll starts new lifetimes.
+
+namespace NSingletons {
+
+template<class T>
+concept CWithPriority = requires { { T::Priority } -> std::convertible_to<int>; };
+
+template<class T>
+constexpr int PriorityOf() {
+    if constexpr (CWithPriority<T>) {
+        return T::Priority;
+    } else {
+        return 0;
+    }
+}
+
+class TSingletonRegistry {
+public:
+    struct TEntry {
+        std::string_view Name;
+        int Priority = 0;
+        size_t RegistrationIndex = 0;
+        void (*Create)() = nullptr;
+        void (*Destroy)() = nullptr;
+
+        std::mutex InitLock;
+        bool Created = false;
+        // by DestroyAll, till the next CreateAll
+        bool Destroyed = false;
+
+        void EnsureCreated() {
+            std::lock_guard g(InitLock);
+            if (Destroyed) [[unlikely]] {
+                std::fprintf(stderr, "singleton %.*s is used after its destruction: its priority must be higher than the user's\n",
+                    int(Name.size()), Name.data());
+                std::abort();
+            }
+            if (!Created) {
+                Create();
+                Created = true;
+            }
+        }
+    };
+
+    static TSingletonRegistry& Instance() {
+        // only reached on registration and on slow paths, so the guard check doesn't matter here
+        static TSingletonRegistry registry;
+        return registry;
+    }
+
+    TEntry* Register(std::string_view name, int priority, void (*create)(), void (*destroy)()) {
+        std::lock_guard g(Lock);
+        TEntry* entry = new TEntry;
+        entry->Name = name;
+        entry->Priority = priority;
+        entry->RegistrationIndex = Entries.size();
+        entry->Create = create;
+        entry->Destroy = destroy;
+        Entries.push_back(entry);
+        return entry;
+    }
+
+    // creates every registered singleton: waves by priority, each wave in parallel on a pool of threadsNum workers
+    void CreateAll(size_t threadsNum) {
+        std::vector<TEntry*> entries = SortedEntries();
+        for(TEntry* entry : entries) {
+            std::lock_guard g(entry->InitLock);
+            entry->Destroyed = false;
+        }
+        NWorkStealing::TPool workers({.Workers = threadsNum});
+        for(size_t waveStart = 0; waveStart < entries.size();) {
+            size_t waveEnd = waveStart;
+            while(waveEnd < entries.size() && entries[waveEnd]->Priority == entries[waveStart]->Priority) {
+                ++waveEnd;
+            }
+            // a constructor may block on the lock of a singleton another worker creates, never on a pool task
+            workers.ParallelFor(waveStart, waveEnd, 1, [&](size_t begin, size_t end) {
+                for(size_t i = begin; i < end; ++i) {
+                    entries[i]->EnsureCreated();
+                }
+            });
+            waveStart = waveEnd;
+        }
+    }
+
+    // reverse of creation waves; inside a wave reverse of (name, registration index), independent of timings
+    void DestroyAll() {
+        std::vector<TEntry*> entries = SortedEntries();
+        for(auto it = entries.rbegin(); it != entries.rend(); ++it) {
+            std::lock_guard g((*it)->InitLock);
+            if ((*it)->Created) {
+                (*it)->Destroy();
+                (*it)->Created = false;
+                (*it)->Destroyed = true;
+            }
+        }
+    }
+
+    ~TSingletonRegistry() {
+        DestroyAll();
+        for(TEntry* entry : Entries) {
+            delete entry;
+        }
+    }
+
+private:
+    std::vector<TEntry*> SortedEntries() {
+        std::lock_guard g(Lock);
+        std::vector<TEntry*> entries = Entries;
+        std::sort(entries.begin(), entries.end(), [](const TEntry* a, const TEntry* b) {
+            if (a->Priority != b->Priority) {
+                return a->Priority > b->Priority;
+            }
+            if (a->Name != b->Name) {
+                return a->Name < b->Name;
+            }
+            return a->RegistrationIndex < b->RegistrationIndex;
+        });
+        return entries;
+    }
+
+    std::mutex Lock;
+    std::vector<TEntry*> Entries;
+};
+
+template<class T>
+class TSingleton {
+public:
+    static T& Get() {
+        T* ptr = Ptr.load(std::memory_order_acquire);
+        if (ptr) [[likely]] {
+            return *ptr;
+        }
+        return GetSlow();
+    }
+
+private:
+    [[gnu::noinline]] static T& GetSlow() {
+        (void)&Registered;
+        GetEntry()->EnsureCreated();
+        return *Ptr.load(std::memory_order_acquire);
+    }
+
+    // a function local static, so that singletons used from other static initializers work too
+    static TSingletonRegistry::TEntry* GetEntry() {
+        static TSingletonRegistry::TEntry* entry =
+            TSingletonRegistry::Instance().Register(T::Name, PriorityOf<T>(), &Create, &Destroy);
+        return entry;
+    }
+
+    static void Create() {
+        Ptr.store(new(Storage) T(), std::memory_order_release);
+    }
+
+    static void Destroy() {
+        T* ptr = Ptr.exchange(nullptr, std::memory_order_acq_rel);
+        ptr->~T();
+    }
+
+    alignas(T) static inline std::byte Storage[sizeof(T)];
+    static inline std::atomic<T*> Ptr = nullptr;
+    // instantiated together with Get(), so any singleton used anywhere in the program is registered before main
+    static inline TSingletonRegistry::TEntry* const Registered = GetEntry();
+};
+
+template<class T>
+T& Singleton() {
+    return TSingleton<T>::Get();
+}
+
+// creates all singletons at construction and destroys them in the deterministic order at scope exit
+struct TSingletonsScope {
+    explicit TSingletonsScope(size_t threadsNum = std::thread::hardware_concurrency()) {
+        TSingletonRegistry::Instance().CreateAll(std::max<size_t>(1, threadsNum));
+    }
+    ~TSingletonsScope() {
+        TSingletonRegistry::Instance().DestroyAll();
+    }
+};
+
+}
@@ -0,0 +1,133 @@
+#include "singleton.hpp"
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+// plays the role of TSomeExternal from just_post/singletons_init.md: "loads a file" into a hash map
+template<size_t Id, size_t Size = 200'000>
+struct TTable {
+    static constexpr std::string_view Name = "table";
+    std::unordered_map<uint64_t, uint64_t> Data;
+
+    TTable() {
+        uint64_t x = Id + 1;
+        for(size_t i = 0; i < Size; ++i) {
+            x = x * 6364136223846793005ull + 1442695040888963407ull;
+            Data[x >> 16] = i;
+        }
+    }
+    int DoCalc() const {
+        return Data.size();
+    }
+};
+
+using TBenchTable = TTable<1000, 10>;
+
+// 1. global object, constructed before main
+TBenchTable GlobalValue;
+[[gnu::noinline]] int FuncGlobal() {
+    return GlobalValue.DoCalc() + 14;
+}
+
+// 2. std::call_once
+std::once_flag OnceFlag;
+std::unique_ptr<TBenchTable> OncePtr;
+[[gnu::noinline]] int FuncCallOnce() {
+    std::call_once(OnceFlag, []() {OncePtr = std::make_unique<TBenchTable>();});
+    return OncePtr->DoCalc() + 14;
+}
+
+// 3. function local static
+[[gnu::noinline]] int FuncLocalStatic() {
+    static TBenchTable prepared;
+    return prepared.DoCalc() + 14;
+}
+
+// 4. double checked atomic pointer
+std::atomic<TBenchTable*> CheckedPtr = nullptr;
+std::mutex CheckedLock;
+[[gnu::noinline]] int FuncDoubleChecked() {
+    TBenchTable* ptr = CheckedPtr.load(std::memory_order_acquire);
+    if (!ptr) [[unlikely]] {
+        std::lock_guard g(CheckedLock);
+        ptr = CheckedPtr.load(std::memory_order_relaxed);
+        if (!ptr) {
+            ptr = new TBenchTable();
+            CheckedPtr.store(ptr, std::memory_order_release);
+        }
+    }
+    return ptr->DoCalc() + 14;
+}
+
+// 5. the registry
+[[gnu::noinline]] int FuncRegistry() {
+    return NSingletons::Singleton<TBenchTable>().DoCalc() + 14;
+}
+
+void BenchAccess(std::string_view name, int (*func)(), size_t iters) {
+    int64_t accum = 0;
+    auto started = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < iters; ++i) {
+        accum += func();
+        asm volatile("" ::: "memory");
+    }
+    auto finished = std::chrono::high_resolution_clock::now();
+    std::cout << name << ": " << std::chrono::duration<double, std::nano>(finished - started).count() / iters
+        << " ns/call (checksum " << accum << ")" << std::endl;
+}
+
+// a few dozen singletons to initialize at startup
+template<size_t... Ids>
+void UseTables(std::index_sequence<Ids...>) {
+    int64_t accum = (NSingletons::Singleton<TTable<Ids>>().DoCalc() + ...);
+    std::cout << "tables checksum " << accum << std::endl;
+}
+constexpr size_t TablesNum = 32;
+
+void BenchStartup(size_t threadsNum) {
+    auto started = std::chrono::high_resolution_clock::now();
+    NSingletons::TSingletonsScope scope(threadsNum);
+    auto finished = std::chrono::high_resolution_clock::now();
+    std::cout << "startup of " << TablesNum << " tables on " << threadsNum << " threads: "
+        << std::chrono::duration<double, std::milli>(finished - started).count() << " ms" << std::endl;
+    UseTables(std::make_index_sequence<TablesNum>());
+}
+
+// destruction order is defined by priorities, not by who happened to be created first
+struct TDemoConfig {
+    static constexpr std::string_view Name = "config";
+    static constexpr int Priority = 100;
+    int Value = 7;
+    ~TDemoConfig() {
+        std::cout << "destroy config" << std::endl;
+    }
+};
+struct TDemoCache {
+    static constexpr std::string_view Name = "cache";
+    int Value = NSingletons::Singleton<TDemoConfig>().Value * 2;
+    ~TDemoCache() {
+        std::cout << "destroy cache, config is still alive: " << NSingletons::Singleton<TDemoConfig>().Value << std::endl;
+    }
+};
+
+int main(int argc, const char* argv[]) {
+    size_t iters = argc > 1 ? atoll(argv[1]) : 100'000'000;
+    size_t threadsNum = std::max(1u, std::thread::hardware_concurrency());
+
+    BenchStartup(1);
+    BenchStartup(threadsNum);
+
+    NSingletons::TSingletonsScope scope(threadsNum);
+    std::cout << "cache value " << NSingletons::Singleton<TDemoCache>().Value << std::endl;
+
+    BenchAccess("global object", &FuncGlobal, iters);
+    BenchAccess("std::call_once", &FuncCallOnce, iters);
+    BenchAccess("function local static", &FuncLocalStatic, iters);
+    BenchAccess("double checked atomic pointer", &FuncDoubleChecked, iters);
+    BenchAccess("registry singleton", &FuncRegistry, iters);
+    return 0;
+}
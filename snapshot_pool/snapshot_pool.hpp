@@ -0,0 +1,249 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Pools and tables that start instantly: generate the data once, write it as a snapshot,
+// then every run mmaps it read only instead of generating it again.
+//
+// A snapshot is a TSnapshotHeader, padding up to DataAlignment and the data, so the data is page aligned
+// in the mapping. The header keeps the element size and count, the producer's tag (seed, generator version)
+// and a checksum of the data, verified on open only when asked: it reads the whole file.
+// How the pages get in is ELoad: on first touch (with the kernel readahead or without it),
+// all in mmap (MAP_POPULATE) or in the background (MADV_WILLNEED).
+//
+// Generation itself is parallel: CounterRandom(seed, i) is a function of the index, so any thread fills
+// any range and the data doesn't depend on the threads count, unlike a std::rand() loop.
+// Errors are returned as strings, a snapshot that failed to open is just regenerated.
+
+namespace NSnapshotPool {
+
+constexpr uint64_t SnapshotMagic = 0x4c4f4f5050414e53ULL; // "SNAPPOOL"
+constexpr uint32_t SnapshotVersion = 1;
+constexpr size_t DataAlignment = 4096;
+
+struct TSnapshotHeader {
+    uint64_t Magic = SnapshotMagic;
+    uint32_t Version = SnapshotVersion;
+    uint32_t HeaderSize = sizeof(TSnapshotHeader);
+    uint64_t ElemSize = 0;
+    uint64_t ElemsNum = 0;
+    uint64_t DataOffset = DataAlignment;
+    uint64_t DataSize = 0;
+    uint64_t Tag = 0;
+    uint64_t Checksum = 0;
+};
+static_assert(sizeof(TSnapshotHeader) <= DataAlignment);
+
+// splitmix64 of the counter: independent enough values for test data, 1 ns each, from any thread
+inline uint64_t CounterRandom(uint64_t seed, uint64_t counter) {
+    uint64_t z = seed + (counter + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// fill(begin, end) for contiguous ranges of [0, n), one per thread
+template<class TFill>
+void ParallelFill(size_t n, TFill&& fill, size_t threadsNum = std::max(1u, std::thread::hardware_concurrency())) {
+    threadsNum = std::max<size_t>(1, std::min(threadsNum, n / 4096 + 1));
+    std::vector<std::thread> threads;
+    for(size_t t = 1; t < threadsNum; ++t) {
+        threads.emplace_back([&, t]() {
+            fill(n * t / threadsNum, n * (t + 1) / threadsNum);
+        });
+    }
+    fill(0, n / threadsNum);
+    for(auto& t : threads) {
+        t.join();
+    }
+}
+
+// 4 lanes of xor-multiply over 8 byte words: several GB/s, enough to catch a truncated or foreign file
+inline uint64_t Checksum(const void* data, size_t size) {
+    const uint8_t* ptr = static_cast<const uint8_t*>(data);
+    uint64_t lanes[4] = {1, 2, 3, 4};
+    size_t i = 0;
+    for(; i + 32 <= size; i += 32) {
+        for(size_t k = 0; k < 4; ++k) {
+            uint64_t word;
+            std::memcpy(&word, ptr + i + 8 * k, 8);
+            lanes[k] = (lanes[k] ^ word) * 0x9e3779b97f4a7c15ULL;
+            lanes[k] ^= lanes[k] >> 29;
+        }
+    }
+    for(; i < size; ++i) {
+        lanes[0] = (lanes[0] ^ ptr[i]) * 0x9e3779b97f4a7c15ULL;
+    }
+    return CounterRandom(lanes[0] ^ size, lanes[1] ^ CounterRandom(lanes[2], lanes[3]));
+}
+
+// written to path.tmp and renamed: a reader sees the old snapshot or the whole new one.
+// Not fsynced, a snapshot is a cache and a torn one fails the size check or the checksum
+inline bool WriteSnapshot(const std::string& path, const void* data, uint64_t elemSize, uint64_t elemsNum, uint64_t tag, std::string* error = nullptr) {
+    auto fail = [&](const char* what) {
+        if (error) {
+            *error = std::string(what) + " " + path + ": " + std::strerror(errno);
+        }
+        return false;
+    };
+    TSnapshotHeader header;
+    header.ElemSize = elemSize;
+    header.ElemsNum = elemsNum;
+    header.DataSize = elemSize * elemsNum;
+    header.Tag = tag;
+    header.Checksum = Checksum(data, header.DataSize);
+
+    const std::string tmpPath = path + ".tmp";
+    const int fd = open(tmpPath.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    if (fd == -1) {
+        return fail("open");
+    }
+    std::vector<char> head(DataAlignment, 0);
+    std::memcpy(head.data(), &header, sizeof(header));
+    auto writeAll = [&](const char* ptr, size_t size) {
+        while(size) {
+            const ssize_t written = write(fd, ptr, size);
+            if (written < 0 && errno == EINTR) {
+                continue;
+            }
+            if (written <= 0) {
+                return false;
+            }
+            ptr += written;
+            size -= written;
+        }
+        return true;
+    };
+    if (!writeAll(head.data(), head.size()) || !writeAll(static_cast<const char*>(data), header.DataSize)) {
+        close(fd);
+        unlink(tmpPath.c_str());
+        return fail("write");
+    }
+    close(fd);
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+        unlink(tmpPath.c_str());
+        return fail("rename");
+    }
+    return true;
+}
+
+// evicts the clean pages of the file: the next open reads it from the disk, as after a reboot
+inline bool DropFromPageCache(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        return false;
+    }
+    const bool res = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+    close(fd);
+    return res;
+}
+
+enum class ELoad {
+    // page faults on first touch, the kernel reads ahead around them
+    Lazy,
+    // page faults on first touch, one page each (MADV_RANDOM): less io for sparse random lookups
+    LazyRandom,
+    // everything is read and mapped before mmap returns
+    Populate,
+    // mmap returns at once, the kernel starts reading everything in the background
+    WillNeed,
+};
+
+struct TMapOptions {
+    ELoad Load = ELoad::Lazy;
+    bool VerifyChecksum = false;
+};
+
+class TMappedSnapshot {
+public:
+    TMappedSnapshot() = default;
+    TMappedSnapshot(TMappedSnapshot&& other) noexcept
+        : Base(std::exchange(other.Base, nullptr))
+        , MappedSize(std::exchange(other.MappedSize, 0))
+        , Error(std::move(other.Error))
+    {}
+    TMappedSnapshot& operator=(TMappedSnapshot&& other) noexcept {
+        std::swap(Base, other.Base);
+        std::swap(MappedSize, other.MappedSize);
+        std::swap(Error, other.Error);
+        return *this;
+    }
+    ~TMappedSnapshot() {
+        if (Base) {
+            munmap(Base, MappedSize);
+        }
+    }
+
+    // an empty snapshot with GetError() on any failure
+    static TMappedSnapshot Open(const std::string& path, TMapOptions options = {}) {
+        TMappedSnapshot res;
+        auto fail = [&](std::string what) {
+            res.Error = what + " " + path + (errno ? std::string(": ") + std::strerror(errno) : std::string());
+            if (res.Base) {
+                munmap(res.Base, res.MappedSize);
+                res.Base = nullptr;
+            }
+            return std::move(res);
+        };
+        errno = 0;
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return fail("open");
+        }
+        struct stat st;
+        TSnapshotHeader header;
+        if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(header) || pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            close(fd);
+            return fail("read header of");
+        }
+        if (header.Magic != SnapshotMagic || header.Version != SnapshotVersion || header.HeaderSize != sizeof(header)
+            || header.DataOffset % DataAlignment || header.DataSize != header.ElemSize * header.ElemsNum
+            || header.DataOffset + header.DataSize > uint64_t(st.st_size))
+        {
+            close(fd);
+            errno = 0;
+            return fail("bad header or truncated data in");
+        }
+        res.MappedSize = header.DataOffset + header.DataSize;
+        void* base = mmap(nullptr, res.MappedSize, PROT_READ, MAP_SHARED | (options.Load == ELoad::Populate ? MAP_POPULATE : 0), fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            return fail("mmap");
+        }
+        res.Base = static_cast<char*>(base);
+        if (options.Load == ELoad::LazyRandom) {
+            madvise(res.Base, res.MappedSize, MADV_RANDOM);
+        } else if (options.Load == ELoad::WillNeed) {
+            madvise(res.Base, res.MappedSize, MADV_WILLNEED);
+        }
+        if (options.VerifyChecksum && Checksum(res.Data(), header.DataSize) != header.Checksum) {
+            errno = 0;
+            return fail("checksum mismatch in");
+        }
+        return res;
+    }
+
+    explicit operator bool() const {return Base != nullptr;}
+    const std::string& GetError() const {return Error;}
+    const TSnapshotHeader& Header() const {return *reinterpret_cast<const TSnapshotHeader*>(Base);}
+    const void* Data() const {return Base + Header().DataOffset;}
+
+private:
+    char* Base = nullptr;
+    size_t MappedSize = 0;
+    std::string Error;
+};
+
+}
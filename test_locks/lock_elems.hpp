@@ -0,0 +1,274 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
+
+#ifdef arcadia
+#include <util/system/mutex.h>
+#endif
+
+// The lock elements of test_locks: a lock and a byte of Data it guards, Lock / TryLock / UnLock,
+// the reader-writer ones have LockShared / UnLockShared or a lock free Read.
+// Shared with the concurrent map, where an element is a shard lock and its Data is unused.
+
+namespace NLockElems {
+
+constexpr size_t CacheLineSize = 64;
+
+struct TBasicElem {
+    static constexpr std::string_view Name = "noLock";
+    uint8_t Data;
+
+    void Lock() {}
+    bool TryLock() {return true;}
+    void UnLock() {}
+};
+
+#ifdef arcadia
+
+struct TUtilMutex {
+    static constexpr std::string_view Name = "arcadia TMutex";
+    TMutex m;
+    uint8_t Data;
+
+    void Lock() {m.lock();}
+    bool TryLock() {return m.TryAcquire();}
+    void UnLock() {m.unlock();}
+};
+
+#endif
+
+struct TMutexElem {
+    static constexpr std::string_view Name = "std::mutex";
+    std::mutex m;
+    uint8_t Data;
+
+    void Lock() {m.lock();}
+    bool TryLock() {return m.try_lock();}
+    void UnLock() {m.unlock();}
+};
+
+struct TMutexPtrElem {
+    static constexpr std::string_view Name = "std::unique_ptr<std::mutex>";
+    std::unique_ptr<std::mutex> m;
+    uint8_t Data;
+
+    TMutexPtrElem () {
+        m = std::make_unique<std::mutex>();
+    }
+    void Lock() {m->lock();}
+    bool TryLock() {return m->try_lock();}
+    void UnLock() {m->unlock();}
+};
+
+struct TAtomicFlagElem {
+    static constexpr std::string_view Name = "std::atomic<bool>";
+    std::atomic<bool> flag = false;
+    uint8_t Data;
+
+    void Lock() {
+        while(true) {
+            bool expected = false;
+            if (flag.compare_exchange_weak(expected, true, std::memory_order_acquire)) {
+                break;
+            }
+        }
+    }
+    bool TryLock() {
+        bool expected = false;
+        return flag.compare_exchange_strong(expected, true, std::memory_order_acquire);
+    }
+    void UnLock() {flag.store(false, std::memory_order_release);}
+};
+
+struct TAtomicFlagWaitNotify {
+    static constexpr std::string_view Name = "std::atomic<bool> wait + notify";
+    std::atomic<bool> flag = false;
+    uint8_t Data;
+
+    void Lock() {
+        while(true) {
+            bool expected = false;
+            if (flag.compare_exchange_weak(expected, true, std::memory_order_acquire)) {
+                break;
+            } else {
+                flag.wait(true, std::memory_order_acquire);
+            }
+        }
+    }
+    bool TryLock() {
+        bool expected = false;
+        return flag.compare_exchange_strong(expected, true, std::memory_order_acquire);
+    }
+    void UnLock() {
+        flag.store(false, std::memory_order_release);
+        flag.notify_all();
+    }
+};
+
+
+struct TAtomicFlagPtrWaitNotify {
+    static constexpr std::string_view Name = "std::atomic<bool> ptr wait + notify";
+    std::unique_ptr<std::atomic<bool>> flag = std::make_unique<std::atomic<bool>>(false);
+    uint8_t Data;
+
+    void Lock() {
+        while(true) {
+            bool expected = false;
+            if (flag->compare_exchange_weak(expected, true, std::memory_order_acquire)) {
+                break;
+            } else {
+                flag->wait(true, std::memory_order_acquire);
+            }
+        }
+    }
+    bool TryLock() {
+        bool expected = false;
+        return flag->compare_exchange_strong(expected, true, std::memory_order_acquire);
+    }
+    void UnLock() {
+        flag->store(false, std::memory_order_release);
+        flag->notify_all();
+    }
+};
+
+// reader-writer elements: readers take LockShared, or Read() the value without any lock (seqlock),
+// writers go through Lock/UnLock as usual, or Update() when the data must be written atomically
+
+struct TSharedMutexElem {
+    static constexpr std::string_view Name = "std::shared_mutex";
+    std::shared_mutex m;
+    uint8_t Data;
+
+    void Lock() {m.lock();}
+    bool TryLock() {return m.try_lock();}
+    void UnLock() {m.unlock();}
+    void LockShared() {m.lock_shared();}
+    void UnLockShared() {m.unlock_shared();}
+};
+
+// spinning with a yield: a waiter may wait for a thread that is not running at all
+template<class TCond>
+void SpinWhile(TCond&& cond) {
+    for(uint32_t spins = 0; cond(); ++spins) {
+        if (spins >= 64) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+// a reader counter per thread slot, each in its own cache line: readers of different slots
+// don't touch the same line, a writer takes the flag and waits for every counter to drop to zero.
+// Slots are given to threads round robin, so up to ShardsNum threads it is a counter per core
+struct TShardedRwLockElem {
+    static constexpr std::string_view Name = "sharded rw lock";
+    static constexpr uint32_t ShardsNum = 16;
+
+    struct alignas(CacheLineSize) TSlot {
+        std::atomic<uint32_t> Readers = 0;
+    };
+
+    TSlot Slots[ShardsNum];
+    alignas(CacheLineSize) std::atomic<bool> Writer = false;
+    uint8_t Data;
+
+    static uint32_t ThreadSlot() {
+        static std::atomic<uint32_t> nextSlot = 0;
+        thread_local const uint32_t slot = nextSlot.fetch_add(1, std::memory_order_relaxed) % ShardsNum;
+        return slot;
+    }
+
+    void Lock() {
+        while(Writer.exchange(true, std::memory_order_seq_cst)) {
+            SpinWhile([&]() {return Writer.load(std::memory_order_relaxed);});
+        }
+        // readers that came after the flag see it and go away
+        for(TSlot& slot : Slots) {
+            SpinWhile([&]() {return slot.Readers.load(std::memory_order_seq_cst) != 0;});
+        }
+    }
+    bool TryLock() {
+        if (Writer.exchange(true, std::memory_order_seq_cst)) {
+            return false;
+        }
+        for(TSlot& slot : Slots) {
+            if (slot.Readers.load(std::memory_order_seq_cst) != 0) {
+                Writer.store(false, std::memory_order_release);
+                return false;
+            }
+        }
+        return true;
+    }
+    void UnLock() {Writer.store(false, std::memory_order_release);}
+
+    void LockShared() {
+        std::atomic<uint32_t>& readers = Slots[ThreadSlot()].Readers;
+        while(true) {
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            if (!Writer.load(std::memory_order_seq_cst)) {
+                return;
+            }
+            // writers first: step back until the writer is done
+            readers.fetch_sub(1, std::memory_order_release);
+            SpinWhile([&]() {return Writer.load(std::memory_order_relaxed);});
+        }
+    }
+    void UnLockShared() {Slots[ThreadSlot()].Readers.fetch_sub(1, std::memory_order_release);}
+};
+
+// a version, odd while a writer is inside: a reader loads the version, the data and the version again
+// and retries if a writer was there, so readers write nothing and share the cache line with no traffic.
+// Data is accessed through atomic_ref only: readers race with the writer by design
+struct TSeqLockElem {
+    static constexpr std::string_view Name = "seqlock";
+    std::atomic<uint32_t> Version = 0;
+    uint8_t Data;
+
+    void Lock() {
+        while(true) {
+            uint32_t version = Version.load(std::memory_order_relaxed);
+            if (version % 2 == 0 && Version.compare_exchange_weak(version, version + 1, std::memory_order_acquire)) {
+                break;
+            }
+            SpinWhile([&]() {return Version.load(std::memory_order_relaxed) % 2 != 0;});
+        }
+        // the odd version is visible before any of the data stores
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+    bool TryLock() {
+        uint32_t version = Version.load(std::memory_order_relaxed);
+        if (version % 2 != 0 || !Version.compare_exchange_strong(version, version + 1, std::memory_order_acquire)) {
+            return false;
+        }
+        std::atomic_thread_fence(std::memory_order_release);
+        return true;
+    }
+    void UnLock() {Version.store(Version.load(std::memory_order_relaxed) + 1, std::memory_order_release);}
+
+    uint8_t Read() {
+        while(true) {
+            const uint32_t before = Version.load(std::memory_order_acquire);
+            const uint8_t res = std::atomic_ref<uint8_t>(Data).load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (before % 2 == 0 && Version.load(std::memory_order_relaxed) == before) {
+                return res;
+            }
+            SpinWhile([&]() {return Version.load(std::memory_order_relaxed) % 2 != 0;});
+        }
+    }
+    // Data = change(Data) under the lock
+    template<class TChange>
+    void Update(TChange&& change) {
+        Lock();
+        std::atomic_ref<uint8_t> data(Data);
+        data.store(change(data.load(std::memory_order_relaxed)), std::memory_order_relaxed);
+        UnLock();
+    }
+};
+
+}
@@ -1,3 +1,12 @@
+#include "../bench/bench.hpp"
+#include "../false_sharing/false_sharing.hpp"
+#include "../hdr_histogram/hdr_histogram.hpp"
+#include "../lock_profiler/lock_profiler.hpp"
+#include "../snapshot_pool/snapshot_pool.hpp"
+#include "../work_stealing/work_stealing.hpp"
+#include "lock_elems.hpp"
+
+#include <algorithm>
 #include <atomic>
 #include <cassert>
 #include <cstdint>
@@ -5,118 +14,107 @@
 #include <limits>
 #include <memory>
 #include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <source_location>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <type_traits>
+#include <utility>
+#include <vector>
 #include <chrono>
 
-std::mutex PrintLock;
-std::atomic<bool> WaitFlag = false;
+using namespace NLockElems;
 
-struct TBasicElem {
-    static constexpr std::string_view Name = "noLock";
-    uint8_t Data;
+// any element under the contention profiler: a site is the place Lock is called from (ReadElem, WriteElem).
+// Only Lock is profiled, LockShared, Read and Update go to the element as they are.
+// The wrapper adds no members, the held state is the thread's: the patterns share lines as the plain runs do
+template<class TElem>
+struct TProfiledElem : TElem {
+    static inline const std::string Name = "profiled " + std::string(TElem::Name);
 
-    void Lock() {}
-    void UnLock() {}
-};
-
-#ifdef arcadia
-#include <util/system/mutex.h>
-
-struct TUtilMutex {
-    static constexpr std::string_view Name = "arcadia TMutex";
-    TMutex m;
-    uint8_t Data;
-
-    void Lock() {m.lock();}
-    void UnLock() {m.unlock();}
-};
-
-#endif
-
-
-struct TMutexElem {
-    static constexpr std::string_view Name = "std::mutex";
-    std::mutex m;
-    uint8_t Data;
-
-    void Lock() {m.lock();}
-    void UnLock() {m.unlock();}
-};
-
-struct TMutexPtrElem {
-    static constexpr std::string_view Name = "std::unique_ptr<std::mutex>";
-    std::unique_ptr<std::mutex> m;
-    uint8_t Data;
-
-    TMutexPtrElem () {
-        m = std::make_unique<std::mutex>();
-    }
-    void Lock() {m->lock();}
-    void UnLock() {m->unlock();}
-};
-
-struct TAtomicFlagElem {
-    static constexpr std::string_view Name = "std::atomic<bool>";
-    std::atomic<bool> flag = false;
-    uint8_t Data;
-
-    void Lock() {
-        while(true) {
-            bool expected = false;
-            if (flag.compare_exchange_weak(expected, true, std::memory_order_acquire)) {
-                break;
-            }
-        }
-    }
-    void UnLock() {flag.store(false, std::memory_order_release);}
-};
-
-struct TAtomicFlagWaitNotify {
-    static constexpr std::string_view Name = "std::atomic<bool> wait + notify";
-    std::atomic<bool> flag = false;
-    uint8_t Data;
-
-    void Lock() {
-        while(true) {
-            bool expected = false;
-            if (flag.compare_exchange_weak(expected, true, std::memory_order_acquire)) {
-                break;
-            } else {
-                flag.wait(true, std::memory_order_acquire);
-            }
-        }
+    void Lock(const std::source_location& location = std::source_location::current()) {
+        NLockProfiler::AcquireByAddress(static_cast<TElem&>(*this), location);
     }
     void UnLock() {
-        flag.store(false, std::memory_order_release);
-        flag.notify_all();
+        NLockProfiler::ReleaseByAddress(static_cast<TElem&>(*this));
     }
 };
 
+// the read action: a load of Data under the lightest lock the element has
+template<class TElem>
+uint8_t ReadElem(TElem& elem) {
+    if constexpr (requires {elem.Read();}) {
+        return elem.Read();
+    } else if constexpr (requires {elem.LockShared();}) {
+        elem.LockShared();
+        const uint8_t res = elem.Data;
+        elem.UnLockShared();
+        return res;
+    } else {
+        elem.Lock();
+        const uint8_t res = elem.Data;
+        elem.UnLock();
+        return res;
+    }
+}
 
-struct TAtomicFlagPtrWaitNotify {
-    static constexpr std::string_view Name = "std::atomic<bool> ptr wait + notify";
-    std::unique_ptr<std::atomic<bool>> flag = std::make_unique<std::atomic<bool>>(false);
-    uint8_t Data;
+// the write action: read-modify-write under the exclusive lock
+template<class TElem>
+void WriteElem(TElem& elem) {
+    auto change = [](uint8_t value) -> uint8_t {return value * value;};
+    if constexpr (requires {elem.Update(change);}) {
+        elem.Update(change);
+    } else {
+        elem.Lock();
+        elem.Data = change(elem.Data);
+        elem.UnLock();
+    }
+}
 
-    void Lock() {
-        while(true) {
-            bool expected = false;
-            if (flag->compare_exchange_weak(expected, true, std::memory_order_acquire)) {
-                break;
-            } else {
-                flag->wait(true, std::memory_order_acquire);
-            }
-        }
+// every read and write of ReadElem / WriteElem is recorded by the false sharing detector first.
+// The wrapper adds no members: the layout and the bytes the patterns touch are the element's
+template<class TElem>
+struct TShadowedElem : TElem {
+    static inline const std::string Name = "shadowed " + std::string(TElem::Name);
+    // a lock taken for a read writes its word: only the seqlock and the no lock element read without a write
+    static constexpr bool ReadWrites = !requires(TElem& elem) {elem.Read();} && !std::is_same_v<TElem, TBasicElem>;
+
+    uint8_t Read() {
+        NFalseSharing::OnAccess(this, sizeof(TElem), ReadWrites);
+        return ReadElem(static_cast<TElem&>(*this));
     }
-    void UnLock() {
-        flag->store(false, std::memory_order_release);
-        flag->notify_all();
+    template<class TChange>
+    void Update(TChange&& change) {
+        NFalseSharing::OnWrite(static_cast<TElem&>(*this));
+        if constexpr (requires(TElem& elem) {elem.Update(change);}) {
+            TElem::Update(change);
+        } else {
+            TElem::Lock();
+            this->Data = change(this->Data);
+            TElem::UnLock();
+        }
     }
 };
 
 constexpr size_t AlignmentShift = 1024;
-constexpr size_t CacheLineSize = 64;
+
+// what DoAction does: elements index = Shift + k * Window (+ j < Subelems), from the start or from the end of the pool
+struct TActionOptions {
+    size_t Window = 1;
+    size_t Shift = 0;
+    size_t Subelems = 1;
+    bool Forward = true;
+    // reads (ReadElem) between writes (WriteElem), 0 for writes only
+    uint32_t ReadsPerWrite = 0;
+    size_t Passes = 1;
+    // reads or writes are timed into the recorder when it is set, the others are not timed
+    NHdrHistogram::TConcurrentHistogram::TRecorder* ReadLatencies = nullptr;
+    NHdrHistogram::TConcurrentHistogram::TRecorder* WriteLatencies = nullptr;
+    // the actions start when all threads of a phase have come: each takes one off
+    std::atomic<size_t>* StartLine = nullptr;
+};
 
 template<class T>
 struct TDataHolder {
@@ -136,8 +134,6 @@ struct TDataHolder {
         delete[] Data;
     }
     TDataHolder(float mbs) {
-        std::srand(2026);
-
         const size_t recommendedSizeBytes = mbs * 1024 * 1024 + AlignmentShift;
 
         Data = new char[recommendedSizeBytes];
@@ -154,333 +150,287 @@ struct TDataHolder {
         std::cout << "- pool size is " << (EffectiveEndPtr - EffectiveDataPtr) / 1024. / 1024 << "mb elems " << std::endl;
         std::cout << "- it is " << (size_t(EffectiveEndPtr) - size_t(EffectiveDataPtr)) / 1024. / 1024 << " mbs capacity " << std::endl;
 
-        for(auto ptr = EffectiveDataPtr; ptr != EffectiveEndPtr; ++ptr) {
-            int rand = std::rand();
-            new(ptr) TElem;
-            ptr->Data =  rand % std::numeric_limits<std::remove_reference_t<decltype(ptr->Data)>>::max();
-        }
+        // elements hold locks, they are constructed in place and can't come from a read only snapshot,
+        // but the fill is parallel and the values are the same for any threads count
+        NSnapshotPool::ParallelFill(EffectiveEndPtr - EffectiveDataPtr, [&](size_t begin, size_t end) {
+            for(auto ptr = EffectiveDataPtr + begin; ptr != EffectiveDataPtr + end; ++ptr) {
+                new(ptr) TElem;
+                ptr->Data =  NSnapshotPool::CounterRandom(2026, ptr - EffectiveDataPtr) % std::numeric_limits<std::remove_reference_t<decltype(ptr->Data)>>::max();
+            }
+        });
     }
 
-    size_t DoAction(size_t window, size_t shift, size_t subelems, std::string_view title, bool forward = true) {
+    // passes over the pool, the sample is the time of them and the actions done
+    NBench::TSample DoAction(const TActionOptions& options) {
         assert(EffectiveDataPtr + 1 == (TElem*)( size_t(EffectiveDataPtr) + sizeof(TElem)));
-        while(WaitFlag.load()) {}
+        if (options.StartLine) {
+            options.StartLine->fetch_sub(1);
+            while(options.StartLine->load()) {}
+        }
         size_t actionsDone = 0;
+        uint32_t readsBeforeWrite = 0;
+        uint8_t readsSum = 0;
         auto actionsStarted = std::chrono::high_resolution_clock::now();
-        for(size_t index = shift;  int64_t(index) < EffectiveEndPtr - EffectiveDataPtr; index += window) {
-            for(size_t j = 0; j < subelems; ++j) {
-                TElem& current = forward ? EffectiveDataPtr[index + j] : EffectiveDataPtr[(EffectiveEndPtr - EffectiveDataPtr) - index - j - 1];
-                current.Lock();
-                current.Data = current.Data * current.Data;
-                current.UnLock();
-                actionsDone += 1;
+        for(size_t pass = 0; pass < options.Passes; ++pass) {
+            // the whole group of subelems must fit into the pool
+            for(size_t index = options.Shift;  int64_t(index + options.Subelems) <= EffectiveEndPtr - EffectiveDataPtr; index += options.Window) {
+                for(size_t j = 0; j < options.Subelems; ++j) {
+                    TElem& current = options.Forward ? EffectiveDataPtr[index + j] : EffectiveDataPtr[(EffectiveEndPtr - EffectiveDataPtr) - index - j - 1];
+                    const bool write = readsBeforeWrite == 0;
+                    readsBeforeWrite = write ? options.ReadsPerWrite : readsBeforeWrite - 1;
+                    if (auto latencies = write ? options.WriteLatencies : options.ReadLatencies) {
+                        auto started = std::chrono::steady_clock::now();
+                        if (write) {
+                            WriteElem(current);
+                        } else {
+                            readsSum += ReadElem(current);
+                        }
+                        latencies->Record((std::chrono::steady_clock::now() - started).count());
+                    } else if (write) {
+                        WriteElem(current);
+                    } else {
+                        readsSum += ReadElem(current);
+                    }
+                    actionsDone += 1;
+                }
             }
         }
         auto actionsFinished = std::chrono::high_resolution_clock::now();
-
-        {
-            std::lock_guard g(PrintLock);
-            std::cout << TElem::Name << ":" << title
-                << "\n  window=" << window << "(bytes=" << sizeof(TElem) * window << ")"
-                    << " shift=" << shift << " (bytes " << sizeof(TElem) * shift << ")"
-                    << " subelems=" << subelems << " (bytes " << sizeof(TElem) * subelems << ")"
-                << "\n -- done " << actionsDone / 1024. / 1024 
-                << "mb actions, in " << (actionsFinished - actionsStarted).count() / 1e6 << "mln ticks"
-                << "\n -- actions cost is " << (actionsFinished - actionsStarted).count() / (actionsDone + 0.0) << " ticks"
-                << std::endl;
-        }
-
-        return actionsDone;
+        // as an input: gcc fails the "+r,m" output constraint on a sum folded to a constant (no reads)
+        NBench::DoNotOptimize(std::as_const(readsSum));
+        return NBench::TSample{std::chrono::duration<double, std::nano>(actionsFinished - actionsStarted).count(), double(actionsDone)};
     }
 };
 
-int main() {
-    TDataHolder<TAtomicFlagPtrWaitNotify> atomicWaitFlagPtrDataPool(128);
-    {
-        atomicWaitFlagPtrDataPool.DoAction(2, 0, 1, "each second;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            atomicWaitFlagPtrDataPool.DoAction(2, 0, 1, "each second; t1");
-        });
-        std::thread t2([&]() {
-            atomicWaitFlagPtrDataPool.DoAction(2, 1, 1, "each second; t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
-    {
-        size_t window_size = CacheLineSize / sizeof(TAtomicFlagPtrWaitNotify) * 2;
-        atomicWaitFlagPtrDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            atomicWaitFlagPtrDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline; t1");
-        });
-        std::thread t2([&]() {
-            atomicWaitFlagPtrDataPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline; t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
-    {
-        size_t window_size = CacheLineSize / sizeof(TAtomicFlagPtrWaitNotify) * 2;
-        atomicWaitFlagPtrDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline different sides iter;main thread", false);
-        WaitFlag = true;
-        std::thread t1([&]() {
-            atomicWaitFlagPtrDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline different sides iter; t1");
-        });
-        std::thread t2([&]() {
-            atomicWaitFlagPtrDataPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline different sides iter; t2", false);
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
+// the main thread alone, then t1 from 0 and t2 from SecondShift, both with the same window
+struct TPattern {
+    std::string_view Title;
+    size_t Window;
+    size_t SecondShift;
+    size_t Subelems = 1;
+    // t2 (and the main thread) go from the end of the pool
+    bool SecondBackward = false;
+};
 
-    TDataHolder<TAtomicFlagWaitNotify> atomicWaitFlagDataPool(128);
-    {
-        atomicWaitFlagDataPool.DoAction(2, 0, 1, "each second;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            atomicWaitFlagDataPool.DoAction(2, 0, 1, "each second; t1");
-        });
-        std::thread t2([&]() {
-            atomicWaitFlagDataPool.DoAction(2, 1, 1, "each second; t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
-    {
-        size_t window_size = CacheLineSize / sizeof(TAtomicFlagWaitNotify) * 2;
-        atomicWaitFlagDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            atomicWaitFlagDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline; t1");
-        });
-        std::thread t2([&]() {
-            atomicWaitFlagDataPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline; t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
-    {
-        size_t window_size = CacheLineSize / sizeof(TAtomicFlagWaitNotify) * 2;
-        atomicWaitFlagDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline different sides iter;main thread", false);
-        WaitFlag = true;
-        std::thread t1([&]() {
-            atomicWaitFlagDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline different sides iter; t1");
-        });
-        std::thread t2([&]() {
-            atomicWaitFlagDataPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline different sides iter; t2", false);
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
+constexpr TPattern EachSecond{"each second", 2, 1};
+
+template<class TElem>
+TPattern NonIntersectedCacheline(size_t window = CacheLineSize / sizeof(TElem) * 2) {
+    return {"nonintersected cacheline", window, window / 2};
+}
+
+template<class TElem>
+TPattern DifferentSides(size_t window = CacheLineSize / sizeof(TElem) * 2) {
+    return {"nonintersected cacheline different sides iter", window, window / 2, 1, true};
+}
 
-    TDataHolder<TAtomicFlagElem> atomicFlagDataPool(128);
+// t1 and t2 of the pattern on two pool workers, started together
+template<class TElem>
+std::pair<NBench::TSample, NBench::TSample> DoTwoThreads(NWorkStealing::TPool& workers, TDataHolder<TElem>& pool, const TPattern& pattern,
+    NHdrHistogram::TConcurrentHistogram::TRecorder* firstLatencies = nullptr, NHdrHistogram::TConcurrentHistogram::TRecorder* secondLatencies = nullptr)
+{
+    NBench::TSample first;
+    NBench::TSample second;
+    std::atomic<size_t> startLine = 2;
+    workers.Join([&]() {
+        first = pool.DoAction({.Window = pattern.Window, .Subelems = pattern.Subelems,
+            .WriteLatencies = firstLatencies, .StartLine = &startLine});
+    }, [&]() {
+        second = pool.DoAction({.Window = pattern.Window, .Shift = pattern.SecondShift, .Subelems = pattern.Subelems,
+            .Forward = !pattern.SecondBackward, .WriteLatencies = secondLatencies, .StartLine = &startLine});
+    });
+    return {first, second};
+}
+
+// a sample is a pass over the whole pool, by the main thread or by two pool workers at once;
+// then one more pass with every action timed for the latency quantiles
+template<class TElem>
+void RunPattern(NBench::TReporter& reporter, NWorkStealing::TPool& workers, TDataHolder<TElem>& pool, const TPattern& pattern, uint32_t samples) {
+    NBench::TOptions options;
+    options.Iterations = 1;
+    options.WarmupTime = {};
+    options.Samples = samples;
+    const std::string name = std::string(TElem::Name) + ":" + std::string(pattern.Title);
+    auto add = [&](NBench::TStats stats, const NHdrHistogram::THistogram& latencies) {
+        stats.AddCounter("window_bytes", sizeof(TElem) * pattern.Window)
+            .AddCounter("shift_bytes", sizeof(TElem) * pattern.SecondShift)
+            .AddCounter("subelems_bytes", sizeof(TElem) * pattern.Subelems)
+            .AddQuantiles("action_", latencies);
+        reporter.Add(std::move(stats));
+    };
+
+    auto runTwoThreads = [&](NHdrHistogram::TConcurrentHistogram* latencies) {
+        std::optional<NHdrHistogram::TConcurrentHistogram::TRecorder> firstRecorder;
+        std::optional<NHdrHistogram::TConcurrentHistogram::TRecorder> secondRecorder;
+        if (latencies) {
+            firstRecorder = latencies->GetRecorder();
+            secondRecorder = latencies->GetRecorder();
+        }
+        auto [first, second] = DoTwoThreads(workers, pool, pattern, firstRecorder ? &*firstRecorder : nullptr,
+            secondRecorder ? &*secondRecorder : nullptr);
+        // the action cost of the slower thread
+        return first.Ns * second.Items > second.Ns * first.Items ? first : second;
+    };
+
+    NBench::TStats mainThread = NBench::RunManual(name + "; main thread", [&](uint64_t) {
+        return pool.DoAction({.Window = pattern.Window, .Subelems = pattern.Subelems, .Forward = !pattern.SecondBackward});
+    }, options);
+    NHdrHistogram::TConcurrentHistogram mainLatencies;
     {
-        atomicFlagDataPool.DoAction(2, 0, 1, "each second;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            atomicFlagDataPool.DoAction(2, 0, 1, "each second; t1");
-        });
-        std::thread t2([&]() {
-            atomicFlagDataPool.DoAction(2, 1, 1, "each second; t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        auto recorder = mainLatencies.GetRecorder();
+        pool.DoAction({.Window = pattern.Window, .Subelems = pattern.Subelems, .Forward = !pattern.SecondBackward,
+            .WriteLatencies = &recorder});
     }
-    {
-        size_t window_size = CacheLineSize / sizeof(TAtomicFlagElem) * 2;
-        atomicFlagDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            atomicFlagDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline; t1");
-        });
-        std::thread t2([&]() {
-            atomicFlagDataPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline; t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+    add(std::move(mainThread), mainLatencies.Snapshot());
+
+    NBench::TStats twoThreads = NBench::RunManual(name + "; t1 + t2", [&](uint64_t) {
+        return runTwoThreads(nullptr);
+    }, options);
+    NHdrHistogram::TConcurrentHistogram twoThreadsLatencies;
+    runTwoThreads(&twoThreadsLatencies);
+    add(std::move(twoThreads), twoThreadsLatencies.Snapshot());
+}
+
+// read mostly shared state: every thread walks the same HotElemsNum elements, readsPerWrite reads for each write.
+// The sample is the time of the slowest thread and the reads of all threads, so the rate is the readers throughput;
+// writes are timed for the writer latency
+constexpr size_t HotElemsNum = 1024;
+constexpr size_t ReadMostlyPasses = 256;
+
+template<class TElem>
+void RunReadMostly(NBench::TReporter& reporter, NWorkStealing::TPool& workers, uint32_t readsPerWrite, size_t maxThreads, uint32_t samples) {
+    TDataHolder<TElem> pool(float(HotElemsNum * sizeof(TElem)) / 1024 / 1024);
+    NBench::TOptions options;
+    options.Iterations = 1;
+    options.WarmupTime = {};
+    options.Samples = samples;
+    for(size_t threadsNum = 1; threadsNum <= maxThreads; threadsNum *= 2) {
+        NHdrHistogram::TConcurrentHistogram writeLatencies;
+        std::vector<NHdrHistogram::TConcurrentHistogram::TRecorder> recorders;
+        for(size_t t = 0; t < threadsNum; ++t) {
+            recorders.push_back(writeLatencies.GetRecorder());
+        }
+        const std::string name = std::string(TElem::Name) + ": read mostly, " + std::to_string(readsPerWrite) + " reads per write, "
+            + std::to_string(threadsNum) + " threads";
+        NBench::TStats stats = NBench::RunManual(name, [&](uint64_t) {
+            std::vector<NBench::TSample> results(threadsNum);
+            std::atomic<size_t> startLine = threadsNum;
+            workers.ParallelFor(0, threadsNum, 1, [&](size_t t, size_t) {
+                results[t] = pool.DoAction({.ReadsPerWrite = readsPerWrite, .Passes = ReadMostlyPasses, .WriteLatencies = &recorders[t],
+                    .StartLine = &startLine});
+            });
+            NBench::TSample res;
+            for(const auto& r : results) {
+                res.Ns = std::max(res.Ns, r.Ns);
+                res.Items += r.Items * readsPerWrite / (readsPerWrite + 1);
+            }
+            return res;
+        }, options);
+        stats.AddCounter("threads", threadsNum)
+            .AddCounter("reads_per_write", readsPerWrite)
+            .AddQuantiles("write_", writeLatencies.Snapshot());
+        reporter.Add(std::move(stats));
     }
+}
+
+// the false sharing detector on t1 + t2 of the pattern over a small pool: true if it finds lines written by both
+// exactly when expected (each second), and no such line in the padded patterns
+template<class TElem>
+bool CheckFalseSharing(NWorkStealing::TPool& workers, const TPattern& pattern, bool expectShared) {
+    TDataHolder<TShadowedElem<TElem>> pool(1);
+    NFalseSharing::Reset();
+    NFalseSharing::Watch(std::string(TElem::Name) + " pool", pool.EffectiveDataPtr,
+        (pool.EffectiveEndPtr - pool.EffectiveDataPtr) * sizeof(TElem), sizeof(TElem));
+    DoTwoThreads(workers, pool, pattern);
+    const std::vector<NFalseSharing::TLineReport> lines = NFalseSharing::Collect();
+    // the threads touch different elements: a shared line must be false sharing only
+    const size_t trueSharing = std::count_if(lines.begin(), lines.end(), [](const auto& line) {return line.TrueSharing;});
+    const bool ok = expectShared ? !lines.empty() && trueSharing == 0 : lines.empty();
+    std::cout << "false sharing check, " << TElem::Name << ":" << pattern.Title << ": "
+        << (ok ? "ok" : "WRONG") << ", expected " << (expectShared ? "shared" : "no shared") << " lines, got "
+        << lines.size() << " shared, " << trueSharing << " of them true sharing" << std::endl;
+    NFalseSharing::Dump(std::cout, 2);
+    return ok;
+}
+
+int main(int argc, const char* argv[]) {
+    const uint32_t samples = argc > 1 ? atoi(argv[1]) : 5;
+    const float poolSizeMb = argc > 2 ? atof(argv[2]) : 128;
+    const uint32_t readsPerWrite = argc > 3 ? atoi(argv[3]) : 100;
+    const size_t maxThreads = argc > 4 ? atoll(argv[4]) : std::max(4u, std::thread::hardware_concurrency());
+    NBench::TReporter reporter("test_locks");
+    // the threads of all phases: a phase starts when all its threads have come, so no less workers than threads
+    NWorkStealing::TPool workers({.Workers = std::max<size_t>(2, maxThreads)});
 
-    TDataHolder<TMutexPtrElem> mutexPtrDataPool(128);
     {
-        mutexPtrDataPool.DoAction(2, 0, 1, "each second;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            mutexPtrDataPool.DoAction(2, 0, 1, "each second; t1");
-        });
-        std::thread t2([&]() {
-            mutexPtrDataPool.DoAction(2, 1, 1, "each second; t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        TDataHolder<TAtomicFlagPtrWaitNotify> pool(poolSizeMb);
+        RunPattern(reporter, workers, pool, EachSecond, samples);
+        RunPattern(reporter, workers, pool, NonIntersectedCacheline<TAtomicFlagPtrWaitNotify>(), samples);
+        RunPattern(reporter, workers, pool, DifferentSides<TAtomicFlagPtrWaitNotify>(), samples);
     }
     {
-        size_t window_size = CacheLineSize / sizeof(TMutexPtrElem) * 2;
-        mutexPtrDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            mutexPtrDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline t1");
-        });
-        std::thread t2([&]() {
-            mutexPtrDataPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        TDataHolder<TAtomicFlagWaitNotify> pool(poolSizeMb);
+        RunPattern(reporter, workers, pool, EachSecond, samples);
+        RunPattern(reporter, workers, pool, NonIntersectedCacheline<TAtomicFlagWaitNotify>(), samples);
+        RunPattern(reporter, workers, pool, DifferentSides<TAtomicFlagWaitNotify>(), samples);
     }
     {
-        size_t window_size = CacheLineSize / sizeof(TMutexPtrElem) * 2;
-        mutexPtrDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline different sides iter;main thread", false);
-        WaitFlag = true;
-        std::thread t1([&]() {
-            mutexPtrDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline different sides iter; t1");
-        });
-        std::thread t2([&]() {
-            mutexPtrDataPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline different sides iter; t2", false);
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        TDataHolder<TAtomicFlagElem> pool(poolSizeMb);
+        RunPattern(reporter, workers, pool, EachSecond, samples);
+        RunPattern(reporter, workers, pool, NonIntersectedCacheline<TAtomicFlagElem>(), samples);
     }
-
-    #ifdef arcadia
-    TDataHolder<TUtilMutex> utilMutexPool(128);
     {
-        utilMutexPool.DoAction(2, 0, 1, "each second;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            utilMutexPool.DoAction(2, 0, 1, "each second; t1");
-        });
-        std::thread t2([&]() {
-            utilMutexPool.DoAction(2, 1, 1, "each second; t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        TDataHolder<TMutexPtrElem> pool(poolSizeMb);
+        RunPattern(reporter, workers, pool, EachSecond, samples);
+        RunPattern(reporter, workers, pool, NonIntersectedCacheline<TMutexPtrElem>(), samples);
+        RunPattern(reporter, workers, pool, DifferentSides<TMutexPtrElem>(), samples);
     }
+    #ifdef arcadia
     {
-        size_t window_size = CacheLineSize / sizeof(TUtilMutex) * 2;
-        utilMutexPool.DoAction(window_size, 0, 1, "nonintersected cacheline;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            utilMutexPool.DoAction(window_size, 0, 1, "nonintersected cacheline t1");
-        });
-        std::thread t2([&]() {
-            utilMutexPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        TDataHolder<TUtilMutex> pool(poolSizeMb);
+        RunPattern(reporter, workers, pool, EachSecond, samples);
+        RunPattern(reporter, workers, pool, NonIntersectedCacheline<TUtilMutex>(), samples);
     }
     #endif
-
-
-    TDataHolder<TMutexElem> mutexDataPool(128);
-    {
-        mutexDataPool.DoAction(2, 0, 1, "each second;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            mutexDataPool.DoAction(2, 0, 1, "t1");
-        });
-        std::thread t2([&]() {
-            mutexDataPool.DoAction(2, 1, 1, "t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
     {
-        mutexDataPool.DoAction(4, 0, 1, "nonintersected cacheline;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            mutexDataPool.DoAction(4, 0, 1, "nonintersected cacheline t1");
-        });
-        std::thread t2([&]() {
-            mutexDataPool.DoAction(4, 2, 1, "nonintersected cacheline t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        TDataHolder<TMutexElem> pool(poolSizeMb);
+        RunPattern(reporter, workers, pool, EachSecond, samples);
+        RunPattern(reporter, workers, pool, NonIntersectedCacheline<TMutexElem>(4), samples);
+        RunPattern(reporter, workers, pool, DifferentSides<TMutexElem>(4), samples);
     }
     {
-        size_t window_size = 4;
-        mutexDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline different sides iter;main thread", false);
-        WaitFlag = true;
-        std::thread t1([&]() {
-            mutexDataPool.DoAction(window_size, 0, 1, "nonintersected cacheline different sides iter; t1");
-        });
-        std::thread t2([&]() {
-            mutexDataPool.DoAction(window_size, window_size / 2, 1, "nonintersected cacheline different sides iter; t2", false);
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        TDataHolder<TBasicElem> pool(poolSizeMb);
+        RunPattern(reporter, workers, pool, EachSecond, samples);
+        RunPattern(reporter, workers, pool, TPattern{"nonintersected cacheline", 64, 1}, samples);
+        RunPattern(reporter, workers, pool, TPattern{"32 in each 64", 64, 32, 32}, samples);
+        RunPattern(reporter, workers, pool, TPattern{"64 in each 128", 128, 64, 64}, samples);
     }
 
-    TDataHolder<TBasicElem> basicDataPool(128);
+    RunReadMostly<TMutexElem>(reporter, workers, readsPerWrite, maxThreads, samples);
+    RunReadMostly<TAtomicFlagElem>(reporter, workers, readsPerWrite, maxThreads, samples);
+    RunReadMostly<TSharedMutexElem>(reporter, workers, readsPerWrite, maxThreads, samples);
+    RunReadMostly<TShardedRwLockElem>(reporter, workers, readsPerWrite, maxThreads, samples);
+    RunReadMostly<TSeqLockElem>(reporter, workers, readsPerWrite, maxThreads, samples);
 
+    // the same under the contention profiler: the overhead is the difference with the plain runs
+    static_assert(sizeof(TProfiledElem<TMutexElem>) == sizeof(TMutexElem));
+    static_assert(sizeof(TProfiledElem<TAtomicFlagElem>) == sizeof(TAtomicFlagElem));
     {
-        basicDataPool.DoAction(2, 0, 1, "each second;main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            basicDataPool.DoAction(2, 0, 1, "t1");
-        });
-        std::thread t2([&]() {
-            basicDataPool.DoAction(2, 1, 1, "t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
-
-    {
-        basicDataPool.DoAction(64, 0, 1, "nonintersected cacheline; main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            basicDataPool.DoAction(64, 0, 1, "nonintersected cacheline t1");
-        });
-        std::thread t2([&]() {
-            basicDataPool.DoAction(64, 1, 1, "nonintersected cacheline t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
+        TDataHolder<TProfiledElem<TMutexElem>> pool(poolSizeMb);
+        RunPattern(reporter, workers, pool, EachSecond, samples);
     }
-    {
-        basicDataPool.DoAction(64, 0, 32, "32 in each 64; main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            basicDataPool.DoAction(64, 0, 32, "t1");
-        });
-        std::thread t2([&]() {
-            basicDataPool.DoAction(64, 32, 32, "t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
-    {
-        basicDataPool.DoAction(128, 0, 64, "64 in each 128; main thread");
-        WaitFlag = true;
-        std::thread t1([&]() {
-            basicDataPool.DoAction(128, 0, 64, "t1");
-        });
-        std::thread t2([&]() {
-            basicDataPool.DoAction(128, 64, 64, "t2");
-        });
-        WaitFlag = false;
-        t1.join();
-        t2.join();
-    }
-
-    return 0;
+    RunReadMostly<TProfiledElem<TMutexElem>>(reporter, workers, readsPerWrite, maxThreads, samples);
+    RunReadMostly<TProfiledElem<TAtomicFlagElem>>(reporter, workers, readsPerWrite, maxThreads, samples);
+    NLockProfiler::Dump(std::cout);
+
+    // the detector must flag each second and clear the padded patterns, the same the timings show
+    static_assert(sizeof(TShadowedElem<TMutexElem>) == sizeof(TMutexElem));
+    bool detected = CheckFalseSharing<TAtomicFlagElem>(workers, EachSecond, true);
+    detected &= CheckFalseSharing<TAtomicFlagElem>(workers, NonIntersectedCacheline<TAtomicFlagElem>(), false);
+    detected &= CheckFalseSharing<TMutexElem>(workers, EachSecond, true);
+    detected &= CheckFalseSharing<TMutexElem>(workers, NonIntersectedCacheline<TMutexElem>(4), false);
+    detected &= CheckFalseSharing<TBasicElem>(workers, EachSecond, true);
+    detected &= CheckFalseSharing<TBasicElem>(workers, NonIntersectedCacheline<TBasicElem>(), false);
+
+    return detected ? 0 : 1;
 }
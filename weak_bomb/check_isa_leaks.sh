@@ -0,0 +1,31 @@
+# usage: check_isa_leaks.sh <isa specific objects>... -- <other objects>...
+# fails if a weak symbol defined in an ISA specific object is also defined in any other object:
+# the linker would keep one arbitrary copy, maybe the one with instructions the cpu doesn't have
+set -e
+
+isa_objs=()
+while [ "$#" -gt 0 ] && [ "$1" != "--" ]; do
+    isa_objs+=("$1")
+    shift
+done
+shift || true
+
+defined_symbols() {
+    nm --defined-only "$1" | awk '{print $3}' | sort -u
+}
+
+leaks=0
+for obj in "${isa_objs[@]}"; do
+    for other in "${isa_objs[@]}" "$@"; do
+        if [ "$obj" == "$other" ]; then
+            continue
+        fi
+        common=`comm -12 <(nm --defined-only "$obj" | awk '$2 ~ /^[WVu]$/ {print $3}' | sort -u) <(defined_symbols "$other")`
+        if [ "$common" != "" ]; then
+            echo "inline symbols of $obj leak into $other:"
+            echo "$common" | c++filt | sed 's/^/    /'
+            leaks=1
+        fi
+    done
+done
+exit $leaks
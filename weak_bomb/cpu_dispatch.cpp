@@ -0,0 +1,20 @@
+#include "cpu_dispatch.hpp"
+
+namespace NCpu {
+
+TCpuFeatures DetectCpuFeatures() {
+    // __builtin_cpu_supports checks both cpuid and that the os saves the wide registers (xgetbv)
+    __builtin_cpu_init();
+    TCpuFeatures features;
+    features.Sse42 = __builtin_cpu_supports("sse4.2");
+    features.Avx2 = __builtin_cpu_supports("avx2");
+    features.Avx512f = __builtin_cpu_supports("avx512f");
+    return features;
+}
+
+const TCpuFeatures& CpuFeatures() {
+    static const TCpuFeatures features = DetectCpuFeatures();
+    return features;
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+// Runtime dispatch between implementations built for different instruction sets.
+//
+// Rules for ISA specific translation units (the ones compiled with -mavx2, -mavx512f, ...):
+// 1. every such TU is compiled with its own -DISA_NAMESPACE=<isa>, and all inline functions of shared headers
+//    live in `inline namespace ISA_NAMESPACE`, so each TU gets its own symbols and the linker has nothing to merge
+// 2. templates of other libraries (std::accumulate, std::array::operator[], ...) can't be renamed this way,
+//    so ISA specific TUs are built with optimizations and check_isa_leaks.sh verifies that no weak symbol
+//    of them is defined anywhere else
+// 3. this header and cpu_dispatch.cpp are compiled with baseline flags only
+
+#ifndef ISA_NAMESPACE
+#define ISA_NAMESPACE common
+#endif
+
+namespace NCpu {
+
+struct TCpuFeatures {
+    bool Sse42 = false;
+    bool Avx2 = false;
+    bool Avx512f = false;
+};
+
+// asks cpuid every time; safe to call from ifunc resolvers, which run before any static initialization
+TCpuFeatures DetectCpuFeatures();
+
+// detected on the first call (a function local static): right from static initializers of any TU, whatever the link order
+const TCpuFeatures& CpuFeatures();
+
+template<class TFunc>
+struct TIsaImpls {
+    TFunc* Common = nullptr;
+    TFunc* Sse42 = nullptr;
+    TFunc* Avx2 = nullptr;
+    TFunc* Avx512 = nullptr;
+
+    TFunc* Choose(const TCpuFeatures& features) const {
+        if (Avx512 && features.Avx512f) {
+            return Avx512;
+        }
+        if (Avx2 && features.Avx2) {
+            return Avx2;
+        }
+        if (Sse42 && features.Sse42) {
+            return Sse42;
+        }
+        return Common;
+    }
+};
+
+}
@@ -0,0 +1,31 @@
+#include "header.hpp"
+
+#include <chrono>
+#include <string_view>
+
+template<class TFunc>
+void Bench(std::string_view name, TFunc&& func, size_t iters) {
+    NS::TData z;
+    float accum = 0;
+    auto started = std::chrono::high_resolution_clock::now();
+    for(size_t i = 0; i < iters; ++i) {
+        accum += func(z);
+    }
+    auto finished = std::chrono::high_resolution_clock::now();
+    std::cout << name << ": " << std::chrono::duration<double, std::nano>(finished - started).count() / iters
+        << " ns/call (checksum " << accum << ")" << std::endl;
+}
+
+int main(int argc, const char* argv[]) {
+    size_t iters = argc > 1 ? atoll(argv[1]) : 10'000'000;
+    const NCpu::TCpuFeatures& features = NCpu::CpuFeatures();
+    std::cout << "sse4.2=" << features.Sse42 << " avx2=" << features.Avx2 << " avx512f=" << features.Avx512f << std::endl;
+
+    Bench("direct common", &NS::func_in_tu_common, iters);
+    if (features.Avx512f) {
+        Bench("direct avx512", &NS::func_in_tu_avx512, iters);
+    }
+    Bench("function pointer dispatch", &NS::func_dispatched, iters);
+    Bench("ifunc dispatch", &NS::func_ifunc, iters);
+    return 0;
+}
@@ -1,6 +1,8 @@
 #include <iostream>
 #include <array>
 
+#include "cpu_dispatch.hpp"
+
 namespace NS {
 
 using TData = std::array<float, 128>;
@@ -8,6 +10,14 @@ using TData = std::array<float, 128>;
 float func_in_tu_common(TData& z);
 float func_in_tu_avx512(TData& z);
 
+// chosen once at startup through a function pointer (tu_dispatch.cpp)
+float func_dispatched(TData& z);
+// chosen by the dynamic loader through an ifunc resolver, the call goes through the plt
+float func_ifunc(TData& z);
+
+// without -DISA_NAMESPACE every TU puts these into NS::common, and we get the bomb from post.md back
+inline namespace ISA_NAMESPACE {
+
 inline void prepare(TData& z) {
     for(size_t i = 0; i < z.size(); ++i) {
         z[i] = i;
@@ -23,3 +33,5 @@ inline float func_with_choose(bool haveAvx) {
 }
 
 }
+
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+
+#include <immintrin.h>
+
+#include "cpu_dispatch.hpp"
+
+namespace NS {
+
+enum class ESumOrder {
+    // left to right, as std::accumulate with float init; serial, so no ISA can speed it up
+    Sequential,
+    // element i goes to partial sum i % 32, partial sums are combined by a fixed tree:
+    // every ISA (and the scalar path) produces bit-identical results
+    Lanes32,
+    // 8 accumulators of the widest vector available; fastest, but the result depends on ISA
+    Unordered,
+};
+
+// one implementation per ISA specific TU (reduce_sum_tu.cpp built with different flags)
+float ReduceSum_common(std::span<const float> data, ESumOrder order);
+float ReduceSum_sse42(std::span<const float> data, ESumOrder order);
+float ReduceSum_avx2(std::span<const float> data, ESumOrder order);
+float ReduceSum_avx512(std::span<const float> data, ESumOrder order);
+
+// the best of the above for the current cpu (tu_dispatch.cpp)
+float ReduceSum(std::span<const float> data, ESumOrder order);
+
+inline namespace ISA_NAMESPACE {
+
+// the kernel is small and hot, and TUs of the same ISA (tu_common.cpp and reduce_sum_tu.cpp for avx2)
+// would otherwise share its out-of-line copy, which check_isa_leaks.sh reports
+#define REDUCE_SUM_INLINE [[gnu::always_inline]] inline
+
+#if defined(__AVX512F__)
+struct TFloatVec {
+    static constexpr size_t Lanes = 16;
+    __m512 V;
+
+    static TFloatVec Zero() {return {_mm512_setzero_ps()};}
+    static TFloatVec Load(const float* ptr) {return {_mm512_loadu_ps(ptr)};}
+    void Store(float* ptr) const {_mm512_storeu_ps(ptr, V);}
+    TFloatVec operator+(TFloatVec other) const {return {_mm512_add_ps(V, other.V)};}
+};
+#elif defined(__AVX2__)
+struct TFloatVec {
+    static constexpr size_t Lanes = 8;
+    __m256 V;
+
+    static TFloatVec Zero() {return {_mm256_setzero_ps()};}
+    static TFloatVec Load(const float* ptr) {return {_mm256_loadu_ps(ptr)};}
+    void Store(float* ptr) const {_mm256_storeu_ps(ptr, V);}
+    TFloatVec operator+(TFloatVec other) const {return {_mm256_add_ps(V, other.V)};}
+};
+#elif defined(__SSE4_2__)
+struct TFloatVec {
+    static constexpr size_t Lanes = 4;
+    __m128 V;
+
+    static TFloatVec Zero() {return {_mm_setzero_ps()};}
+    static TFloatVec Load(const float* ptr) {return {_mm_loadu_ps(ptr)};}
+    void Store(float* ptr) const {_mm_storeu_ps(ptr, V);}
+    TFloatVec operator+(TFloatVec other) const {return {_mm_add_ps(V, other.V)};}
+};
+#else
+struct TFloatVec {
+    static constexpr size_t Lanes = 1;
+    float V;
+
+    static TFloatVec Zero() {return {0.f};}
+    static TFloatVec Load(const float* ptr) {return {*ptr};}
+    void Store(float* ptr) const {*ptr = V;}
+    TFloatVec operator+(TFloatVec other) const {return {V + other.V};}
+};
+#endif
+
+// partial[j] gets the sum of elements with index % (AccumsNum * Lanes) == j, in index order
+template<size_t AccumsNum>
+REDUCE_SUM_INLINE void AccumulatePartialSums(std::span<const float> data, float* partial) {
+    constexpr size_t BlockSize = AccumsNum * TFloatVec::Lanes;
+    TFloatVec accums[AccumsNum];
+    for(auto& accum : accums) {
+        accum = TFloatVec::Zero();
+    }
+    size_t i = 0;
+    for(; i + BlockSize <= data.size(); i += BlockSize) {
+        for(size_t a = 0; a < AccumsNum; ++a) {
+            accums[a] = accums[a] + TFloatVec::Load(data.data() + i + a * TFloatVec::Lanes);
+        }
+    }
+    for(size_t a = 0; a < AccumsNum; ++a) {
+        accums[a].Store(partial + a * TFloatVec::Lanes);
+    }
+    // the tail goes to the same partial sums a full block would have used
+    for(size_t j = 0; i + j < data.size(); ++j) {
+        partial[j] += data[i + j];
+    }
+}
+
+// size must be a power of two
+REDUCE_SUM_INLINE float TreeReduce(float* partial, size_t size) {
+    for(size_t half = size / 2; half > 0; half /= 2) {
+        for(size_t j = 0; j < half; ++j) {
+            partial[j] += partial[j + half];
+        }
+    }
+    return partial[0];
+}
+
+REDUCE_SUM_INLINE float ReduceSumKernel(std::span<const float> data, ESumOrder order) {
+    switch(order) {
+        case ESumOrder::Sequential: {
+            float sum = 0;
+            for(float x : data) {
+                sum += x;
+            }
+            return sum;
+        }
+        case ESumOrder::Lanes32: {
+            static_assert(32 % TFloatVec::Lanes == 0);
+            float partial[32];
+            AccumulatePartialSums<32 / TFloatVec::Lanes>(data, partial);
+            return TreeReduce(partial, 32);
+        }
+        case ESumOrder::Unordered: {
+            constexpr size_t AccumsNum = 8;
+            float partial[AccumsNum * TFloatVec::Lanes];
+            AccumulatePartialSums<AccumsNum>(data, partial);
+            return TreeReduce(partial, AccumsNum * TFloatVec::Lanes);
+        }
+    }
+    return 0;
+}
+
+}
+
+}
+
+#undef REDUCE_SUM_INLINE
@@ -0,0 +1,80 @@
+#include "reduce_sum.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string_view>
+#include <vector>
+
+using TReduceSumImpl = float(std::span<const float>, NS::ESumOrder);
+
+struct TImpl {
+    std::string_view Name;
+    TReduceSumImpl* Func;
+    bool Supported;
+};
+
+constexpr std::pair<std::string_view, NS::ESumOrder> Orders[] = {
+    {"sequential", NS::ESumOrder::Sequential},
+    {"lanes32", NS::ESumOrder::Lanes32},
+    {"unordered", NS::ESumOrder::Unordered},
+};
+
+int main(int argc, const char* argv[]) {
+    // elements processed per measurement, split into calls of the given size
+    const size_t totalElems = argc > 1 ? atoll(argv[1]) : 1'000'000'000;
+    const NCpu::TCpuFeatures& features = NCpu::CpuFeatures();
+    const TImpl impls[] = {
+        {"common", &NS::ReduceSum_common, true},
+        {"sse4.2", &NS::ReduceSum_sse42, features.Sse42},
+        {"avx2", &NS::ReduceSum_avx2, features.Avx2},
+        {"avx512", &NS::ReduceSum_avx512, features.Avx512f},
+    };
+
+    std::mt19937 rng(2026);
+    std::uniform_real_distribution<float> dist(-1, 1);
+
+    // 128 is TData, odd sizes check tails, the biggest one doesn't fit L2
+    for(size_t size : {128ul, 1000ul, 1003ul, 16'384ul, 1'048'576ul}) {
+        std::vector<float> data(size);
+        for(auto& x : data) {
+            x = dist(rng);
+        }
+        const size_t calls = std::max(1ul, totalElems / size);
+        const float reference = std::accumulate(data.begin(), data.end(), 0.);
+
+        std::cout << "size " << size << " (" << calls << " calls, double precision sum " << reference << ")" << std::endl;
+        for(const auto& [orderName, order] : Orders) {
+            float lanes32Result = 0;
+            bool lanes32Same = true;
+            bool first = true;
+            for(const TImpl& impl : impls) {
+                if (!impl.Supported) {
+                    continue;
+                }
+                float accum = 0;
+                float result = impl.Func(data, order);
+                auto started = std::chrono::high_resolution_clock::now();
+                for(size_t i = 0; i < calls; ++i) {
+                    accum += impl.Func(data, order);
+                }
+                auto finished = std::chrono::high_resolution_clock::now();
+                const double ns = std::chrono::duration<double, std::nano>(finished - started).count();
+
+                std::cout << "  " << orderName << " " << impl.Name
+                    << ": " << ns / calls << " ns/call, " << calls * size * sizeof(float) / ns << " GB/s"
+                    << ", result " << result << " (checksum " << accum << ")" << std::endl;
+                if (order == NS::ESumOrder::Lanes32) {
+                    lanes32Same = lanes32Same && (first || result == lanes32Result);
+                    lanes32Result = result;
+                }
+                first = false;
+            }
+            if (order == NS::ESumOrder::Lanes32) {
+                std::cout << "  lanes32 bit-identical across ISA: " << (lanes32Same ? "yes" : "NO") << std::endl;
+            }
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,9 @@
+// compiled once per ISA: -DISA_NAMESPACE=<isa> together with the matching -m flags
+#include "reduce_sum.hpp"
+
+#define REDUCE_SUM_CONCAT_IMPL(a, b) a##b
+#define REDUCE_SUM_CONCAT(a, b) REDUCE_SUM_CONCAT_IMPL(a, b)
+
+float NS::REDUCE_SUM_CONCAT(ReduceSum_, ISA_NAMESPACE)(std::span<const float> data, ESumOrder order) {
+    return ReduceSumKernel(data, order);
+}
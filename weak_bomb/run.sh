@@ -1,4 +1,5 @@
 set -x -e
+# the bomb from post.md: both ISA specific TUs get the same NS::common::prepare
 clang++ -std=c++20 -c tu_avx512.cpp -o tu_avx512.a -msse4.2 -mavx -mavx2 -mavx512f
 clang++ -std=c++20 -c tu_common.cpp -o tu_common.a -msse4.2 -mavx -mavx2
 # for t in `ls *.a`; do  echo "$t"; objdump $t -t -C | grep prep; done
@@ -8,3 +9,31 @@ clang++ -std=c++20 main.cpp tu_common.a tu_avx512.a -o weak_bomb2.exe
 set -x +e
 ./weak_bomb.exe 
 ./weak_bomb2.exe 
+# and the leak check catches it
+bash check_isa_leaks.sh tu_avx512.a tu_common.a
+
+# the fix: each ISA specific TU gets its own namespace (see cpu_dispatch.hpp) and is built optimized,
+# so that std templates are inlined instead of being emitted as weak symbols
+set -x -e
+clang++ -std=c++20 -O2 -c tu_avx512.cpp -o tu_avx512.o -msse4.2 -mavx -mavx2 -mavx512f -DISA_NAMESPACE=avx512
+# the fallback of the dispatch: baseline flags, it runs on any x86-64
+clang++ -std=c++20 -O2 -c tu_common.cpp -o tu_common.o -DISA_NAMESPACE=common
+clang++ -std=c++20 -O2 -c tu_dispatch.cpp -o tu_dispatch.o
+clang++ -std=c++20 -O2 -c cpu_dispatch.cpp -o cpu_dispatch.o
+clang++ -std=c++20 -O2 -c main.cpp -o main.o
+clang++ -std=c++20 -O2 -c dispatch_bench.cpp -o dispatch_bench.o
+clang++ -std=c++20 -O2 -c reduce_sum_tu.cpp -o reduce_sum_common.o -DISA_NAMESPACE=common
+clang++ -std=c++20 -O2 -c reduce_sum_tu.cpp -o reduce_sum_sse42.o -msse4.2 -DISA_NAMESPACE=sse42
+clang++ -std=c++20 -O2 -c reduce_sum_tu.cpp -o reduce_sum_avx2.o -msse4.2 -mavx -mavx2 -DISA_NAMESPACE=avx2
+clang++ -std=c++20 -O2 -c reduce_sum_tu.cpp -o reduce_sum_avx512.o -msse4.2 -mavx -mavx2 -mavx512f -DISA_NAMESPACE=avx512
+clang++ -std=c++20 -O2 -c reduce_sum_bench.cpp -o reduce_sum_bench.o
+REDUCE_SUM_OBJS="reduce_sum_common.o reduce_sum_sse42.o reduce_sum_avx2.o reduce_sum_avx512.o"
+bash check_isa_leaks.sh tu_avx512.o reduce_sum_sse42.o reduce_sum_avx2.o reduce_sum_avx512.o \
+    -- tu_common.o tu_dispatch.o cpu_dispatch.o main.o dispatch_bench.o reduce_sum_common.o reduce_sum_bench.o
+
+clang++ main.o tu_avx512.o tu_common.o tu_dispatch.o cpu_dispatch.o $REDUCE_SUM_OBJS -o weak_bomb_fixed.exe
+./weak_bomb_fixed.exe
+clang++ dispatch_bench.o tu_avx512.o tu_common.o tu_dispatch.o cpu_dispatch.o $REDUCE_SUM_OBJS -o dispatch_bench.exe
+./dispatch_bench.exe | tee report_dispatch.txt
+clang++ reduce_sum_bench.o tu_avx512.o tu_common.o tu_dispatch.o cpu_dispatch.o $REDUCE_SUM_OBJS -o reduce_sum_bench.exe
+./reduce_sum_bench.exe | tee report_reduce_sum.txt
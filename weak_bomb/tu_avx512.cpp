@@ -1,7 +1,8 @@
 #include "header.hpp"
-#include <numeric>
+#include "reduce_sum.hpp"
 
 float NS::func_in_tu_avx512(TData& z) {
     prepare(z);
-    return std::accumulate(z.begin(), z.end(), 0);
+    // was std::accumulate(z.begin(), z.end(), 0): int accumulation, strictly serial
+    return ReduceSumKernel(z, ESumOrder::Lanes32);
 }
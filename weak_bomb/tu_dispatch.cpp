@@ -0,0 +1,64 @@
+#include "header.hpp"
+#include "reduce_sum.hpp"
+
+#include <atomic>
+
+namespace NS {
+
+using TFuncImpl = float(TData&);
+
+constexpr NCpu::TIsaImpls<TFuncImpl> FuncImpls = {
+    .Common = &func_in_tu_common,
+    .Avx512 = &func_in_tu_avx512,
+};
+
+namespace {
+    float ResolveFuncImpl(TData& z);
+
+    // constant initialized to the resolver: the first call chooses, whatever the order of static initialization
+    constinit std::atomic<TFuncImpl*> FuncImpl = &ResolveFuncImpl;
+
+    float ResolveFuncImpl(TData& z) {
+        TFuncImpl* impl = FuncImpls.Choose(NCpu::CpuFeatures());
+        FuncImpl.store(impl, std::memory_order_relaxed);
+        return impl(z);
+    }
+}
+
+float func_dispatched(TData& z) {
+    return FuncImpl.load(std::memory_order_relaxed)(z);
+}
+
+using TReduceSumImpl = float(std::span<const float>, ESumOrder);
+
+constexpr NCpu::TIsaImpls<TReduceSumImpl> ReduceSumImpls = {
+    .Common = &ReduceSum_common,
+    .Sse42 = &ReduceSum_sse42,
+    .Avx2 = &ReduceSum_avx2,
+    .Avx512 = &ReduceSum_avx512,
+};
+
+namespace {
+    float ResolveReduceSumImpl(std::span<const float> data, ESumOrder order);
+
+    // resolved on the first call, as FuncImpl
+    constinit std::atomic<TReduceSumImpl*> ReduceSumImpl = &ResolveReduceSumImpl;
+
+    float ResolveReduceSumImpl(std::span<const float> data, ESumOrder order) {
+        TReduceSumImpl* impl = ReduceSumImpls.Choose(NCpu::CpuFeatures());
+        ReduceSumImpl.store(impl, std::memory_order_relaxed);
+        return impl(data, order);
+    }
+}
+
+float ReduceSum(std::span<const float> data, ESumOrder order) {
+    return ReduceSumImpl.load(std::memory_order_relaxed)(data, order);
+}
+
+}
+
+extern "C" NS::TFuncImpl* ResolveFuncIfunc() {
+    return NS::FuncImpls.Choose(NCpu::DetectCpuFeatures());
+}
+
+float NS::func_ifunc(TData& z) __attribute__((ifunc("ResolveFuncIfunc")));
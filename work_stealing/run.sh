@@ -0,0 +1,4 @@
+set -x -e
+clang++ -std=c++20 work_stealing.cpp -o work_stealing.exe -Wall -O2 -DNDEBUG
+# args: [max threads] [pin workers, 0/1]
+BENCH_JSON=report.json ./work_stealing.exe | tee report.txt
@@ -0,0 +1,150 @@
+#include "work_stealing.hpp"
+#include "../bench/bench.hpp"
+#include "../snapshot_pool/snapshot_pool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// What a task costs in the pool vs a thread per task, and how fine the tasks may be before
+// the pool overhead eats the parallelism: efficiency is the serial time / (workers * parallel time).
+
+constexpr size_t ItemsNum = 1 << 22;
+
+// a few ns of work per item, no memory traffic; the serial baseline is the same function over the whole range
+__attribute__((noinline)) uint64_t Work(size_t begin, size_t end) {
+    uint64_t res = 0;
+    for(size_t i = begin; i < end; ++i) {
+        res += NSnapshotPool::CounterRandom(7, i);
+    }
+    return res;
+}
+
+void RunSpawn(NBench::TReporter& reporter, NWorkStealing::TPool& pool) {
+    const std::string suffix = ", " + std::to_string(pool.WorkersNum()) + " workers";
+    reporter.Add(NBench::Run("std::thread create + join", [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            std::thread t([]() {});
+            t.join();
+        }
+    }));
+    reporter.Add(NBench::Run("pool Run from outside" + suffix, [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            pool.Run([]() {});
+        }
+    }));
+    // the loop runs on a worker: b is pushed and popped back unless an idle worker steals it
+    reporter.Add(NBench::Run("pool Join of empty tasks" + suffix, [&](uint64_t iters) {
+        pool.Run([&]() {
+            for(uint64_t i = 0; i < iters; ++i) {
+                pool.Join([]() {}, []() {});
+            }
+        });
+    }));
+    NBench::TOptions options;
+    options.ItemsPerIteration = 1024;
+    reporter.Add(NBench::Run("pool ParallelFor, per empty piece" + suffix, [&](uint64_t iters) {
+        for(uint64_t i = 0; i < iters; ++i) {
+            pool.ParallelFor(0, 1024, 1, [](size_t, size_t) {});
+        }
+    }, options));
+}
+
+// serial below the cutoff: Fib(pool, n, n) is the serial baseline
+uint64_t Fib(NWorkStealing::TPool& pool, uint32_t n, uint32_t cutoff) {
+    if (n < 2) {
+        return n;
+    }
+    if (n <= cutoff) {
+        return Fib(pool, n - 1, cutoff) + Fib(pool, n - 2, cutoff);
+    }
+    uint64_t a = 0;
+    uint64_t b = 0;
+    pool.Join([&]() {a = Fib(pool, n - 1, cutoff);}, [&]() {b = Fib(pool, n - 2, cutoff);});
+    return a + b;
+}
+
+// ns per item of ParallelFor at the grain, and of fib with Join down to the cutoff
+void RunScaling(NBench::TReporter& reporter, size_t workersNum, bool pin, double serialNs, double serialFibNs) {
+    NWorkStealing::TPool pool({.Workers = workersNum, .Pin = pin});
+    const std::string suffix = ", " + std::to_string(workersNum) + " workers" + (pin ? ", pinned" : "");
+    auto add = [&](NBench::TStats stats, double serial) {
+        stats.AddCounter("workers", workersNum)
+            .AddCounter("efficiency_pct", serial / (workersNum * stats.MedianNs) * 100);
+        reporter.Add(std::move(stats));
+    };
+    for(size_t grain : {16, 256, 4096, 65536}) {
+        NBench::TOptions options;
+        options.ItemsPerIteration = ItemsNum;
+        options.Samples = 10;
+        std::atomic<uint64_t> sum = 0;
+        NBench::TStats stats = NBench::Run("ParallelFor, grain " + std::to_string(grain) + suffix, [&](uint64_t iters) {
+            for(uint64_t i = 0; i < iters; ++i) {
+                pool.ParallelFor(0, ItemsNum, grain, [&](size_t begin, size_t end) {
+                    sum.fetch_add(Work(begin, end), std::memory_order_relaxed);
+                });
+            }
+        }, options);
+        stats.AddCounter("grain", grain);
+        add(std::move(stats), serialNs);
+    }
+    for(uint32_t cutoff : {10, 20}) {
+        NBench::TOptions options;
+        options.Samples = 10;
+        uint64_t res = 0;
+        NBench::TStats stats = NBench::Run("fib(30), Join down to " + std::to_string(cutoff) + suffix, [&](uint64_t iters) {
+            for(uint64_t i = 0; i < iters; ++i) {
+                pool.Run([&]() {res += Fib(pool, 30, cutoff);});
+            }
+        }, options);
+        NBench::DoNotOptimize(res);
+        add(std::move(stats), serialFibNs);
+    }
+}
+
+int main(int argc, const char* argv[]) {
+    const size_t maxThreads = argc > 1 ? atoll(argv[1]) : std::max(4u, std::thread::hardware_concurrency());
+    const bool pin = argc > 2 && atoi(argv[2]);
+
+    NBench::TReporter reporter("work_stealing");
+    {
+        NWorkStealing::TPool pool({.Workers = maxThreads, .Pin = pin});
+        RunSpawn(reporter, pool);
+    }
+
+    NBench::TOptions options;
+    options.ItemsPerIteration = ItemsNum;
+    options.Samples = 10;
+    NBench::TStats serial = NBench::Run("serial loop", [&](uint64_t iters) {
+        uint64_t sum = 0;
+        size_t end = ItemsNum;
+        for(uint64_t i = 0; i < iters; ++i) {
+            // Work is pure: the same call would be done once
+            NBench::DoNotOptimize(end);
+            sum += Work(0, end);
+        }
+        NBench::DoNotOptimize(sum);
+    }, options);
+    const double serialNs = serial.MedianNs;
+    reporter.Add(std::move(serial));
+    options.ItemsPerIteration = 1;
+    // the cutoff is n: no Join, the pool is not used
+    NWorkStealing::TPool idle({.Workers = 1});
+    NBench::TStats serialFib = NBench::Run("serial fib(30)", [&](uint64_t iters) {
+        uint64_t res = 0;
+        for(uint64_t i = 0; i < iters; ++i) {
+            res += Fib(idle, 30, 30);
+        }
+        NBench::DoNotOptimize(res);
+    }, options);
+    const double serialFibNs = serialFib.MedianNs;
+    reporter.Add(std::move(serialFib));
+
+    for(size_t workersNum = 1; workersNum <= maxThreads; workersNum *= 2) {
+        RunScaling(reporter, workersNum, pin, serialNs, serialFibNs);
+    }
+    return 0;
+}
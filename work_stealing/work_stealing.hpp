@@ -0,0 +1,397 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// A work stealing pool for the experiments instead of a fresh std::thread per phase.
+//
+// Every worker has a Chase-Lev deque (Le, Pop, Cohen, Zappa Nardelli, "Correct and efficient work-stealing
+// for weak memory models", 2013): the owner pushes and pops at the bottom without a CAS, except for the last
+// element; thieves take the oldest task at the top with a CAS. The array grows, old arrays live until
+// the deque dies: a thief may still read them.
+//
+// Join(a, b) is the fork-join: b goes to the deque of the worker (on its stack, no allocation), a runs,
+// then b is popped back and run inline or, if it was stolen, the worker helps with other tasks until b is done.
+// ParallelFor(begin, end, grain, f) halves the range with Join down to grain, f(begin, end) per piece.
+// A call from a thread outside the pool is injected into a shared queue and waited for.
+//
+// Idle workers try to steal for a while, then park on a futex (std::atomic::wait) and are woken per pushed task.
+// Tasks that wait for each other (a start line for contention experiments) need as many workers as tasks:
+// the pool runs every task eventually, it doesn't promise to run them at once.
+
+namespace NWorkStealing {
+
+struct TTask {
+    void (*Execute)(TTask*);
+    std::atomic<bool> Done = false;
+};
+
+// a task on the stack of the one who waits for it
+template<class TFunc>
+struct TFuncTask : TTask {
+    explicit TFuncTask(TFunc& func)
+        : TTask{&Run}
+        , Func(func)
+    {}
+
+    static void Run(TTask* task) {
+        TFuncTask* self = static_cast<TFuncTask*>(task);
+        self->Func();
+        // the last touch: the waiter may destroy the task right after
+        self->Done.store(true, std::memory_order_release);
+    }
+
+    TFunc& Func;
+};
+
+// a task of a thread outside the pool: the thread sleeps until the task is done and may destroy it
+// only after the worker has released the lock
+template<class TFunc>
+struct TInjectedTask : TTask {
+    explicit TInjectedTask(TFunc& func)
+        : TTask{&Run}
+        , Func(func)
+    {}
+
+    static void Run(TTask* task) {
+        TInjectedTask* self = static_cast<TInjectedTask*>(task);
+        self->Func();
+        std::lock_guard g(self->Lock);
+        self->Done.store(true, std::memory_order_relaxed);
+        self->DoneCond.notify_one();
+    }
+
+    void Wait() {
+        std::unique_lock g(Lock);
+        DoneCond.wait(g, [this]() {return Done.load(std::memory_order_relaxed);});
+    }
+
+    TFunc& Func;
+    std::mutex Lock;
+    std::condition_variable DoneCond;
+};
+
+class TDeque {
+    struct TArray {
+        explicit TArray(int64_t size)
+            : Size(size)
+            , Tasks(new std::atomic<TTask*>[size])
+        {}
+
+        TTask* Get(int64_t i) const {return Tasks[i & (Size - 1)].load(std::memory_order_relaxed);}
+        void Put(int64_t i, TTask* task) {Tasks[i & (Size - 1)].store(task, std::memory_order_relaxed);}
+
+        const int64_t Size;
+        std::unique_ptr<std::atomic<TTask*>[]> Tasks;
+    };
+
+public:
+    explicit TDeque(int64_t size = 256) {
+        Arrays.push_back(std::make_unique<TArray>(size));
+        Array.store(Arrays.back().get(), std::memory_order_relaxed);
+    }
+
+    // the owner only
+    void Push(TTask* task) {
+        const int64_t b = Bottom.load(std::memory_order_relaxed);
+        const int64_t t = Top.load(std::memory_order_acquire);
+        TArray* array = Array.load(std::memory_order_relaxed);
+        if (b - t > array->Size - 1) {
+            array = Grow(array, t, b);
+        }
+        array->Put(b, task);
+        // a release store instead of the paper's release fence: the same on x86 and visible to tsan
+        Bottom.store(b + 1, std::memory_order_release);
+    }
+
+    // the owner only, the newest task
+    TTask* Pop() {
+        const int64_t b = Bottom.load(std::memory_order_relaxed) - 1;
+        TArray* array = Array.load(std::memory_order_relaxed);
+        Bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = Top.load(std::memory_order_relaxed);
+        if (t > b) {
+            Bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        TTask* task = array->Get(b);
+        if (t == b) {
+            // the last one, a race with the thieves
+            if (!Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+                task = nullptr;
+            }
+            Bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+
+    // anyone, the oldest task; nullptr when empty or lost a race
+    TTask* Steal() {
+        int64_t t = Top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        const int64_t b = Bottom.load(std::memory_order_acquire);
+        if (t >= b) {
+            return nullptr;
+        }
+        TTask* task = Array.load(std::memory_order_acquire)->Get(t);
+        if (!Top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        return task;
+    }
+
+    bool IsEmpty() const {
+        return Bottom.load(std::memory_order_relaxed) <= Top.load(std::memory_order_relaxed);
+    }
+
+private:
+    TArray* Grow(TArray* array, int64_t t, int64_t b) {
+        Arrays.push_back(std::make_unique<TArray>(array->Size * 2));
+        TArray* grown = Arrays.back().get();
+        for(int64_t i = t; i < b; ++i) {
+            grown->Put(i, array->Get(i));
+        }
+        Array.store(grown, std::memory_order_release);
+        return grown;
+    }
+
+    alignas(64) std::atomic<int64_t> Top = 0;
+    alignas(64) std::atomic<int64_t> Bottom = 0;
+    std::atomic<TArray*> Array;
+    // the owner only
+    std::vector<std::unique_ptr<TArray>> Arrays;
+};
+
+struct TOptions {
+    size_t Workers = std::max(1u, std::thread::hardware_concurrency());
+    // worker i on cpu i % cpus
+    bool Pin = false;
+    // failed steal rounds before parking
+    uint32_t SpinRounds = 64;
+};
+
+class TPool {
+    struct alignas(64) TWorker {
+        TDeque Deque;
+        uint64_t RandomState;
+        std::thread Thread;
+    };
+
+    // the worker of the current thread and its pool
+    static inline thread_local TPool* CurrentPool = nullptr;
+    static inline thread_local TWorker* CurrentWorker = nullptr;
+
+public:
+    explicit TPool(TOptions options = {})
+        : Options(options)
+    {
+        Options.Workers = std::max<size_t>(1, Options.Workers);
+        for(size_t i = 0; i < Options.Workers; ++i) {
+            Workers.emplace_back().RandomState = i * 0x9e3779b97f4a7c15ULL + 1;
+        }
+        for(size_t i = 0; i < Options.Workers; ++i) {
+            Workers[i].Thread = std::thread([this, i]() {WorkerLoop(Workers[i], i);});
+        }
+    }
+    TPool(const TPool&) = delete;
+    TPool& operator=(const TPool&) = delete;
+    ~TPool() {
+        Stop.store(true);
+        WakeEpoch.fetch_add(1);
+        WakeEpoch.notify_all();
+        for(TWorker& worker : Workers) {
+            worker.Thread.join();
+        }
+    }
+
+    size_t WorkersNum() const {
+        return Workers.size();
+    }
+
+    // a() and b() in parallel, returns when both are done
+    template<class TFuncA, class TFuncB>
+    void Join(TFuncA&& a, TFuncB&& b) {
+        TWorker* worker = CurrentPool == this ? CurrentWorker : nullptr;
+        if (!worker) {
+            Run([&]() {Join(a, b);});
+            return;
+        }
+        TFuncTask<TFuncB> taskB(b);
+        worker->Deque.Push(&taskB);
+        Wake();
+        a();
+        // the joins of a() are done, so b is on the bottom unless it was stolen
+        TTask* task = worker->Deque.Pop();
+        if (task == &taskB) {
+            taskB.Execute(&taskB);
+            return;
+        }
+        if (task) {
+            // a task of an outer Join: it stays for that Join
+            worker->Deque.Push(task);
+        }
+        while(!taskB.Done.load(std::memory_order_acquire)) {
+            // help while the thief runs b
+            if (TTask* stolen = StealFromOthers(*worker)) {
+                stolen->Execute(stolen);
+            } else {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    // func(pieceBegin, pieceEnd) over [begin, end) in pieces of at most grain
+    template<class TFunc>
+    void ParallelFor(size_t begin, size_t end, size_t grain, TFunc&& func) {
+        grain = std::max<size_t>(1, grain);
+        if (end - begin <= grain) {
+            if (begin < end) {
+                func(begin, end);
+            }
+            return;
+        }
+        const size_t middle = begin + (end - begin) / 2;
+        Join([&]() {ParallelFor(begin, middle, grain, func);}, [&]() {ParallelFor(middle, end, grain, func);});
+    }
+
+    // func() on a worker, returns when it is done
+    template<class TFunc>
+    void Run(TFunc&& func) {
+        if (CurrentPool == this) {
+            func();
+            return;
+        }
+        TInjectedTask task(func);
+        {
+            std::lock_guard g(InjectedLock);
+            Injected.push_back(&task);
+            InjectedNum.store(Injected.size(), std::memory_order_relaxed);
+        }
+        Wake();
+        task.Wait();
+    }
+
+private:
+    void WorkerLoop(TWorker& worker, size_t index) {
+        CurrentPool = this;
+        CurrentWorker = &worker;
+#if defined(__linux__)
+        if (Options.Pin) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(index % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+#endif
+        uint32_t idleRounds = 0;
+        while(!Stop.load(std::memory_order_relaxed)) {
+            TTask* task = worker.Deque.Pop();
+            if (!task) {
+                task = TakeInjected();
+            }
+            if (!task) {
+                task = StealFromOthers(worker);
+            }
+            if (task) {
+                task->Execute(task);
+                idleRounds = 0;
+                continue;
+            }
+            if (++idleRounds < Options.SpinRounds) {
+                std::this_thread::yield();
+                continue;
+            }
+            Park();
+            idleRounds = 0;
+        }
+    }
+
+    TTask* TakeInjected() {
+        if (!InjectedNum.load(std::memory_order_relaxed)) {
+            return nullptr;
+        }
+        std::lock_guard g(InjectedLock);
+        if (Injected.empty()) {
+            return nullptr;
+        }
+        TTask* task = Injected.front();
+        Injected.pop_front();
+        InjectedNum.store(Injected.size(), std::memory_order_relaxed);
+        return task;
+    }
+
+    // a round over the other workers from a random one
+    TTask* StealFromOthers(TWorker& thief) {
+        const size_t n = Workers.size();
+        uint64_t& x = thief.RandomState;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        const size_t start = x % n;
+        for(size_t i = 0; i < n; ++i) {
+            TWorker& victim = Workers[(start + i) % n];
+            if (&victim == &thief) {
+                continue;
+            }
+            if (TTask* task = victim.Deque.Steal()) {
+                return task;
+            }
+        }
+        return nullptr;
+    }
+
+    bool HasWork() const {
+        if (InjectedNum.load(std::memory_order_relaxed)) {
+            return true;
+        }
+        for(const TWorker& worker : Workers) {
+            if (!worker.Deque.IsEmpty()) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // a pusher publishes its task and then reads Sleepers, a sleeper counts itself and then looks for tasks:
+    // with the seq_cst fence and RMW one of them sees the other
+    void Park() {
+        const uint32_t epoch = WakeEpoch.load();
+        Sleepers.fetch_add(1);
+        if (!HasWork() && !Stop.load()) {
+            WakeEpoch.wait(epoch);
+        }
+        Sleepers.fetch_sub(1);
+    }
+
+    void Wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (Sleepers.load(std::memory_order_relaxed)) {
+            WakeEpoch.fetch_add(1);
+            WakeEpoch.notify_one();
+        }
+    }
+
+    TOptions Options;
+    std::deque<TWorker> Workers;
+    std::mutex InjectedLock;
+    std::deque<TTask*> Injected;
+    std::atomic<size_t> InjectedNum = 0;
+    alignas(64) std::atomic<uint32_t> Sleepers = 0;
+    alignas(64) std::atomic<uint32_t> WakeEpoch = 0;
+    std::atomic<bool> Stop = false;
+};
+
+}